@@ -0,0 +1,297 @@
+#include <link.h>
+
+#include "FunctionInstrument.h"
+#include "Symbol.h"
+
+static void ResetFunctionInstrumentInChild()
+{
+	FunctionInstrument::GetInstance()->ResetInChild();
+}
+
+FunctionInstrument::FunctionInstrument()
+	:_unresolvedCount(0)
+{
+	pthread_atfork(NULL, NULL, ResetFunctionInstrumentInChild);
+}
+
+void FunctionInstrument::ResetInChild()
+{
+	RebuildInChild(_mutex);
+}
+
+FunctionEntry* FunctionInstrument::Find(void* address)
+{
+	bool excluded = false;
+	{
+		unique_lock<mutex> Lock(_mutex);
+		auto it = _entries.find(address);
+		if (it != _entries.end())
+			return it->second;
+
+		excluded = _IsExcluded(address);
+	}
+
+	// 在锁外注册剖析段，输出报告时先持有Performance的锁再解析符号
+	PerformanceSection* section = NULL;
+	if (!excluded)
+	{
+		// 剖析段注册时用地址作占位函数名，报告时替换为符号名
+		char name[32];
+		snprintf(name, sizeof(name), "0x%llx", (unsigned long long)(uintptr_t)address);
+		section = Performance::GetInstance()->CreateSection("", name, 0, "", false);
+	}
+
+	unique_lock<mutex> Lock(_mutex);
+	auto it = _entries.find(address);
+	if (it != _entries.end())
+		return it->second;
+
+	FunctionEntry* entry = new FunctionEntry(address, section, excluded);
+	_entries[address] = entry;
+	if (section)
+		++_unresolvedCount;
+
+	return entry;
+}
+
+void FunctionInstrument::Exclude(const void* begin, const void* end)
+{
+	unique_lock<mutex> Lock(_mutex);
+	_excludes.push_back(make_pair((uintptr_t)begin, (uintptr_t)end));
+
+	auto it = _entries.begin();
+	for (; it != _entries.end(); ++it)
+	{
+		if (_IsExcluded(it->first))
+			it->second->_excluded.store(true, memory_order_relaxed);
+	}
+}
+
+struct ModuleRange
+{
+	uintptr_t _address;
+	uintptr_t _begin;
+	uintptr_t _end;
+};
+
+static int FindModuleRange(struct dl_phdr_info* info, size_t, void* data)
+{
+	ModuleRange* range = (ModuleRange*)data;
+	uintptr_t begin = UINTPTR_MAX, end = 0;
+	for (int i = 0; i < info->dlpi_phnum; ++i)
+	{
+		const ElfW(Phdr)& phdr = info->dlpi_phdr[i];
+		if (phdr.p_type != PT_LOAD)
+			continue;
+
+		begin = min(begin, (uintptr_t)(info->dlpi_addr + phdr.p_vaddr));
+		end = max(end, (uintptr_t)(info->dlpi_addr + phdr.p_vaddr + phdr.p_memsz));
+	}
+
+	if (range->_address < begin || range->_address >= end)
+		return 0;
+
+	range->_begin = begin;
+	range->_end = end;
+	return 1;
+}
+
+bool FunctionInstrument::ExcludeModule(const void* address)
+{
+	ModuleRange range;
+	range._address = (uintptr_t)address;
+	if (dl_iterate_phdr(FindModuleRange, &range) == 0)
+		return false;
+
+	Exclude((const void*)range._begin, (const void*)range._end);
+	return true;
+}
+
+bool FunctionInstrument::_IsExcluded(const void* address)
+{
+	uintptr_t value = (uintptr_t)address;
+	for (size_t i = 0; i < _excludes.size(); ++i)
+	{
+		if (value >= _excludes[i].first && value < _excludes[i].second)
+			return true;
+	}
+
+	return false;
+}
+
+void FunctionInstrument::ResolveSymbols()
+{
+	vector<FunctionEntry*> entries;
+	{
+		unique_lock<mutex> Lock(_mutex);
+		if (_unresolvedCount == 0)
+			return;
+
+		auto it = _entries.begin();
+		for (; it != _entries.end(); ++it)
+		{
+			FunctionEntry* entry = it->second;
+			if (entry->_section && !entry->_resolved)
+				entries.push_back(entry);
+		}
+	}
+
+	// 在锁外加载符号表，第一次执行到新函数的线程不等待解析
+	vector<SectionSymbol> symbols(entries.size());
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		symbols[i]._section = entries[i]->_section;
+		SymbolResolver::GetInstance()->Resolve(entries[i]->_address,
+			symbols[i]._symbol, symbols[i]._module);
+	}
+
+	Performance::GetInstance()->SetSymbols(symbols);
+
+	// 并发输出报告时同一函数可能被解析两次，只计一次
+	unique_lock<mutex> Lock(_mutex);
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		if (!entries[i]->_resolved)
+		{
+			entries[i]->_resolved = true;
+			--_unresolvedCount;
+		}
+	}
+}
+///////////////////////////////////////////////////////////////
+// -finstrument-functions钩子
+
+//
+// 插桩函数栈帧
+//
+struct FunctionFrame
+{
+	void* _address;
+	PerformanceSection* _section;
+};
+
+//
+// 函数地址缓存项，直接映射，冲突时覆盖
+//
+struct FunctionCacheItem
+{
+	void* _address;
+	FunctionEntry* _entry;
+};
+
+//
+// 线程的插桩状态，零初始化的__thread变量，不需要构造和析构。
+// 影子栈记录已开始剖析的函数，出口时与栈顶核对，
+// 开启插桩前已经进入的函数和被排除的函数不在栈上，出口时直接忽略。
+//
+struct FunctionThreadState
+{
+	bool _inHook;										// 正在钩子中，避免钩子调用的插桩代码递归
+	int _depth;											// 影子栈深度，可能超过PP_FUNC_STACK_DEPTH
+	FunctionCacheItem _cache[PP_FUNC_CACHE_SIZE];		// 函数地址缓存
+	FunctionFrame _stack[PP_FUNC_STACK_DEPTH];			// 影子栈
+};
+
+static __thread FunctionThreadState s_functionState;
+
+static inline FunctionEntry* LookupFunction(FunctionThreadState& state, void* address)
+{
+	FunctionCacheItem& item = state._cache[((uintptr_t)address >> 4) & (PP_FUNC_CACHE_SIZE - 1)];
+	if (item._address != address)
+	{
+		item._entry = FunctionInstrument::GetInstance()->Find(address);
+		item._address = address;
+	}
+
+	return item._entry;
+}
+
+// 只查缓存，不注册函数，出口处用来判断不在栈顶的函数是否被排除
+static inline FunctionEntry* PeekFunction(FunctionThreadState& state, void* address)
+{
+	FunctionCacheItem& item = state._cache[((uintptr_t)address >> 4) & (PP_FUNC_CACHE_SIZE - 1)];
+	return item._address == address ? item._entry : NULL;
+}
+
+extern "C"
+{
+
+void __cyg_profile_func_enter(void* function, void* callSite) __attribute__((no_instrument_function));
+void __cyg_profile_func_exit(void* function, void* callSite) __attribute__((no_instrument_function));
+
+void __cyg_profile_func_enter(void* function, void* callSite)
+{
+	if (!OptionManager::IsEnabled(PPCO_FUNC_INSTRUMENT)
+		|| !OptionManager::IsEnabled(PPCO_PROFILER))
+		return;
+
+	FunctionThreadState& state = s_functionState;
+	if (state._inHook)
+		return;
+
+	state._inHook = true;
+
+	FunctionEntry* entry = LookupFunction(state, function);
+	if (!entry->_excluded.load(memory_order_relaxed))
+	{
+		if (state._depth < PP_FUNC_STACK_DEPTH)
+		{
+			FunctionFrame& frame = state._stack[state._depth];
+			frame._address = function;
+			frame._section = entry->_section;
+			entry->_section->Begin(GetThreadId());
+		}
+
+		++state._depth;
+	}
+
+	state._inHook = false;
+}
+
+void __cyg_profile_func_exit(void* function, void* callSite)
+{
+	FunctionThreadState& state = s_functionState;
+	if (state._depth == 0 || state._inHook)
+		return;
+
+	state._inHook = true;
+
+	if (state._depth > PP_FUNC_STACK_DEPTH)
+	{
+		// 超过跟踪深度的调用只计深度，不做剖析
+		if (!LookupFunction(state, function)->_excluded.load(memory_order_relaxed))
+			--state._depth;
+	}
+	else if (state._stack[state._depth - 1]._address == function)
+	{
+		--state._depth;
+		state._stack[state._depth]._section->End(GetThreadId());
+	}
+	else
+	{
+		FunctionEntry* entry = PeekFunction(state, function);
+		if (entry && entry->_excluded.load(memory_order_relaxed))
+		{
+			state._inHook = false;
+			return;
+		}
+
+		// longjmp等跳过了内层函数的出口，结束到匹配的栈帧为止
+		int index = state._depth - 2;
+		while (index >= 0 && state._stack[index]._address != function)
+			--index;
+
+		if (index >= 0)
+		{
+			while (state._depth > index)
+			{
+				--state._depth;
+				state._stack[state._depth]._section->End(GetThreadId());
+			}
+		}
+	}
+
+	state._inHook = false;
+}
+
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <unordered_map>
+
+#include "Performance.h"
+
+//
+// 函数级自动插桩
+// 用-finstrument-functions编译的代码在每个函数的入口和出口调用
+// __cyg_profile_func_enter/__cyg_profile_func_exit，libperformance提供这两个钩子。
+// 开启PPCO_PROFILER和PPCO_FUNC_INSTRUMENT后，每个函数按地址对应一个剖析段，
+// 和手工剖析段出现在同一份报告和调用树中。
+// 符号名在输出报告时才通过ELF符号表和dladdr解析，钩子里只做地址查找。
+//
+
+// 每个线程的函数地址缓存项数，必须是2的幂
+#ifndef PP_FUNC_CACHE_SIZE
+#define PP_FUNC_CACHE_SIZE 256
+#endif
+
+// 每个线程跟踪的函数调用深度，更深的调用不做剖析
+#ifndef PP_FUNC_STACK_DEPTH
+#define PP_FUNC_STACK_DEPTH 256
+#endif
+
+//
+// 插桩函数，每个函数地址一项，在进程生命期内一直有效。
+//
+struct FunctionEntry
+{
+	void* _address;					// 函数地址
+	PerformanceSection* _section;	// 对应的剖析段，注册时已被排除的函数为NULL
+	atomic<bool> _excluded;			// 是否被排除
+	bool _resolved;					// 是否已解析符号名，持有FunctionInstrument的锁时读写
+
+	FunctionEntry(void* address, PerformanceSection* section, bool excluded)
+		:_address(address)
+		, _section(section)
+		, _excluded(excluded)
+		, _resolved(false)
+	{}
+};
+
+class FunctionInstrument : public Singleton<FunctionInstrument>
+{
+	friend class Singleton<FunctionInstrument>;
+public:
+	// 查找或注册函数，每个线程第一次执行到该函数时调用
+	FunctionEntry* Find(void* address);
+
+	// 排除[begin, end)地址范围内的函数
+	void Exclude(const void* begin, const void* end);
+
+	// 排除@address所在的整个模块(可执行文件或动态库)，找不到模块时返回false
+	bool ExcludeModule(const void* address);
+
+	//
+	// 解析新注册函数的符号名并设置到剖析段。
+	// 在输出报告前调用，调用方不能持有Performance的锁，符号表在锁外加载。
+	//
+	void ResolveSymbols();
+
+	// fork出的子进程中重建锁，fork时可能被父进程的其他线程持有
+	void ResetInChild();
+
+protected:
+	FunctionInstrument();
+
+private:
+	// 地址是否在排除范围内，调用方持有_mutex
+	bool _IsExcluded(const void* address);
+
+private:
+	mutex _mutex;
+	unordered_map<void*, FunctionEntry*> _entries;			// 按函数地址索引
+	vector<pair<uintptr_t, uintptr_t> > _excludes;			// 排除的地址范围
+	int _unresolvedCount;									// 未解析符号名的函数数
+};
+
+#ifndef PP_DISABLE_PROFILER
+
+//
+// 排除[begin, end)地址范围内的函数，不做自动插桩剖析
+//
+#define SET_PERFORMANCE_INSTRUMENT_EXCLUDE(begin, end)	\
+	FunctionInstrument::GetInstance()->Exclude(begin, end)
+
+//
+// 排除@address所在模块的所有函数，如传入某个第三方库中的函数地址
+//
+#define SET_PERFORMANCE_INSTRUMENT_EXCLUDE_MODULE(address)	\
+	FunctionInstrument::GetInstance()->ExcludeModule(address)
+
+#else // PP_DISABLE_PROFILER
+
+#define SET_PERFORMANCE_INSTRUMENT_EXCLUDE(begin, end) ((void)0)
+#define SET_PERFORMANCE_INSTRUMENT_EXCLUDE_MODULE(address) ((void)0)
+
+#endif // PP_DISABLE_PROFILER
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <math.h>
+#include <string.h>
+#include <atomic>
+
+//
+// 对数线性直方图(HdrHistogram风格)
+// 每个2的幂区间[2^e, 2^(e+1))再等分为HISTOGRAM_SUB_BUCKETS个子桶，
+// 相对误差不超过1/HISTOGRAM_SUB_BUCKETS，内存固定，记录为O(1)。
+// 记录值的单位是纳秒，超过2^HISTOGRAM_MAX_EXPONENT(约18分钟)的值记入最后一个桶。
+//
+#define HISTOGRAM_SUB_BUCKET_BITS 4
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_MAX_EXPONENT 40
+#define HISTOGRAM_BUCKET_COUNT \
+	(HISTOGRAM_SUB_BUCKETS * (HISTOGRAM_MAX_EXPONENT - HISTOGRAM_SUB_BUCKET_BITS + 1))
+
+// 值所在桶的下标
+inline int HistogramBucketIndex(long long value)
+{
+	if (value < HISTOGRAM_SUB_BUCKETS)
+	{
+		return value < 0 ? 0 : (int)value;
+	}
+
+	int exponent = 63 - __builtin_clzll((unsigned long long)value);
+	if (exponent >= HISTOGRAM_MAX_EXPONENT)
+	{
+		return HISTOGRAM_BUCKET_COUNT - 1;
+	}
+
+	int shift = exponent - HISTOGRAM_SUB_BUCKET_BITS;
+	int subBucket = (int)(value >> shift) - HISTOGRAM_SUB_BUCKETS;
+	return (shift + 1) * HISTOGRAM_SUB_BUCKETS + subBucket;
+}
+
+// 桶内的最大值
+inline long long HistogramBucketUpperValue(int index)
+{
+	if (index < HISTOGRAM_SUB_BUCKETS)
+	{
+		return index;
+	}
+
+	int shift = index / HISTOGRAM_SUB_BUCKETS - 1;
+	long long mantissa = index % HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKETS;
+	return ((mantissa + 1) << shift) - 1;
+}
+
+//
+// 线程私有的直方图，只由所属线程记录，报告线程合并读取。
+//
+struct LatencyHistogram
+{
+	std::atomic<long long> _counts[HISTOGRAM_BUCKET_COUNT];	// 各桶计数
+	std::atomic<long long> _count;		// 记录次数
+	std::atomic<long long> _min;		// 最小值
+	std::atomic<long long> _max;		// 最大值
+	std::atomic<double> _sum;			// 值的和
+	std::atomic<double> _sumSquare;		// 值的平方和，用于计算标准差
+
+	LatencyHistogram()
+		:_count(0)
+		, _min(0)
+		, _max(0)
+		, _sum(0)
+		, _sumSquare(0)
+	{
+		for (int i = 0; i < HISTOGRAM_BUCKET_COUNT; ++i)
+		{
+			_counts[i].store(0, std::memory_order_relaxed);
+		}
+	}
+
+	void Record(long long value)
+	{
+		std::atomic<long long>& bucket = _counts[HistogramBucketIndex(value)];
+		bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+		long long count = _count.load(std::memory_order_relaxed);
+		if (count == 0 || value < _min.load(std::memory_order_relaxed))
+			_min.store(value, std::memory_order_relaxed);
+		if (value > _max.load(std::memory_order_relaxed))
+			_max.store(value, std::memory_order_relaxed);
+
+		double v = (double)value;
+		_sum.store(_sum.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+		_sumSquare.store(_sumSquare.load(std::memory_order_relaxed) + v * v, std::memory_order_relaxed);
+		_count.store(count + 1, std::memory_order_relaxed);
+	}
+};
+
+//
+// 合并后的直方图快照，输出报告时使用。
+//
+struct HistogramSnapshot
+{
+	long long _counts[HISTOGRAM_BUCKET_COUNT];
+	long long _count;
+	long long _min;
+	long long _max;
+	double _sum;
+	double _sumSquare;
+
+	HistogramSnapshot()
+	{
+		Reset();
+	}
+
+	void Reset()
+	{
+		memset(_counts, 0, sizeof(_counts));
+		_count = 0;
+		_min = 0;
+		_max = 0;
+		_sum = 0;
+		_sumSquare = 0;
+	}
+
+	void Merge(const LatencyHistogram& h)
+	{
+		long long count = h._count.load(std::memory_order_relaxed);
+		if (count == 0)
+			return;
+
+		for (int i = 0; i < HISTOGRAM_BUCKET_COUNT; ++i)
+		{
+			_counts[i] += h._counts[i].load(std::memory_order_relaxed);
+		}
+
+		long long minValue = h._min.load(std::memory_order_relaxed);
+		long long maxValue = h._max.load(std::memory_order_relaxed);
+		if (_count == 0 || minValue < _min)
+			_min = minValue;
+		if (maxValue > _max)
+			_max = maxValue;
+
+		_count += count;
+		_sum += h._sum.load(std::memory_order_relaxed);
+		_sumSquare += h._sumSquare.load(std::memory_order_relaxed);
+	}
+
+	double Mean() const
+	{
+		return _count ? _sum / _count : 0.0;
+	}
+
+	double StdDev() const
+	{
+		if (_count == 0)
+			return 0.0;
+
+		double mean = Mean();
+		double variance = _sumSquare / _count - mean * mean;
+		return variance > 0 ? sqrt(variance) : 0.0;
+	}
+
+	//
+	// 百分位数(0 < percentile <= 100)，返回所在桶的最大值，并限定在[min, max]内。
+	//
+	long long Percentile(double percentile) const
+	{
+		if (_count == 0)
+			return 0;
+
+		// 以桶计数之和为准，避免并发记录时_count与各桶计数不一致
+		long long total = 0;
+		for (int i = 0; i < HISTOGRAM_BUCKET_COUNT; ++i)
+		{
+			total += _counts[i];
+		}
+
+		long long rank = (long long)ceil(percentile / 100.0 * total);
+		if (rank < 1)
+			rank = 1;
+
+		long long seen = 0;
+		for (int i = 0; i < HISTOGRAM_BUCKET_COUNT; ++i)
+		{
+			seen += _counts[i];
+			if (seen >= rank)
+			{
+				long long value = HistogramBucketUpperValue(i);
+				if (value > _max)
+					value = _max;
+				if (value < _min)
+					value = _min;
+				return value;
+			}
+		}
+
+		return _max;
+	}
+};
@@ -1,12 +1,23 @@
 #pragma once
 
+#include<stdio.h>
+#include<errno.h>
 #include<string.h>
+#include<stdint.h>
 #include<unistd.h>
-#include<sys/ipc.h>
 #include<sys/types.h>
 #include<sys/stat.h>
+#include<sys/socket.h>
+#include<sys/un.h>
+#include<sys/epoll.h>
+#include<sys/eventfd.h>
+#include<arpa/inet.h>
 #include<fcntl.h>
 
+#include<string>
+#include<map>
+#include<functional>
+
 using namespace std;
 
 // 记录错误日志
@@ -18,184 +29,528 @@ static void RecordErrorLog(const char* errMsg, int line)
 #define RECORD_ERROR_LOG(errMsg)	\
 	RecordErrorLog(errMsg, __LINE__)
 
-class NamePipeSender
+//
+// IPC消息帧：4字节网络字节序的长度 + 消息内容。
+// 请求是一帧；回复由若干帧组成，以长度为0的帧结束，所以回复大小没有上限。
+//
+const size_t IPC_FRAME_HEADER_LEN = 4;
+const size_t IPC_MAX_REQUEST_LEN = 64 * 1024;	// 请求最大长度
+const size_t IPC_REPLY_CHUNK_LEN = 64 * 1024;	// 回复分帧的长度
+
+// IPC服务的目录，不存在时创建
+const char* const IPC_DIRECTORY = "/tmp/performance_profiler";
+
+inline void AppendFrame(string& buf, const char* msg, size_t msgLen)
 {
-public:
-	NamePipeSender(const char* pipeName)
-		:_pipeName(pipeName)
-	{}
+	uint32_t len = htonl((uint32_t)msgLen);
+	buf.append((const char*)&len, IPC_FRAME_HEADER_LEN);
+	buf.append(msg, msgLen);
+}
 
-	bool Connect()
+// 把回复拆成若干帧，最后追加结束帧
+inline void AppendReplyFrames(string& buf, const string& reply)
+{
+	for (size_t pos = 0; pos < reply.size(); pos += IPC_REPLY_CHUNK_LEN)
 	{
-		return true;
+		size_t len = reply.size() - pos;
+		if (len > IPC_REPLY_CHUNK_LEN)
+			len = IPC_REPLY_CHUNK_LEN;
+
+		AppendFrame(buf, reply.data() + pos, len);
 	}
 
-	bool SendMsg(const char* msg, size_t msgLen, size_t& realSize)
-	{
+	AppendFrame(buf, "", 0);
+}
 
-		int pipe_fd = open(_pipeName.c_str(), O_WRONLY| O_NONBLOCK);
-		int ret = write(pipe_fd, msg, msgLen);
-		if (ret == 0)
+// 阻塞写完全部数据
+// 套接字用send(MSG_NOSIGNAL)发送，对端关闭时返回EPIPE而不是触发SIGPIPE终止进程，
+// 文件等非套接字返回ENOTSOCK后改用write
+inline bool WriteAll(int fd, const char* buf, size_t len)
+{
+	bool isSocket = true;
+	while (len > 0)
+	{
+		ssize_t ret = isSocket ? send(fd, buf, len, MSG_NOSIGNAL) : write(fd, buf, len);
+		if (ret < 0)
 		{
+			if (errno == EINTR)
+				continue;
+			if (errno == ENOTSOCK && isSocket)
+			{
+				isSocket = false;
+				continue;
+			}
 			return false;
 		}
 
-		realSize = ret;
-		close(pipe_fd);
-		return true;
+		buf += ret;
+		len -= ret;
 	}
 
-	bool GetReplyMsg(char* msg, size_t msgLen, size_t realLen)
+	return true;
+}
+
+// 阻塞读满len字节
+inline bool ReadAll(int fd, char* buf, size_t len)
+{
+	while (len > 0)
 	{
-		int pipe_fd = open(_pipeName.c_str(), O_RDONLY);
-		int ret = read(pipe_fd, msg, msgLen);
-		if (ret == 0)
-		{
+		ssize_t ret = read(fd, buf, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
 			return false;
-		}
-		msg[ret] = '\0';
 
-		realLen = ret;
-		close(pipe_fd);
-		return true;
+		buf += ret;
+		len -= ret;
 	}
-private:
-	string _pipeName;
-};
 
-class NamePipeReceiver
+	return true;
+}
+
+// IPC客户端，使用持久连接
+class IPCClient
 {
 public:
-	NamePipeReceiver(const char* pipeName)
-		:_pipeName(pipeName)
+	IPCClient(const char* serverName)
+		:_serverName(serverName)
+		, _fd(-1)
 	{}
 
-	bool Listen()
+	~IPCClient()
+	{
+		Close();
+	}
+
+	// 连接服务端
+	bool Connect()
 	{
+		if (_fd >= 0)
+			return true;
+
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, _serverName.c_str(), sizeof(addr.sun_path) - 1);
 
-		int ret= 0;
-		ret = mkfifo(_pipeName.c_str(), 0777);
-		if (ret != 0)
+		_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (_fd < 0)
 		{
-			RECORD_ERROR_LOG(to_string((long long)ret).c_str());
+			RECORD_ERROR_LOG("Client Socket Error");
+			return false;
+		}
+
+		if (connect(_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+		{
+			RECORD_ERROR_LOG("Client Connect Error");
+			Close();
 			return false;
 		}
 
 		return true;
 	}
 
-	bool ReceiverMsg(char* msg, size_t msgLen, size_t &realLen)
+	void Close()
 	{
+		if (_fd >= 0)
+		{
+			close(_fd);
+			_fd = -1;
+		}
+	}
 
-		int pipe_fd = open(_pipeName.c_str(), O_RDONLY);
-		int ret = read(pipe_fd, msg, msgLen);
-		if (ret == 0)
+	// 发送消息给服务端
+	bool SendMsg(const char* buf, size_t bufLen)
+	{
+		if (!Connect())
+			return false;
+
+		string frame;
+		AppendFrame(frame, buf, bufLen);
+		if (!WriteAll(_fd, frame.data(), frame.size()))
 		{
+			RECORD_ERROR_LOG("Client SendMsg Error");
+			Close();
 			return false;
 		}
-		msg[ret] = '\0';
 
-		realLen = ret;
-		close(pipe_fd);
 		return true;
 	}
 
-	bool SendReplyMsg(const char* msg, size_t msgLen, size_t& realSize)
+	// 获取服务端回复消息，读到结束帧为止
+	bool GetReplyMsg(string& reply)
 	{
-
-		int pipe_fd = open(_pipeName.c_str(), O_WRONLY| O_NONBLOCK);
-		int ret = write(pipe_fd, msg, msgLen);
-		if (ret == 0)
+		reply.clear();
+		while (_fd >= 0)
 		{
-			return false;
+			uint32_t len = 0;
+			if (!ReadAll(_fd, (char*)&len, IPC_FRAME_HEADER_LEN))
+				break;
+
+			len = ntohl(len);
+			if (len == 0)
+				return true;
+
+			size_t oldSize = reply.size();
+			reply.resize(oldSize + len);
+			if (!ReadAll(_fd, &reply[oldSize], len))
+				break;
 		}
 
-		realSize = ret;
-		close(pipe_fd);
-		return true;
+		RECORD_ERROR_LOG("Client GetReplyMsg Error");
+		Close();
+		return false;
 	}
 
 private:
-	string _pipeName;
+	string _serverName;		// 服务端套接字路径
+	int _fd;				// 连接
 };
 
-// IPC客户端
-class IPCClient
+//
+// IPC服务端
+// 基于epoll的Unix域套接字服务，保持持久连接，可同时服务多个客户端。
+// 每个连接的待发送数据先缓存，套接字可写时再继续发送。
+//
+class IPCServer
 {
 public:
-	IPCClient(const char* serverName)
-		:_sender(serverName)
-	{}
+	// 消息处理函数，根据请求生成回复
+	typedef function<void(const string& msg, string& reply)> MsgHandler;
 
-	~IPCClient()
+	IPCServer(const char* serverName)
+		:_serverName(serverName)
+		, _listenFd(-1)
+		, _epollFd(-1)
+		, _stopFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
 	{}
 
-	// 发送消息给服务端
-	void SendMsg(char* buf, size_t bufLen)
+	~IPCServer()
 	{
-		size_t realLen;
-		if (!_sender.Connect())
+		Close();
+		if (_stopFd >= 0)
 		{
-			RECORD_ERROR_LOG("Client Connect Error\n");
+			close(_stopFd);
+			_stopFd = -1;
 		}
+	}
 
-		if (!_sender.SendMsg(buf, bufLen, realLen))
+	// 关闭所有连接并删除套接字文件，须在Run返回后调用
+	void Close()
+	{
+		map<int, Connection>::iterator it = _connections.begin();
+		for (; it != _connections.end(); ++it)
 		{
-			RECORD_ERROR_LOG("Client SendMsg Error\n");
+			close(it->first);
+		}
+		_connections.clear();
+
+		if (_listenFd >= 0)
+		{
+			close(_listenFd);
+			unlink(_serverName.c_str());
+			_listenFd = -1;
+		}
+		if (_epollFd >= 0)
+		{
+			close(_epollFd);
+			_epollFd = -1;
 		}
 	}
 
-	// 获取服务端回复消息
-	void GetReplyMsg(char* buf, size_t bufLen)
+	//
+	// fork出的子进程中关闭继承的描述符，它们属于父进程的服务，不删除套接字文件。
+	// 之后用@serverName重新Listen
+	//
+	void ResetInChild(const char* serverName)
 	{
-		size_t realLen = 0;
-		if (!_sender.GetReplyMsg(buf, bufLen, realLen))
+		map<int, Connection>::iterator it = _connections.begin();
+		for (; it != _connections.end(); ++it)
 		{
-			RECORD_ERROR_LOG("Client GetReplyMsg Error\n");
+			close(it->first);
+		}
+		_connections.clear();
+
+		if (_listenFd >= 0)
+		{
+			close(_listenFd);
+			_listenFd = -1;
+		}
+		if (_epollFd >= 0)
+		{
+			close(_epollFd);
+			_epollFd = -1;
+		}
+		if (_stopFd >= 0)
+		{
+			close(_stopFd);
+		}
+
+		_stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		_serverName = serverName;
+	}
+
+	bool Listen()
+	{
+		// 目录不存在时创建，多个用户共用目录
+		if (mkdir(IPC_DIRECTORY, 0777) == 0)
+		{
+			chmod(IPC_DIRECTORY, 0777);
+		}
+
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, _serverName.c_str(), sizeof(addr.sun_path) - 1);
+
+		// 删除同pid旧进程残留的套接字文件
+		unlink(_serverName.c_str());
+
+		_listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (_listenFd < 0
+			|| bind(_listenFd, (struct sockaddr*)&addr, sizeof(addr)) != 0
+			|| listen(_listenFd, 16) != 0)
+		{
+			RECORD_ERROR_LOG("Server Listen Error");
+			return false;
+		}
+
+		_epollFd = epoll_create1(EPOLL_CLOEXEC);
+		if (_epollFd < 0 || _stopFd < 0)
+		{
+			RECORD_ERROR_LOG("Server Epoll Error");
+			return false;
+		}
+
+		return _AddEvent(_listenFd, EPOLLIN) && _AddEvent(_stopFd, EPOLLIN);
+	}
+
+	// 事件循环，直到Stop被调用
+	void Run(const MsgHandler& handler)
+	{
+		const int MAX_EVENTS = 16;
+		struct epoll_event events[MAX_EVENTS];
+
+		while (1)
+		{
+			int n = epoll_wait(_epollFd, events, MAX_EVENTS, -1);
+			if (n < 0)
+			{
+				if (errno == EINTR)
+					continue;
+
+				RECORD_ERROR_LOG("Server Epoll Wait Error");
+				return;
+			}
+
+			for (int i = 0; i < n; ++i)
+			{
+				int fd = events[i].data.fd;
+				if (fd == _stopFd)
+				{
+					return;
+				}
+				else if (fd == _listenFd)
+				{
+					_OnAccept();
+				}
+				else
+				{
+					if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+					{
+						if (!_OnRead(fd, handler))
+						{
+							_CloseConnection(fd);
+							continue;
+						}
+					}
+
+					if (!_OnWrite(fd))
+					{
+						_CloseConnection(fd);
+					}
+				}
+			}
+		}
+	}
+
+	// 通知事件循环退出，可在其他线程调用
+	void Stop()
+	{
+		uint64_t one = 1;
+		if (_stopFd >= 0 && write(_stopFd, &one, sizeof(one)) < 0)
+		{
+			RECORD_ERROR_LOG("Server Stop Error");
 		}
 	}
 
 private:
-	NamePipeSender _sender;			// 发送者
-};
+	struct Connection
+	{
+		string _in;		// 已接收未处理的数据
+		string _out;	// 待发送的数据
+		size_t _outPos;	// _out中已发送的位置
+		bool _writing;	// 是否在等待可写事件
+		bool _eof;		// 对端已关闭写端，发送完应答后关闭连接
+
+		Connection()
+			:_outPos(0)
+			, _writing(false)
+			, _eof(false)
+		{}
+	};
+
+	bool _AddEvent(int fd, uint32_t events)
+	{
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = events;
+		ev.data.fd = fd;
+		return epoll_ctl(_epollFd, EPOLL_CTL_ADD, fd, &ev) == 0;
+	}
 
-// IPC服务端
-class IPCServer
-{
-public:
-	IPCServer(const char* serverName)
-		:_receiver(serverName)
+	void _ModifyEvent(int fd, uint32_t events)
 	{
-		
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = events;
+		ev.data.fd = fd;
+		epoll_ctl(_epollFd, EPOLL_CTL_MOD, fd, &ev);
 	}
 
-	~IPCServer()
-	{}
+	void _OnAccept()
+	{
+		while (1)
+		{
+			int fd = accept4(_listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (fd < 0)
+				return;
 
-	bool Listen()
+			if (!_AddEvent(fd, EPOLLIN))
+			{
+				close(fd);
+				continue;
+			}
+
+			_connections[fd] = Connection();
+		}
+	}
+
+	void _CloseConnection(int fd)
 	{
-		return _receiver.Listen();
+		epoll_ctl(_epollFd, EPOLL_CTL_DEL, fd, NULL);
+		close(fd);
+		_connections.erase(fd);
 	}
 
-	// 接收客户端消息
-	void ReceiverMsg(char* buf, size_t bufLen)
+	// 读取数据并处理完整的请求帧，连接需要关闭时返回false
+	bool _OnRead(int fd, const MsgHandler& handler)
 	{
-		size_t realLen;
-		if (!_receiver.ReceiverMsg(buf, bufLen, realLen))
+		Connection& conn = _connections[fd];
+		char buf[4096];
+		while (1)
 		{
-			RECORD_ERROR_LOG("Server ReceiverMsg Error\n");
+			ssize_t ret = read(fd, buf, sizeof(buf));
+			if (ret > 0)
+			{
+				conn._in.append(buf, ret);
+				continue;
+			}
+
+			if (ret == 0)
+			{
+				// 对端关闭写端后仍处理已收到的完整请求，应答发送完再关闭，
+				// 之后只关注可写事件，避免读端一直就绪
+				if (!conn._eof)
+				{
+					conn._eof = true;
+					_ModifyEvent(fd, EPOLLOUT);
+					conn._writing = true;
+				}
+				break;
+			}
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			return false;
 		}
+
+		size_t pos = 0;
+		while (conn._in.size() - pos >= IPC_FRAME_HEADER_LEN)
+		{
+			uint32_t len = 0;
+			memcpy(&len, conn._in.data() + pos, IPC_FRAME_HEADER_LEN);
+			len = ntohl(len);
+			if (len > IPC_MAX_REQUEST_LEN)
+			{
+				RECORD_ERROR_LOG("Server Request Too Long");
+				return false;
+			}
+
+			if (conn._in.size() - pos - IPC_FRAME_HEADER_LEN < len)
+				break;
+
+			string msg = conn._in.substr(pos + IPC_FRAME_HEADER_LEN, len);
+			pos += IPC_FRAME_HEADER_LEN + len;
+
+			string reply;
+			handler(msg, reply);
+			AppendReplyFrames(conn._out, reply);
+		}
+		conn._in.erase(0, pos);
+
+		return true;
 	}
 
-	// 回复客户端消息
-	void SendReplyMsg(const char* buf, size_t bufLen)
+	// 尽量发送缓存的数据，发不完时等待可写事件，连接需要关闭时返回false
+	// 用MSG_NOSIGNAL发送，对端已关闭时得到EPIPE并关闭连接，不会触发SIGPIPE
+	bool _OnWrite(int fd)
 	{
-		size_t realLen;
-		if (!_receiver.SendReplyMsg(buf, bufLen, realLen))
+		Connection& conn = _connections[fd];
+		while (conn._outPos < conn._out.size())
+		{
+			ssize_t ret = send(fd, conn._out.data() + conn._outPos,
+				conn._out.size() - conn._outPos, MSG_NOSIGNAL);
+			if (ret > 0)
+			{
+				conn._outPos += ret;
+				continue;
+			}
+
+			if (ret < 0 && errno == EINTR)
+				continue;
+			if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			{
+				if (!conn._writing)
+				{
+					_ModifyEvent(fd, EPOLLIN | EPOLLOUT);
+					conn._writing = true;
+				}
+				return true;
+			}
+
+			return false;
+		}
+
+		conn._out.clear();
+		conn._outPos = 0;
+		if (conn._eof)
+			return false;
+
+		if (conn._writing)
 		{
-			RECORD_ERROR_LOG("Server SendReplyMsg Error\n");
+			_ModifyEvent(fd, EPOLLIN);
+			conn._writing = false;
 		}
+
+		return true;
 	}
+
 private:
-	NamePipeReceiver _receiver;		// 接收者
-};
\ No newline at end of file
+	string _serverName;					// 套接字路径
+	int _listenFd;						// 监听套接字
+	int _epollFd;						// epoll
+	int _stopFd;						// 通知退出的eventfd
+	map<int, Connection> _connections;	// 客户端连接
+};
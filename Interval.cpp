@@ -0,0 +1,285 @@
+#include "Interval.h"
+#include "Trace.h"
+
+static void StopIntervalRecorder()
+{
+	IntervalRecorder::GetInstance()->Stop();
+}
+
+static void RestartIntervalRecorderInChild()
+{
+	IntervalRecorder::GetInstance()->RestartInChild();
+}
+
+IntervalRecorder::IntervalRecorder()
+	:_tick(0)
+	, _clockTicks(sysconf(_SC_CLK_TCK))
+	, _stop(false)
+{
+	_ResetBaselines();
+	for (int i = 0; i < PP_INTERVAL_WINDOW_COUNT; ++i)
+	{
+		_windows[i]._sampleCount = 0;
+	}
+
+	atexit(StopIntervalRecorder);
+	pthread_atfork(NULL, NULL, RestartIntervalRecorderInChild);
+
+	// 区间数据初始化完成后再启动记录线程
+	_recordThread = std::thread(&IntervalRecorder::_Record, this);
+}
+
+IntervalRecorder::~IntervalRecorder()
+{
+	Stop();
+}
+
+void IntervalRecorder::Stop()
+{
+	{
+		unique_lock<mutex> lock(_stopMutex);
+		if (_stop)
+			return;
+
+		_stop = true;
+		_condVariable.notify_one();
+	}
+
+	if (_recordThread.joinable())
+	{
+		_recordThread.join();
+	}
+}
+
+void IntervalRecorder::RestartInChild()
+{
+	RebuildInChild(_mutex);
+	RebuildInChild(_stopMutex);
+	RebuildInChild(_condVariable);
+	if (_stop)
+		return;
+
+	_ResetBaselines();
+	for (int i = 0; i < PP_INTERVAL_WINDOW_COUNT; ++i)
+	{
+		_windows[i]._sampleCount = 0;
+	}
+
+	_current.clear();
+	_statReader.Reopen();
+
+	new(&_recordThread) std::thread(&IntervalRecorder::_Record, this);
+}
+
+void IntervalRecorder::_Record()
+{
+	while (1)
+	{
+		{
+			unique_lock<std::mutex> lock(_stopMutex);
+			if (!_stop)
+			{
+				_condVariable.wait_for(lock, std::chrono::seconds(1));
+			}
+
+			if (_stop)
+				break;
+		}
+
+		_Snapshot();
+	}
+}
+
+void IntervalRecorder::_ResetBaselines()
+{
+	for (int i = 0; i < PP_INTERVAL_WINDOW_COUNT; ++i)
+	{
+		_windows[i]._valid = false;
+		_windows[i]._baseline.clear();
+	}
+}
+
+void IntervalRecorder::_Snapshot()
+{
+	if (!OptionManager::IsEnabled(PPCO_INTERVAL_STATS))
+	{
+		unique_lock<mutex> lock(_mutex);
+		_ResetBaselines();
+		return;
+	}
+
+	// 只有记录线程访问_current，未变化的剖析段沿用上一次的累计值
+	Performance::GetInstance()->SnapshotSections(_current);
+	const vector<SectionTotals>& current = _current;
+
+	LongType cpuTicks = -1;
+	LongType memory = -1;
+	if (!_statReader.ReadCpuTicks(cpuTicks))
+		cpuTicks = -1;
+	if (!_statReader.ReadResidentSize(memory))
+		memory = -1;
+
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	LongType now = PerformanceTimer::MonotonicTimeNs();
+	LongType endTime = ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+
+	unique_lock<mutex> lock(_mutex);
+
+	_names.resize(current.size());
+	for (size_t i = 0; i < current.size(); ++i)
+	{
+		if (_names[i].empty())
+			_names[i] = current[i]._name + "(" + current[i]._location + ")";
+	}
+
+	++_tick;
+	for (int i = 0; i < PP_INTERVAL_WINDOW_COUNT; ++i)
+	{
+		Window& window = _windows[i];
+		if (!window._valid || _tick - window._baselineTick >= INTERVAL_WINDOW_SECONDS[i])
+		{
+			if (window._valid)
+				_AppendSample(i, current, cpuTicks, memory, now, endTime);
+
+			window._valid = true;
+			window._baseline = current;
+			window._baselineCpuTicks = cpuTicks;
+			window._baselineTime = now;
+			window._baselineTick = _tick;
+		}
+	}
+}
+
+void IntervalRecorder::_AppendSample(int window, const vector<SectionTotals>& current,
+	LongType cpuTicks, LongType memory, LongType now, LongType endTime)
+{
+	static const SectionTotals s_empty;
+
+	Window& w = _windows[window];
+	IntervalSample& sample = w._samples[w._sampleCount % PP_INTERVAL_RING_SIZE];
+	sample._endTime = endTime;
+	sample._duration = now - w._baselineTime;
+	sample._processCpu = -1;
+	if (cpuTicks >= 0 && w._baselineCpuTicks >= 0 && sample._duration > 0 && _clockTicks > 0)
+	{
+		sample._processCpu = (cpuTicks - w._baselineCpuTicks) * PP_NS_PER_SEC * 100
+			/ _clockTicks / sample._duration;
+	}
+	sample._processMemory = memory;
+	sample._sections.clear();
+
+	HistogramSnapshot delta;
+	for (size_t i = 0; i < current.size(); ++i)
+	{
+		const SectionTotals& cur = current[i];
+		const SectionTotals& base = i < w._baseline.size() ? w._baseline[i] : s_empty;
+		if (cur._callCount <= base._callCount)
+			continue;
+
+		IntervalSectionStats stats;
+		stats._id = (int)i;
+		stats._callCount = cur._callCount - base._callCount;
+		stats._costTime = cur._costTime - base._costTime;
+		stats._cpuTime = cur._cpuTime - base._cpuTime;
+
+		// 区间内的延迟分布是两次累计分布之差，最值取累计值作为界限
+		for (int j = 0; j < HISTOGRAM_BUCKET_COUNT; ++j)
+		{
+			delta._counts[j] = cur._histogram._counts[j] - base._histogram._counts[j];
+		}
+		delta._count = cur._histogram._count - base._histogram._count;
+		delta._sum = cur._histogram._sum - base._histogram._sum;
+		delta._min = cur._histogram._min;
+		delta._max = cur._histogram._max;
+
+		stats._mean = (LongType)delta.Mean();
+		stats._p99 = delta.Percentile(99);
+		sample._sections.push_back(stats);
+	}
+
+	++w._sampleCount;
+}
+
+void IntervalRecorder::OutPutLatest(SaveAdapter& SA)
+{
+	unique_lock<mutex> lock(_mutex);
+
+	SA.Save("=================Interval Statistics================\n\n");
+	for (int i = 0; i < PP_INTERVAL_WINDOW_COUNT; ++i)
+	{
+		Window& w = _windows[i];
+		if (w._sampleCount == 0)
+		{
+			SA.Save("[%ds] No Sample\n\n", INTERVAL_WINDOW_SECONDS[i]);
+			continue;
+		}
+
+		const IntervalSample& sample = w._samples[(w._sampleCount - 1) % PP_INTERVAL_RING_SIZE];
+		double seconds = (double)sample._duration / PP_NS_PER_SEC;
+
+		char timeStr[32];
+		time_t endTime = sample._endTime / 1000;
+		struct tm tm;
+		localtime_r(&endTime, &tm);
+		strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S", &tm);
+
+		SA.Save("[%ds] End Time:%s, Duration:%.3fs, Process Cpu:%lld%%, Memory:%lldKB\n",
+			INTERVAL_WINDOW_SECONDS[i], timeStr, seconds,
+			sample._processCpu, sample._processMemory);
+
+		for (size_t j = 0; j < sample._sections.size(); ++j)
+		{
+			const IntervalSectionStats& stats = sample._sections[j];
+			SA.Save("  %s Calls:%lld, Rate:%.1f/s, Mean:%.3fus, P99:%.3fus, Cpu:%.1f%%\n",
+				_names[stats._id].c_str(), stats._callCount,
+				seconds > 0 ? stats._callCount / seconds : 0.0,
+				stats._mean / 1000.0, stats._p99 / 1000.0,
+				sample._duration > 0 ? stats._cpuTime * 100.0 / sample._duration : 0.0);
+		}
+
+		SA.Save("\n");
+	}
+}
+
+void IntervalRecorder::OutPutSeries(SaveAdapter& SA)
+{
+	unique_lock<mutex> lock(_mutex);
+
+	SA.Save("{\"schema\":\"performance_intervals\",\"version\":%d,\"pid\":%d,\"windows\":[",
+		PP_INTERVAL_SCHEMA_VERSION, getpid());
+	for (int i = 0; i < PP_INTERVAL_WINDOW_COUNT; ++i)
+	{
+		Window& w = _windows[i];
+		SA.Save("%s{\"window_seconds\":%d,\"samples\":[", i ? "," : "", INTERVAL_WINDOW_SECONDS[i]);
+
+		// 从最旧到最新
+		LongType begin = w._sampleCount > PP_INTERVAL_RING_SIZE
+			? w._sampleCount - PP_INTERVAL_RING_SIZE : 0;
+		for (LongType j = begin; j < w._sampleCount; ++j)
+		{
+			const IntervalSample& sample = w._samples[j % PP_INTERVAL_RING_SIZE];
+			double seconds = (double)sample._duration / PP_NS_PER_SEC;
+			SA.Save("%s\n{\"end_time_ms\":%lld,\"duration_ns\":%lld,\"process_cpu_percent\":%lld,"
+				"\"process_memory_kb\":%lld,\"sections\":[",
+				j > begin ? "," : "", sample._endTime, sample._duration,
+				sample._processCpu, sample._processMemory);
+
+			for (size_t k = 0; k < sample._sections.size(); ++k)
+			{
+				const IntervalSectionStats& stats = sample._sections[k];
+				SA.Save("%s{\"id\":%d,\"name\":\"%s\",\"call_count\":%lld,\"call_rate\":%.3f,"
+					"\"cost_time_ns\":%lld,\"cpu_time_ns\":%lld,\"mean_latency_ns\":%lld,\"p99_latency_ns\":%lld}",
+					k ? "," : "", stats._id, EscapeJson(_names[stats._id].c_str()).c_str(),
+					stats._callCount, seconds > 0 ? stats._callCount / seconds : 0.0,
+					stats._costTime, stats._cpuTime, stats._mean, stats._p99);
+			}
+
+			SA.Save("]}");
+		}
+
+		SA.Save("]}");
+	}
+
+	SA.Save("]}\n");
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "Performance.h"
+
+//
+// 区间统计
+// 每秒对各剖析段的累计值做一次快照，与上一个区间边界的快照相减，
+// 得到1s、10s、60s三种窗口内的调用次数、延迟和CPU增量，
+// 每种窗口在内存中保留最近PP_INTERVAL_RING_SIZE个区间。
+//
+#ifndef PP_INTERVAL_RING_SIZE
+#define PP_INTERVAL_RING_SIZE 60
+#endif
+
+#define PP_INTERVAL_WINDOW_COUNT 3
+
+// 窗口长度(秒)
+const int INTERVAL_WINDOW_SECONDS[PP_INTERVAL_WINDOW_COUNT] = { 1, 10, 60 };
+
+//
+// 区间序列JSON的结构版本，字段命名与结构化报告(见Report.h)一致，
+// 修改或删除已有字段时增加
+//
+#define PP_INTERVAL_SCHEMA_VERSION 1
+
+//
+// 剖析段的累计值，Performance::SnapshotSections生成
+//
+struct SectionTotals
+{
+	string _name;					// 剖析段名字
+	string _location;				// 文件名:行号
+	LongType _callCount;			// 调用次数
+	LongType _costTime;				// 估算的墙上时间(纳秒)
+	LongType _cpuTime;				// 估算的线程CPU时间(纳秒)
+	HistogramSnapshot _histogram;	// 延迟分布
+	LongType _activity;				// 生成时剖析段的活动计数，未变化时不再合并
+
+	SectionTotals()
+		:_callCount(0)
+		, _costTime(0)
+		, _cpuTime(0)
+		, _activity(-1)
+	{}
+};
+
+// 剖析段在一个区间内的增量
+struct IntervalSectionStats
+{
+	int _id;						// 剖析段id
+	LongType _callCount;			// 调用次数
+	LongType _costTime;				// 墙上时间(纳秒)
+	LongType _cpuTime;				// 线程CPU时间(纳秒)
+	LongType _mean;					// 计时调用的平均延迟(纳秒)
+	LongType _p99;					// 计时调用的P99延迟(纳秒)
+};
+
+// 一个区间的统计
+struct IntervalSample
+{
+	LongType _endTime;				// 区间结束的墙上时间(毫秒，Unix时间)
+	LongType _duration;				// 区间的实际长度(纳秒)
+	LongType _processCpu;			// 区间内进程CPU使用率(%)，无法读取为-1
+	LongType _processMemory;		// 区间结束时进程常驻内存(KB)，无法读取为-1
+	vector<IntervalSectionStats> _sections;	// 区间内有调用的剖析段
+};
+
+//
+// 区间统计记录器
+// 开启PPCO_INTERVAL_STATS后，记录线程每秒取一次快照。
+// 快照在Performance::_mutex下只合并上一秒有调用的剖析段，剖析线程不受影响。
+//
+class IntervalRecorder : public Singleton<IntervalRecorder>
+{
+	friend class Singleton<IntervalRecorder>;
+public:
+	// 停止记录线程，进程退出时调用
+	void Stop();
+
+	// fork出的子进程中丢弃父进程的区间并重新启动记录线程
+	void RestartInChild();
+
+	// 各窗口最近一个区间的可读报告
+	void OutPutLatest(SaveAdapter& SA);
+
+	//
+	// 各窗口保留的全部区间，JSON格式：
+	// {"schema":"performance_intervals","version":1,"pid":..,"windows":[{"window_seconds":1,"samples":[...]}]}
+	//
+	void OutPutSeries(SaveAdapter& SA);
+
+protected:
+	IntervalRecorder();
+	~IntervalRecorder();
+
+	void _Record();
+
+	// 取一次快照，到达窗口边界时计算该窗口的区间增量
+	void _Snapshot();
+
+	// 丢弃各窗口的基准快照，重新开启时从头计算
+	void _ResetBaselines();
+
+	// 计算@window窗口从基准快照到@current的增量并写入环形缓冲区
+	void _AppendSample(int window, const vector<SectionTotals>& current,
+		LongType cpuTicks, LongType memory, LongType now, LongType endTime);
+
+private:
+	struct Window
+	{
+		bool _valid;					// 是否已有基准快照
+		vector<SectionTotals> _baseline;	// 上一个区间边界的累计值
+		LongType _baselineCpuTicks;		// 上一个区间边界的进程CPU时间(滴答)
+		LongType _baselineTime;			// 上一个区间边界的CLOCK_MONOTONIC时间(纳秒)
+		LongType _baselineTick;			// 上一个区间边界的快照序号
+		IntervalSample _samples[PP_INTERVAL_RING_SIZE];	// 环形缓冲区
+		LongType _sampleCount;			// 写入过的区间总数
+	};
+
+	Window _windows[PP_INTERVAL_WINDOW_COUNT];
+	vector<SectionTotals> _current;	// 最近一次快照，增量更新
+	vector<string> _names;			// 按剖析段id索引的名字
+	LongType _tick;					// 快照序号
+	ProcessStatReader _statReader;	// 进程资源读取器
+	long _clockTicks;				// 每秒的时钟滴答数
+
+	bool _stop;						// 是否停止
+	mutex _mutex;					// 保护区间数据
+	mutex _stopMutex;
+	condition_variable _condVariable;
+	std::thread _recordThread;		// 记录线程
+};
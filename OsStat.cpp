@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "OsStat.h"
+
+static const char* s_osStatNames[PPOS_COUNT] =
+{
+	"Voluntary Switches",
+	"Involuntary Switches",
+	"Minor Faults",
+	"Major Faults",
+	"Read Chars",
+	"Write Chars",
+	"Read Bytes",
+	"Write Bytes",
+	"Run Delay",
+};
+
+const char* OsStatName(int stat)
+{
+	if (stat < 0 || stat >= PPOS_COUNT)
+		return "";
+
+	return s_osStatNames[stat];
+}
+
+// 打开当前线程的/proc文件，内核早于3.17没有/proc/thread-self时按tid打开
+static int OpenThreadFile(const char* name)
+{
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/thread-self/%s", name);
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		snprintf(path, sizeof(path), "/proc/self/task/%ld/%s", (long)syscall(SYS_gettid), name);
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+	}
+
+	return fd;
+}
+
+OsStatReader::OsStatReader()
+	:_ioFd(-1)
+	, _schedFd(-1)
+	, _selfReadChars(0)
+{}
+
+OsStatReader::~OsStatReader()
+{
+	Close();
+}
+
+void OsStatReader::Open()
+{
+	Close();
+
+	_ioFd = OpenThreadFile("io");
+	_schedFd = OpenThreadFile("schedstat");
+}
+
+void OsStatReader::Close()
+{
+	if (_ioFd >= 0)
+		close(_ioFd);
+	if (_schedFd >= 0)
+		close(_schedFd);
+
+	_ioFd = -1;
+	_schedFd = -1;
+}
+
+// 从"name: value"格式的内容中读取一个值
+static long long ParseField(const char* buf, const char* name)
+{
+	const char* pos = strstr(buf, name);
+	if (pos == NULL)
+		return 0;
+
+	return strtoll(pos + strlen(name), NULL, 10);
+}
+
+bool OsStatReader::Read(long long values[PPOS_COUNT])
+{
+	struct rusage usage;
+	if (getrusage(RUSAGE_THREAD, &usage) != 0)
+		return false;
+
+	values[PPOS_VOLUNTARY_SWITCHES] = usage.ru_nvcsw;
+	values[PPOS_INVOLUNTARY_SWITCHES] = usage.ru_nivcsw;
+	values[PPOS_MINOR_FAULTS] = usage.ru_minflt;
+	values[PPOS_MAJOR_FAULTS] = usage.ru_majflt;
+
+	values[PPOS_READ_CHARS] = 0;
+	values[PPOS_WRITE_CHARS] = 0;
+	values[PPOS_READ_BYTES] = 0;
+	values[PPOS_WRITE_BYTES] = 0;
+	values[PPOS_RUN_DELAY] = 0;
+
+	// schedstat：在CPU上运行的时间、在运行队列上等待的时间、时间片数
+	char buf[512];
+	if (_schedFd >= 0)
+	{
+		ssize_t len = pread(_schedFd, buf, sizeof(buf) - 1, 0);
+		if (len > 0)
+		{
+			_selfReadChars += len;
+			buf[len] = '\0';
+			unsigned long long runTime = 0, runDelay = 0;
+			if (sscanf(buf, "%llu %llu", &runTime, &runDelay) == 2)
+				values[PPOS_RUN_DELAY] = (long long)runDelay;
+		}
+	}
+
+	//
+	// rchar包含读取器自己读/proc文件的字节数，扣除后才是被剖析代码的读取量。
+	// io文件的内容在本次读取计入rchar之前生成，所以最后读它，读完再累计。
+	//
+	if (_ioFd >= 0)
+	{
+		ssize_t len = pread(_ioFd, buf, sizeof(buf) - 1, 0);
+		if (len > 0)
+		{
+			buf[len] = '\0';
+			values[PPOS_READ_CHARS] = ParseField(buf, "rchar:") - _selfReadChars;
+			values[PPOS_WRITE_CHARS] = ParseField(buf, "wchar:");
+			values[PPOS_READ_BYTES] = ParseField(buf, "\nread_bytes:");
+			values[PPOS_WRITE_BYTES] = ParseField(buf, "\nwrite_bytes:");
+			_selfReadChars += len;
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+
+//
+// 剖析段统计的操作系统资源
+// 墙上时间长而CPU时间短的段，用这些增量区分是在等锁/I/O(主动切换)、
+// 被抢占(被动切换、运行队列等待)，还是在缺页。
+//
+enum PP_OS_STAT
+{
+	PPOS_VOLUNTARY_SWITCHES = 0,	// 主动上下文切换(阻塞在I/O、锁等)
+	PPOS_INVOLUNTARY_SWITCHES,		// 被动上下文切换(时间片用完、被抢占)
+	PPOS_MINOR_FAULTS,				// 次缺页
+	PPOS_MAJOR_FAULTS,				// 主缺页(需要读盘)
+	PPOS_READ_CHARS,				// read类系统调用读取的字节数
+	PPOS_WRITE_CHARS,				// write类系统调用写入的字节数
+	PPOS_READ_BYTES,				// 实际从存储读取的字节数
+	PPOS_WRITE_BYTES,				// 实际写到存储的字节数
+	PPOS_RUN_DELAY,					// 在运行队列上等待的时间(纳秒)
+	PPOS_COUNT,
+};
+
+// 资源名称
+const char* OsStatName(int stat);
+
+//
+// 当前线程的操作系统资源读取器
+// getrusage(RUSAGE_THREAD)读取切换和缺页，/proc/thread-self/io读取I/O字节数，
+// /proc/thread-self/schedstat读取运行队列等待时间。
+// 文件在打开它的线程上预先打开，之后每次用pread读取，只能由该线程使用。
+//
+class OsStatReader
+{
+public:
+	OsStatReader();
+	~OsStatReader();
+
+	// 为调用线程打开/proc文件，打不开的文件对应的值读为0
+	void Open();
+
+	void Close();
+
+	// 读取各资源的当前累计值
+	bool Read(long long values[PPOS_COUNT]);
+
+	// I/O字节数和运行队列等待是否可用(需要内核开启任务I/O统计和调度统计)
+	bool IsIoAvailable() const
+	{
+		return _ioFd >= 0;
+	}
+	bool IsSchedAvailable() const
+	{
+		return _schedFd >= 0;
+	}
+
+private:
+	int _ioFd;					// /proc/thread-self/io
+	int _schedFd;				// /proc/thread-self/schedstat
+	long long _selfReadChars;	// 读取器自己读/proc文件的字节数
+};
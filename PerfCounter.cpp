@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "PerfCounter.h"
+
+struct PerfCounterConfig
+{
+	uint32_t _type;			// perf_event类型
+	uint64_t _config;		// perf_event配置
+	const char* _name;		// 名称
+};
+
+static const PerfCounterConfig s_counterConfigs[PPC_COUNT] =
+{
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "Cycles" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "Instructions" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "Cache Misses" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS, "Branches" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "Branch Misses" },
+	{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "Context Switches" },
+	{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, "Page Faults" },
+};
+
+const char* PerfCounterName(int counter)
+{
+	if (counter < 0 || counter >= PPC_COUNT)
+		return "";
+
+	return s_counterConfigs[counter]._name;
+}
+
+static int PerfEventOpen(struct perf_event_attr* attr, int groupFd)
+{
+	// pid = 0, cpu = -1：只统计调用线程，线程在哪个CPU上运行都统计
+	return syscall(SYS_perf_event_open, attr, 0, -1, groupFd, PERF_FLAG_FD_CLOEXEC);
+}
+
+PerfCounterGroup::PerfCounterGroup()
+	:_leaderFd(-1)
+	, _openCount(0)
+{
+	for (int i = 0; i < PPC_COUNT; ++i)
+	{
+		_fds[i] = -1;
+		_indexs[i] = -1;
+	}
+}
+
+PerfCounterGroup::~PerfCounterGroup()
+{
+	Close();
+}
+
+bool PerfCounterGroup::_OpenCounter(int counter)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = s_counterConfigs[counter]._type;
+	attr.config = s_counterConfigs[counter]._config;
+	attr.read_format = PERF_FORMAT_GROUP
+		| PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	attr.exclude_hv = 1;
+
+	int fd = PerfEventOpen(&attr, _leaderFd);
+	if (fd < 0 && (errno == EACCES || errno == EPERM))
+	{
+		// perf_event_paranoid >= 2 时只允许统计用户态
+		attr.exclude_kernel = 1;
+		fd = PerfEventOpen(&attr, _leaderFd);
+	}
+
+	if (fd < 0)
+		return false;
+
+	if (_leaderFd < 0)
+		_leaderFd = fd;
+
+	_fds[counter] = fd;
+	_indexs[counter] = _openCount++;
+	return true;
+}
+
+bool PerfCounterGroup::Open()
+{
+	if (IsOpen())
+		return true;
+
+	//
+	// 硬件计数器排在前面，可用时由CPU周期计数器做组长。
+	// 硬件计数器打不开时跳过，只用软件计数器组成计数器组。
+	//
+	for (int i = 0; i < PPC_COUNT; ++i)
+	{
+		_OpenCounter(i);
+	}
+
+	return IsOpen();
+}
+
+void PerfCounterGroup::Close()
+{
+	for (int i = 0; i < PPC_COUNT; ++i)
+	{
+		if (_fds[i] >= 0)
+			close(_fds[i]);
+
+		_fds[i] = -1;
+		_indexs[i] = -1;
+	}
+
+	_leaderFd = -1;
+	_openCount = 0;
+}
+
+bool PerfCounterGroup::Read(long long values[PPC_COUNT])
+{
+	if (_leaderFd < 0)
+		return false;
+
+	// PERF_FORMAT_GROUP的读取结果：计数器个数、启用时间、运行时间、各计数器的值
+	uint64_t buf[3 + PPC_COUNT];
+	ssize_t len = read(_leaderFd, buf, sizeof(buf));
+	if (len < (ssize_t)(3 * sizeof(uint64_t)))
+		return false;
+
+	uint64_t count = buf[0];
+	uint64_t enabled = buf[1];
+	uint64_t running = buf[2];
+
+	for (int i = 0; i < PPC_COUNT; ++i)
+	{
+		int index = _indexs[i];
+		if (index < 0 || (uint64_t)index >= count)
+		{
+			values[i] = 0;
+			continue;
+		}
+
+		uint64_t value = buf[3 + index];
+		if (running && running < enabled)
+		{
+			value = (uint64_t)((double)value * enabled / running);
+		}
+
+		values[i] = (long long)value;
+	}
+
+	return true;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+
+//
+// 剖析段统计的性能计数器
+// 硬件计数器不可用(虚拟机、容器或perf_event_paranoid限制)时只统计软件计数器。
+//
+enum PP_COUNTER
+{
+	PPC_CYCLES = 0,				// CPU周期
+	PPC_INSTRUCTIONS,			// 指令数
+	PPC_CACHE_MISSES,			// 末级缓存未命中
+	PPC_BRANCHES,				// 分支指令数
+	PPC_BRANCH_MISSES,			// 分支预测失败
+	PPC_CONTEXT_SWITCHES,		// 上下文切换(软件计数器)
+	PPC_PAGE_FAULTS,			// 缺页(软件计数器)
+	PPC_COUNT,
+};
+
+// 计数器名称
+const char* PerfCounterName(int counter);
+
+//
+// 当前线程的perf_event计数器组
+// 所有计数器放在同一个组里，一次read系统调用读出整组的值，
+// 组内计数器同时被调度，比值(IPC、未命中率)不受多路复用影响。
+// 只统计打开它的线程，只能由该线程读取。
+//
+class PerfCounterGroup
+{
+public:
+	PerfCounterGroup();
+	~PerfCounterGroup();
+
+	// 为调用线程打开计数器，至少打开一个计数器时返回true
+	bool Open();
+
+	void Close();
+
+	//
+	// 读取各计数器的当前值，不可用的计数器为0。
+	// 计数器被多路复用时按运行时间比例放大。
+	//
+	bool Read(long long values[PPC_COUNT]);
+
+	// 计数器是否可用
+	bool IsAvailable(int counter) const
+	{
+		return _indexs[counter] >= 0;
+	}
+
+	bool IsOpen() const
+	{
+		return _leaderFd >= 0;
+	}
+
+private:
+	bool _OpenCounter(int counter);
+
+private:
+	int _leaderFd;					// 组长的文件描述符
+	int _fds[PPC_COUNT];			// 各计数器的文件描述符，不可用为-1
+	int _indexs[PPC_COUNT];			// 各计数器在组读取结果中的位置，不可用为-1
+	int _openCount;					// 组内已打开的计数器个数
+};
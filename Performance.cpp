@@ -1,4 +1,18 @@
 #include "Performance.h"
+#include "Trace.h"
+#include "Report.h"
+#include "Interval.h"
+#include "ProfiledMutex.h"
+#include "FunctionInstrument.h"
+#include "StackSampler.h"
+
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <dirent.h>
+
+// ѡǰ̬ʼ
+atomic<int> OptionManager::_sFlag(PPCO_NONE);
 
 //////////////////////////////////////////////////////////////
 // Դͳ
@@ -11,7 +25,7 @@
 //#define RECORD_ERROR_LOG(errMsg)		\
 //	RecordErrorLog(errMsg, __LINE__);
 
-void ResourceInfo::Update(LongType value)
+void ResourceInfo::Update(LongType value, LongType time)
 {
 	// value < 0ʱֱӷزٸ¡
 	if (value < 0)
@@ -20,383 +34,2484 @@ void ResourceInfo::Update(LongType value)
 	if (value > _peak)
 		_peak = value;
 
-	//
-	// 㲻׼ȷƽֵܱ仯Ӱ첻
-	// Żɲο绬ڷڼ㡣
-	//
 	_total += value;
 	_avg = _total / (++_count);
-}
-
-ResourceStatistics::ResourceStatistics()
-	:_refCount(0)
-	,_statisticsThread(&ResourceStatistics::_Statistics, this)
-{
-	// ʼͳԴϢ
-	_pid = getpid();
-}
-
-ResourceStatistics::~ResourceStatistics()
-{
-
-}
 
-void ResourceStatistics::StartStatistics()
-{
 	//
-	// ̲߳һεĳʹüͳơ
-	// һ߳̽ʱʼͳƣһ̳߳ʱ
-	// ֹͣͳơ
+	// EWMAȨأڱ仯̱߳ƳʱȻȷ
+	// ʱ䳣ΪԴͳƴڣ֮ǰĲȨ˥1/e¡
 	//
-	if (_refCount++ == 0)
+	if (_count == 1)
 	{
-		unique_lock<std::mutex> lock(_lockMutex);
-		_condVariable.notify_one();
+		_ewma = (double)value;
 	}
-}
-
-void ResourceStatistics::StopStatistics()
-{
-	if (_refCount > 0)
+	else
 	{
-		--_refCount;
-		_lastKernelTime = -1;
-		_lastSystemTime = -1;
+		double window = OptionManager::GetInstance()->GetResourceWindow() * 1000000.0;
+		double alpha = 1.0 - exp(-(double)(time - _lastTime) / window);
+		_ewma += alpha * (value - _ewma);
 	}
-}
+	_lastTime = time;
 
-const ResourceInfo& ResourceStatistics::GetCpuInfo()
-{
-	return _cpuInfo;
+	ResourceSample sample;
+	sample._time = time;
+	sample._value = value;
+	if (_samples.size() < PP_RESOURCE_RING_SIZE)
+	{
+		_samples.push_back(sample);
+	}
+	else
+	{
+		_samples[_sampleIndex % PP_RESOURCE_RING_SIZE] = sample;
+	}
+	++_sampleIndex;
 }
 
-const ResourceInfo& ResourceStatistics::GetMemoryInfo()
+ResourceWindowStats ResourceInfo::GetWindowStats(LongType windowNs) const
 {
-	return _memoryInfo;
-}
-
-///////////////////////////////////////////////////
-// ResourceStatistics
+	ResourceWindowStats stats;
+	memset(&stats, 0, sizeof(stats));
 
-static const int CPU_TIME_SLICE_UNIT = 100;
-
-void ResourceStatistics::_Statistics()
-{
-	while (1)
+	// һβΪյ㣬νʱȻӳеһʱ
+	vector<LongType> values;
+	values.reserve(_samples.size());
+	for (size_t i = 0; i < _samples.size(); ++i)
 	{
-		//
-		// δʼͳʱʹ
-		//
-		if (_refCount == 0)
+		if (_samples[i]._time >= _lastTime - windowNs)
 		{
-			unique_lock<std::mutex> lock(_lockMutex);
-			_condVariable.wait(lock);
+			values.push_back(_samples[i]._value);
 		}
+	}
 
-		// ͳϢ
-		_UpdateStatistics();
+	if (values.empty())
+		return stats;
 
-		// ÿCPUʱƬԪͳһ
-		this_thread::sleep_for(std::chrono::milliseconds(CPU_TIME_SLICE_UNIT));
+	sort(values.begin(), values.end());
+
+	LongType total = 0;
+	for (size_t i = 0; i < values.size(); ++i)
+	{
+		total += values[i];
 	}
+
+	// ȷİٷλ
+	size_t count = values.size();
+	stats._count = count;
+	stats._min = values.front();
+	stats._max = values.back();
+	stats._avg = total / (LongType)count;
+	stats._p50 = values[(size_t)ceil(0.50 * count) - 1];
+	stats._p95 = values[(size_t)ceil(0.95 * count) - 1];
+	stats._p99 = values[(size_t)ceil(0.99 * count) - 1];
+	return stats;
 }
 
-void ResourceStatistics::_UpdateStatistics()
+void ResourceInfo::Serialize(SaveAdapter& SA, const char* name, const char* unit) const
 {
-	char buf[1024] = { 0 };
-	char cmd[256] = { 0 };
-	sprintf(cmd, "ps -o pcpu,rss -p %d | sed 1,1d", _pid);
-
-	//
-	//  "ps"  ͨܵȡ ("pid" )  FILE* stream
-	// ո stream ȡbuf
-	// http://www.cnblogs.com/caosiyang/archive/2012/06/25/2560976.html
-	FILE *stream = ::popen(cmd, "r");
-	::fread(buf, sizeof (char), 1024, stream);
-	::pclose(stream);
+	SA.Save("%s Peak:%lld%s, Avg:%lld%s\n", name, _peak, unit, _avg, unit);
 
-	double cpu = 0.0;
-	int rss = 0;
-	sscanf(buf, "%lf %d", &cpu, &rss);
+	int windowMs = OptionManager::GetInstance()->GetResourceWindow();
+	ResourceWindowStats stats = GetWindowStats(windowMs * 1000000LL);
+	if (stats._count == 0)
+		return;
 
-	_cpuInfo.Update(cpu);
-	_memoryInfo.Update(rss);
+	SA.Save("%s Last %.1fs Min:%lld%s, Avg:%lld%s, P50:%lld%s, P95:%lld%s, P99:%lld%s, Max:%lld%s, EWMA:%.1f%s, Samples:%lld\n",
+		name, windowMs / 1000.0, stats._min, unit, stats._avg, unit,
+		stats._p50, unit, stats._p95, unit, stats._p99, unit,
+		stats._max, unit, _ewma, unit, stats._count);
 }
 
-//////////////////////////////////////////////////////////////////////
-// IPCMonitorServer
-
-int GetProcessId()
+ResourceStatistics::ResourceStatistics()
+	:_refCount(0)
 {
-	int processId = 0;
-	processId = getpid();
+	for (int i = 0; i < PP_MAX_THREADS; ++i)
+	{
+		_activeTids[i].store(0, memory_order_relaxed);
+	}
 
-	return processId;
+	ResourceSampler::GetInstance()->Register(this);
 }
 
-const char* SERVER_PIPE_NAME = "/tmp/performance_profiler/_fifo";
-string GetServerPipeName()
+ResourceStatistics::~ResourceStatistics()
 {
-	string name = SERVER_PIPE_NAME;
-	string idStr(to_string((long long)GetProcessId()));
-	name += idStr;
-	return name;
+
 }
 
-IPCMonitorServer::IPCMonitorServer()
-	:_onMsgThread(&IPCMonitorServer::OnMessage, this)
+void ResourceStatistics::StartStatistics(int index, int tid)
 {
-	printf("%s IPC Monitor Server Start\n", GetServerPipeName().c_str());
+	// ͬһ̵߳ݹʱֻõÿֻ߳߳д
+	_activeTids[index].store(tid, memory_order_relaxed);
 
-	_cmdFuncsMap["state"] = GetState;
-	_cmdFuncsMap["save"] = Save;
-	_cmdFuncsMap["disable"] = Disable;
-	_cmdFuncsMap["enable"] = Enable;
+	//
+	// ̲߳һεĳʹüͳơ
+	// һ߳̽ʱʼͳƣһ̳߳ʱ
+	// ֹͣͳơ
+	//
+	if (_refCount++ == 0)
+	{
+		ResourceSampler::GetInstance()->Activate();
+	}
 }
 
-void IPCMonitorServer::Start()
+void ResourceStatistics::StopStatistics(int index)
 {
-}
+	_activeTids[index].store(0, memory_order_relaxed);
 
-void IPCMonitorServer::OnMessage()
-{
-	const int IPC_BUF_LEN = 1024;
-	char msg[IPC_BUF_LEN] = { 0 };
-	IPCServer server(GetServerPipeName().c_str());
-	
-	if(!server.Listen())
+	// βƥʱüΪ0ʱٵݼ
+	int refCount = _refCount.load();
+	while (refCount > 0 && !_refCount.compare_exchange_weak(refCount, refCount - 1))
+		;
+
+	if (refCount == 1)
 	{
-		return;
+		ResourceSampler::GetInstance()->Deactivate();
 	}
+}
 
-	while (1)
+void ResourceStatistics::ResetInChild(int current, int tid)
+{
+	RebuildInChild(_infoMutex);
+
+	int refCount = 0;
+	for (int i = 0; i < PP_MAX_THREADS; ++i)
 	{
-		server.ReceiverMsg(msg, IPC_BUF_LEN);
-		printf("Receiver Cmd Msg: %s\n", msg);
+		if (_activeTids[i].load(memory_order_relaxed) == 0)
+			continue;
 
-		string reply;
-		string cmd = msg;
-		CmdFuncMap::iterator it = _cmdFuncsMap.find(cmd);
-		if (it != _cmdFuncsMap.end())
+		if (i == current)
 		{
-			CmdFunc func = it->second;
-			func(reply);
+			_activeTids[i].store(tid, memory_order_relaxed);
+			++refCount;
 		}
 		else
 		{
-			reply = "Invalid Command";
+			_activeTids[i].store(0, memory_order_relaxed);
 		}
-
-		server.SendReplyMsg(reply.c_str(), reply.size());
 	}
+	_refCount = refCount;
+
+	// εͳһӽֻfork֮Ĳ
+	_cpuInfo = ResourceInfo();
+	_memoryInfo = ResourceInfo();
+	_threadCpuInfo = ResourceInfo();
+	_threadInfos.clear();
 }
 
-void IPCMonitorServer::GetState(string& reply)
+void ResourceStatistics::GetActiveThreads(vector<int>& tids)
 {
-	reply += "State:";
-	int flag = OptionManager::GetInstance()->GetOptions();
-
-	if (flag == PPCO_NONE)
+	for (int i = 0; i < PP_MAX_THREADS; ++i)
 	{
-		reply += "None\n";
-		return;
+		int tid = _activeTids[i].load(memory_order_relaxed);
+		if (tid)
+			tids.push_back(tid);
 	}
+}
 
-	if (flag & PPCO_PROFILER)
-	{
-		reply += "Performance Profiler \n";
-	}
+void ResourceStatistics::Update(LongType cpu, LongType memory, LongType time,
+	const map<int, LongType>& threadCpus)
+{
+	vector<int> tids;
+	GetActiveThreads(tids);
 
-	if (flag & PPCO_SAVE_TO_CONSOLE)
+	unique_lock<mutex> lock(_infoMutex);
+	_cpuInfo.Update(cpu, time);
+	_memoryInfo.Update(memory, time);
+
+	// ̸߳սʱûв׼β
+	LongType threadCpu = -1;
+	for (size_t i = 0; i < tids.size(); ++i)
 	{
-		reply += "Save To Console\n";
+		map<int, LongType>::const_iterator cpuIt = threadCpus.find(tids[i]);
+		if (cpuIt == threadCpus.end() || cpuIt->second < 0)
+			continue;
+
+		_threadInfos[tids[i]]._cpuInfo.Update(cpuIt->second, time);
+		threadCpu = (threadCpu < 0 ? 0 : threadCpu) + cpuIt->second;
 	}
 
-	if (flag & PPCO_SAVE_TO_FILE)
+	_threadCpuInfo.Update(threadCpu, time);
+	_PruneExitedThreads();
+}
+
+void ResourceStatistics::_PruneExitedThreads()
+{
+	pid_t pid = getpid();
+	ThreadInfoMap::iterator it = _threadInfos.begin();
+	while (it != _threadInfos.end())
 	{
-		reply += "Save To File\n";
+		if (syscall(SYS_tgkill, pid, it->first, 0) != 0 && errno == ESRCH)
+			_threadInfos.erase(it++);
+		else
+			++it;
 	}
 }
 
-void IPCMonitorServer::Enable(string& reply)
+ResourceInfo ResourceStatistics::GetCpuInfo()
 {
-	OptionManager::GetInstance()->SetOptions(PPCO_PROFILER | PPCO_SAVE_TO_FILE);
-
-	reply += "Enable Success";
+	unique_lock<mutex> lock(_infoMutex);
+	return _cpuInfo;
 }
 
-void IPCMonitorServer::Disable(string& reply)
+ResourceInfo ResourceStatistics::GetMemoryInfo()
 {
-	OptionManager::GetInstance()->SetOptions(PPCO_NONE);
-
-	reply += "Disable Success";
+	unique_lock<mutex> lock(_infoMutex);
+	return _memoryInfo;
 }
 
-void IPCMonitorServer::Save(string& reply)
+ResourceInfo ResourceStatistics::GetThreadCpuInfo()
 {
-	OptionManager::GetInstance()->SetOptions(
-		OptionManager::GetInstance()->GetOptions() | PPCO_SAVE_TO_FILE);
-	Performance::GetInstance()->OutPut();
-
-	reply += "Save Success";
+	unique_lock<mutex> lock(_infoMutex);
+	return _threadCpuInfo;
 }
 
-//////////////////////////////////////////////////////////////
-// Ч
+ResourceStatistics::ThreadInfoMap ResourceStatistics::GetThreadInfos()
+{
+	unique_lock<mutex> lock(_infoMutex);
+	_PruneExitedThreads();
+	return _threadInfos;
+}
 
-//ȡ·ļ
-static string GetFileName(const string& path)
+///////////////////////////////////////////////////
+// ProcessStatReader
+
+ProcessStatReader::ProcessStatReader()
+	:_statFd(open("/proc/self/stat", O_RDONLY))
+	, _statmFd(open("/proc/self/statm", O_RDONLY))
+	, _clockTicks(sysconf(_SC_CLK_TCK))
+	, _pageSizeKB(sysconf(_SC_PAGESIZE) / 1024)
+	, _lastCpuTicks(0)
+	, _lastSampleTime(-1)
 {
-	char ch = '/';
-	size_t pos = path.rfind(ch);
-	if (pos == string::npos)
-	{
-		return path;
-	}
-	else
+	if (_statFd < 0 || _statmFd < 0)
 	{
-		return path.substr(pos + 1);
+		RECORD_ERROR_LOG("Open /proc/self/stat Error");
 	}
 }
 
-// PerformanceNode
-PerformanceNode::PerformanceNode(const char* fileName, const char* function,
-	int line, const char* desc)
-	:_fileName(GetFileName(fileName))
-	,_function(function)
-	,_line(line)
-	,_desc(desc)
-{}
+ProcessStatReader::ProcessStatReader(int tid)
+	:_statFd(-1)
+	, _statmFd(-1)
+	, _clockTicks(sysconf(_SC_CLK_TCK))
+	, _pageSizeKB(sysconf(_SC_PAGESIZE) / 1024)
+	, _lastCpuTicks(0)
+	, _lastSampleTime(-1)
+{
+	// ߳̿Ѿ˳ʧɵͨIsOpenж
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/self/task/%d/stat", tid);
+	_statFd = open(path, O_RDONLY | O_CLOEXEC);
+}
 
-bool PerformanceNode::operator<(const PerformanceNode& p) const
+ProcessStatReader::~ProcessStatReader()
 {
-	if (_line > p._line)
+	if (_statFd >= 0)
+		close(_statFd);
+	if (_statmFd >= 0)
+		close(_statmFd);
+}
+
+void ProcessStatReader::Reopen()
+{
+	if (_statFd >= 0)
+		close(_statFd);
+	if (_statmFd >= 0)
+		close(_statmFd);
+
+	_statFd = open("/proc/self/stat", O_RDONLY);
+	_statmFd = open("/proc/self/statm", O_RDONLY);
+	Reset();
+}
+
+bool ProcessStatReader::ReadCpuTicks(LongType& ticks)
+{
+	char buf[1024];
+	ssize_t len = pread(_statFd, buf, sizeof(buf) - 1, 0);
+	if (len <= 0)
 		return false;
+	buf[len] = '\0';
 
-	if (_line < p._line)
-		return true;
+	//
+	// ппո񣬴һ')'֮ʼ
+	// һֶstate(3ֶ)utimestimeǵ1415ֶΡ
+	//
+	char* pos = strrchr(buf, ')');
+	if (pos == NULL)
+		return false;
 
-	if (_fileName > p._fileName)
+	unsigned long long utime = 0, stime = 0;
+	if (sscanf(pos + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+		&utime, &stime) != 2)
+	{
 		return false;
-	
-	if (_fileName < p._fileName)
-		return true;
+	}
 
-	if (_function > p._function)
+	ticks = utime + stime;
+	return true;
+}
+
+bool ProcessStatReader::ReadResidentSize(LongType& kb)
+{
+	char buf[256];
+	ssize_t len = pread(_statmFd, buf, sizeof(buf) - 1, 0);
+	if (len <= 0)
 		return false;
+	buf[len] = '\0';
 
-	if (_function < p._function)
-		return true;
+	// statmڶֶǳפڴҳ
+	long long size = 0, resident = 0;
+	if (sscanf(buf, "%lld %lld", &size, &resident) != 2)
+		return false;
 
-	return false;
+	kb = resident * _pageSizeKB;
+	return true;
 }
 
-bool PerformanceNode::operator == (const PerformanceNode& p) const
+LongType ProcessStatReader::SampleCpuUsage()
 {
-	return _fileName == p._fileName
-		&&_function == p._function
-		&&_line == p._line;
+	LongType now = PerformanceTimer::MonotonicTimeNs();
+	LongType cpuTicks = 0, cpu = -1;
+	if (!ReadCpuTicks(cpuTicks))
+		return -1;
+
+	if (_lastSampleTime > 0 && now > _lastSampleTime)
+	{
+		cpu = (cpuTicks - _lastCpuTicks) * PP_NS_PER_SEC / _clockTicks
+			* 100 / (now - _lastSampleTime);
+	}
+
+	_lastCpuTicks = cpuTicks;
+	_lastSampleTime = now;
+	return cpu;
 }
 
-void PerformanceNode::Serialize(SaveAdapter& SA) const
+///////////////////////////////////////////////////
+// ResourceSampler
+
+static void StopResourceSampler()
 {
-	SA.Save("FileName:%s, Fuction:%s, Line:%d\n",
-		_fileName.c_str(), _function.c_str(), _line);
+	ResourceSampler::GetInstance()->Stop();
 }
 
-///////////////////////////////////////////////////////////////
-//PerformanceSection
-void PerformanceSection::Serialize(SaveAdapter& SA)
+static void RestartResourceSamplerInChild()
 {
-	// ܵü0ʾβƥ
-	if (_totalRef)
-		SA.Save("Performance Profiler Not Match!\n");
+	ResourceSampler::GetInstance()->RestartInChild();
+}
 
-	// лЧͳϢ
-	auto costTimeIt = _costTimeMap.begin();
-	for (; costTimeIt != _costTimeMap.end(); ++costTimeIt)
-	{
-		LongType callCount = _callCountMap[costTimeIt->first];
-		SA.Save("Thread Id:%d, Cost Time:%.2f, Call Count:%d\n",
-			 costTimeIt->first, 
-			(double)costTimeIt->second / CLOCKS_PER_SEC,
-			callCount);
-	}
+ResourceSampler::ResourceSampler()
+	:_activeCount(0)
+	, _rebase(false)
+	, _stop(false)
+	, _samplerThread(&ResourceSampler::_Sample, this)
+{
+	// ˳ʱֹͣ߳
+	atexit(StopResourceSampler);
+	pthread_atfork(NULL, NULL, RestartResourceSamplerInChild);
+}
 
-	SA.Save("Total Cost Time:%.2f, Total Call Count:%d\n",
-		(double)_totalCostTime / CLOCKS_PER_SEC, _totalCallCount);
+ResourceSampler::~ResourceSampler()
+{
+	Stop();
+}
 
-	// лԴͳϢ
-	if (_rsStatistics)
+void ResourceSampler::Register(ResourceStatistics* rs)
+{
+	unique_lock<mutex> lock(_mutex);
+	_rsList.push_back(rs);
+}
+
+void ResourceSampler::Activate()
+{
+	if (_activeCount++ == 0)
 	{
-		ResourceInfo cpuInfo = _rsStatistics->GetCpuInfo();
-		SA.Save("Cpu Peak:%lld%%, Avg:%lld%%\n", cpuInfo._peak, cpuInfo._avg);
+		// ½״̬ʱCPUʹʴһβ¼
+		_rebase = true;
 
-		ResourceInfo memoryInfo = _rsStatistics->GetMemoryInfo();
-		SA.Save("Memory Peak:%lldK, Avg:%lldK\n", memoryInfo._peak / 1024, memoryInfo._avg / 1024);
+		unique_lock<mutex> lock(_mutex);
+		_condVariable.notify_one();
 	}
 }
 
-//////////////////////////////////////////////////////////////
-// Performance
-PerformanceSection* Performance::CreateSection(const char* fileName,
-	const char* function, int line, const char* extraDesc, bool isStatistics)
+void ResourceSampler::Deactivate()
 {
-	PerformanceSection* section = NULL;
-	PerformanceNode node(fileName, function, line, extraDesc);
+	--_activeCount;
+}
 
-	unique_lock<mutex> Lock(_mutex);
-	auto it = _ppMap.find(node);
-	if (it != _ppMap.end())
+void ResourceSampler::Stop()
+{
 	{
-		section = it->second;
+		unique_lock<mutex> lock(_mutex);
+		if (_stop)
+			return;
+
+		_stop = true;
+		_condVariable.notify_one();
 	}
-	else
+
+	if (_samplerThread.joinable())
 	{
-		section = new PerformanceSection;
-		if (isStatistics)
-		{
-			section->_rsStatistics = new ResourceStatistics();
-		}
-		_ppMap[node] = section;
+		_samplerThread.join();
 	}
-
-	return section;
 }
 
-void PerformanceSection::Begin(int threadId)
+void ResourceSampler::RestartInChild()
 {
-	unique_lock<mutex> Lock(_mutex);
-
-	// µôͳ
-	++_callCountMap[threadId];
+	RebuildInChild(_mutex);
+	RebuildInChild(_condVariable);
 
-	// ü == 0 ʱ¶οʼʱͳƣݹ⡣
-	auto& refCount = _refCountMap[threadId];
-	if (refCount == 0)
+	// ߳̽Ķӽụֻ̂߳fork߳
+	PerformanceThreadContext* context = PeekThreadContext();
+	int activeCount = 0;
+	for (size_t i = 0; i < _rsList.size(); ++i)
 	{
-		_beginTimeMap[threadId] = clock();
+		_rsList[i]->ResetInChild(context ? context->_index : -1, syscall(SYS_gettid));
+		if (_rsList[i]->IsActive())
+			++activeCount;
+	}
+	_activeCount = activeCount;
 
-		// ʼԴͳ
-		if (_rsStatistics)
-		{
-			_rsStatistics->StartStatistics();
-		}
+	if (_stop)
+		return;
+
+	// ̸̵߳Ķȡӽû
+	map<int, ProcessStatReader*>::iterator it = _threadReaders.begin();
+	for (; it != _threadReaders.end(); ++it)
+	{
+		delete it->second;
 	}
+	_threadReaders.clear();
 
-	// οʼüͳ
-	++refCount;
-	++_totalRef;
-	++_totalCallCount;
+	_statReader.Reopen();
+	_rebase = true;
+
+	new(&_samplerThread) std::thread(&ResourceSampler::_Sample, this);
 }
 
-void PerformanceSection::End(int threadId)
+void ResourceSampler::_SampleThreads(const vector<ResourceStatistics*>& rsList,
+	map<int, LongType>& threadCpus)
 {
-	unique_lock<mutex> Lock(_mutex);
+	// ͬһ߳ڶʱֻȡһ
+	vector<int> tids;
+	for (size_t i = 0; i < rsList.size(); ++i)
+	{
+		if (rsList[i]->IsActive())
+		{
+			rsList[i]->GetActiveThreads(tids);
+		}
+	}
+
+	for (size_t i = 0; i < tids.size(); ++i)
+	{
+		threadCpus[tids[i]] = -1;
+	}
+
+	//
+	// 뿪жε̹߳رնȡٴνʱ½׼
+	// ڶڵʱ䲻һεʹʡ
+	//
+	map<int, ProcessStatReader*>::iterator it = _threadReaders.begin();
+	while (it != _threadReaders.end())
+	{
+		if (threadCpus.count(it->first) == 0)
+		{
+			delete it->second;
+			_threadReaders.erase(it++);
+		}
+		else
+		{
+			++it;
+		}
+	}
+
+	map<int, LongType>::iterator cpuIt = threadCpus.begin();
+	for (; cpuIt != threadCpus.end(); ++cpuIt)
+	{
+		ProcessStatReader*& reader = _threadReaders[cpuIt->first];
+		if (reader == NULL)
+		{
+			reader = new ProcessStatReader(cpuIt->first);
+		}
+
+		if (reader->IsOpen())
+		{
+			cpuIt->second = reader->SampleCpuUsage();
+		}
+	}
+}
+
+void ResourceSampler::_Sample()
+{
+	while (1)
+	{
+		vector<ResourceStatistics*> rsList;
+		{
+			unique_lock<std::mutex> lock(_mutex);
+
+			//
+			// ûлԴͳƶʱʹ
+			//
+			while (!_stop && _activeCount == 0)
+			{
+				_condVariable.wait(lock);
+			}
+
+			if (_stop)
+				break;
+
+			rsList = _rsList;
+		}
+
+		// һν̵CPUʹʺͳפڴ棬ַлԴͳƶ
+		if (_rebase.exchange(false))
+		{
+			_statReader.Reset();
+		}
+
+		LongType cpu = _statReader.SampleCpuUsage();
+		LongType memory = -1;
+		_statReader.ReadResidentSize(memory);
+		LongType now = PerformanceTimer::MonotonicTimeNs();
+
+		map<int, LongType> threadCpus;
+		_SampleThreads(rsList, threadCpus);
+
+		for (size_t i = 0; i < rsList.size(); ++i)
+		{
+			if (rsList[i]->IsActive())
+			{
+				rsList[i]->Update(cpu, memory, now, threadCpus);
+			}
+		}
+
+		// ÿͳһΣɱStopǰ
+		unique_lock<std::mutex> lock(_mutex);
+		if (!_stop)
+		{
+			_condVariable.wait_for(lock, std::chrono::milliseconds(
+				OptionManager::GetInstance()->GetSamplePeriod()));
+		}
+	}
+}
+
+///////////////////////////////////////////////////
+// SharedStatsPublisher
+
+static void StopSharedStatsPublisher()
+{
+	SharedStatsPublisher::GetInstance()->Stop();
+}
+
+static void RestartSharedStatsPublisherInChild()
+{
+	SharedStatsPublisher::GetInstance()->RestartInChild();
+}
+
+SharedStatsPublisher::SharedStatsPublisher()
+	:_created(false)
+	, _stop(false)
+	, _publishThread(&SharedStatsPublisher::_Publish, this)
+{
+	atexit(StopSharedStatsPublisher);
+	pthread_atfork(NULL, NULL, RestartSharedStatsPublisherInChild);
+}
+
+SharedStatsPublisher::~SharedStatsPublisher()
+{
+	Stop();
+}
+
+void SharedStatsPublisher::Stop()
+{
+	{
+		unique_lock<mutex> lock(_mutex);
+		if (_stop)
+			return;
+
+		_stop = true;
+		_condVariable.notify_one();
+	}
+
+	if (_publishThread.joinable())
+	{
+		_publishThread.join();
+	}
+
+	if (_created)
+	{
+		_region.Close();
+		SharedStatsRegion::Unlink(getpid());
+		_created = false;
+	}
+}
+
+void SharedStatsPublisher::RestartInChild()
+{
+	RebuildInChild(_mutex);
+	RebuildInChild(_condVariable);
+	if (_stop)
+		return;
+
+	if (_created)
+	{
+		_region.Close();
+		_created = false;
+	}
+
+	_statReader.Reopen();
+
+	new(&_publishThread) std::thread(&SharedStatsPublisher::_Publish, this);
+}
+
+void SharedStatsPublisher::_Publish()
+{
+	while (1)
+	{
+		{
+			unique_lock<std::mutex> lock(_mutex);
+			if (!_stop)
+			{
+				_condVariable.wait_for(lock, std::chrono::milliseconds(
+					OptionManager::GetInstance()->GetPublishPeriod()));
+			}
+
+			if (_stop)
+				break;
+		}
+
+		if (!OptionManager::IsEnabled(PPCO_PUBLISH_SHM))
+			continue;
+
+		// һηʱŴڴ
+		if (!_created)
+		{
+			_created = _region.Create(getpid());
+			if (!_created)
+			{
+				RECORD_ERROR_LOG("Create Shared Stats Region Error");
+				continue;
+			}
+
+			_region.Header()->_beginTime = time(NULL);
+		}
+
+		SharedStatsHeader* header = _region.Header();
+		LongType cpu = _statReader.SampleCpuUsage();
+		LongType memory = -1;
+		_statReader.ReadResidentSize(memory);
+		header->_processCpu.store(cpu, memory_order_relaxed);
+		header->_processMemory.store(memory, memory_order_relaxed);
+
+		Performance::GetInstance()->PublishSharedStats(_region);
+
+		header->_publishTime.store(PerformanceTimer::MonotonicTimeNs(), memory_order_relaxed);
+		header->_publishCount.fetch_add(1, memory_order_release);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// ReportWriter
+
+#define PP_REPORT_DIRECTORY "/tmp/performance_profiler"
+
+// ˳ʱȴдʱ()
+#ifndef PP_EXIT_FLUSH_TIMEOUT
+#define PP_EXIT_FLUSH_TIMEOUT 3000
+#endif
+
+// IPCȴдʱ()
+#define PP_IPC_SAVE_TIMEOUT 1000
+
+// д߳ÿȴʱ()̵ıʱЧ
+#define PP_REPORT_PERIOD_CHECK 1000
+
+// ڱļĹǰ׺̡еڱһת
+#define PP_PERIODIC_REPORT_PREFIX "PerformanceReport_"
+
+// дʱļ߲ῴдһı
+static bool WriteReportFile(const string& path, const string& content)
+{
+	string tmpPath = path + ".tmp";
+	int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+	{
+		mkdir(PP_REPORT_DIRECTORY, 0777);
+		fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (fd < 0)
+			return false;
+	}
+
+	bool success = WriteAll(fd, content.data(), content.size());
+	close(fd);
+
+	if (!success || rename(tmpPath.c_str(), path.c_str()) != 0)
+	{
+		unlink(tmpPath.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+// ڱļǰ׺ʱͬʱеĽ̲дͬһļ
+static string PeriodicReportPrefix()
+{
+	char prefix[64];
+	snprintf(prefix, sizeof(prefix), PP_PERIODIC_REPORT_PREFIX "%d_", getpid());
+	return prefix;
+}
+
+static void RestartReportWriterInChild()
+{
+	ReportWriter::GetInstance()->RestartInChild();
+}
+
+ReportWriter::ReportWriter()
+	:_writing(false)
+	, _stop(false)
+	, _writeThread(&ReportWriter::_Write, this)
+{
+	pthread_atfork(NULL, NULL, RestartReportWriterInChild);
+}
+
+ReportWriter::~ReportWriter()
+{
+	Stop(0);
+}
+
+void ReportWriter::Submit(const string& path, string& content)
+{
+	unique_lock<mutex> lock(_mutex);
+
+	auto it = _jobs.begin();
+	for (; it != _jobs.end(); ++it)
+	{
+		if (it->_path == path)
+		{
+			it->_content.swap(content);
+			return;
+		}
+	}
+
+	_jobs.push_back(ReportJob());
+	_jobs.back()._path = path;
+	_jobs.back()._content.swap(content);
+	_condVariable.notify_one();
+}
+
+bool ReportWriter::Flush(int timeoutMs)
+{
+	unique_lock<mutex> lock(_mutex);
+	return _idleCondVariable.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+		[this]() { return _jobs.empty() && !_writing; });
+}
+
+void ReportWriter::Stop(int timeoutMs)
+{
+	{
+		unique_lock<mutex> lock(_mutex);
+		if (_stop)
+			return;
+
+		_stop = true;
+		_condVariable.notify_one();
+	}
+
+	if (!_writeThread.joinable())
+		return;
+
+	if (Flush(timeoutMs))
+	{
+		_writeThread.join();
+	}
+	else
+	{
+		// д߳I/OϣȴʱļḲб
+		RECORD_ERROR_LOG("Flush Report Timeout");
+		_writeThread.detach();
+	}
+}
+
+void ReportWriter::RestartInChild()
+{
+	RebuildInChild(_mutex);
+	RebuildInChild(_condVariable);
+	RebuildInChild(_idleCondVariable);
+	if (_stop)
+		return;
+
+	_jobs.clear();
+	_writing = false;
+
+	new(&_writeThread) std::thread(&ReportWriter::_Write, this);
+}
+
+void ReportWriter::_Write()
+{
+	LongType lastReportTime = PerformanceTimer::MonotonicTimeNs();
+
+	while (1)
+	{
+		ReportJob job;
+		bool periodic = false;
+		{
+			unique_lock<std::mutex> lock(_mutex);
+			_writing = false;
+
+			if (_jobs.empty())
+			{
+				_idleCondVariable.notify_all();
+				if (_stop)
+					break;
+
+				// ֶεȴÿ¶ȡ
+				LongType period = OptionManager::GetInstance()->GetReportPeriod();
+				LongType elapsed = (PerformanceTimer::MonotonicTimeNs() - lastReportTime) / 1000000;
+				if (elapsed < period)
+				{
+					LongType wait = min(period - elapsed, (LongType)PP_REPORT_PERIOD_CHECK);
+					_condVariable.wait_for(lock, std::chrono::milliseconds(wait));
+				}
+			}
+
+			if (!_jobs.empty())
+			{
+				job = std::move(_jobs.front());
+				_jobs.pop_front();
+				_writing = true;
+			}
+			else if (!_stop)
+			{
+				LongType period = OptionManager::GetInstance()->GetReportPeriod();
+				LongType now = PerformanceTimer::MonotonicTimeNs();
+				if ((now - lastReportTime) / 1000000 >= period)
+				{
+					lastReportTime = now;
+					periodic = OptionManager::IsEnabled(PPCO_SAVE_PERIODICALLY);
+					_writing = periodic;
+				}
+			}
+		}
+
+		if (periodic)
+		{
+			_WritePeriodicReport();
+		}
+		else if (!job._path.empty())
+		{
+			if (!WriteReportFile(job._path, job._content))
+			{
+				RECORD_ERROR_LOG("Write Report Error");
+			}
+		}
+	}
+}
+
+void ReportWriter::_WritePeriodicReport()
+{
+	BufferSaveAdapter BSA;
+	const char* extension = Performance::GetInstance()->_OutPutByFormat(
+		BSA, OptionManager::GetInstance()->GetOptions());
+
+	string report;
+	BSA.Release(report);
+
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	struct tm tm;
+	localtime_r(&ts.tv_sec, &tm);
+
+	char timeStr[32];
+	strftime(timeStr, sizeof(timeStr), "%Y%m%d-%H%M%S", &tm);
+
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%s%s-%03ld%s", PP_REPORT_DIRECTORY,
+		PeriodicReportPrefix().c_str(), timeStr, ts.tv_nsec / 1000000, extension);
+
+	if (!WriteReportFile(path, report))
+	{
+		RECORD_ERROR_LOG("Write Periodic Report Error");
+		return;
+	}
+
+	_Rotate();
+}
+
+void ReportWriter::_Rotate()
+{
+	DIR* dir = opendir(PP_REPORT_DIRECTORY);
+	if (dir == NULL)
+		return;
+
+	// ޸ʱڱ棺(޸ʱ(), (·, С))
+	vector<pair<LongType, pair<string, LongType> > > reports;
+
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != NULL)
+	{
+		//
+		// ǰ׺ƥ䣬˳Ľ̺֮ǰµڱҲơ
+		// ڱĸʽлʽļһת
+		//
+		string name = entry->d_name;
+		size_t dot = name.rfind('.');
+		string extension = dot == string::npos ? "" : name.substr(dot);
+		if (name.compare(0, strlen(PP_PERIODIC_REPORT_PREFIX), PP_PERIODIC_REPORT_PREFIX) != 0
+			|| (extension != ".txt" && extension != ".json" && extension != ".csv"))
+			continue;
+
+		string path = string(PP_REPORT_DIRECTORY "/") + name;
+		struct stat st;
+		if (stat(path.c_str(), &st) == 0)
+		{
+			LongType mtime = st.st_mtim.tv_sec * PP_NS_PER_SEC + st.st_mtim.tv_nsec;
+			reports.push_back(make_pair(mtime, make_pair(path, (LongType)st.st_size)));
+		}
+	}
+	closedir(dir);
+
+	// ̵ͬļʱ򣬰޸ʱµۼƣƵľļȫɾµһǱ
+	sort(reports.begin(), reports.end());
+
+	size_t maxFiles = OptionManager::GetInstance()->GetReportMaxFiles();
+	LongType maxBytes = OptionManager::GetInstance()->GetReportMaxBytes();
+	LongType totalBytes = 0;
+	size_t kept = 0;
+	for (size_t i = reports.size(); i > 0; --i)
+	{
+		const pair<string, LongType>& report = reports[i - 1].second;
+		if (kept > 0 && (kept >= maxFiles || totalBytes + report.second > maxBytes))
+		{
+			unlink(report.first.c_str());
+			continue;
+		}
+
+		totalBytes += report.second;
+		++kept;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// IPCMonitorServer
+
+int GetProcessId()
+{
+	int processId = 0;
+	processId = getpid();
+
+	return processId;
+}
+
+const char* SERVER_SOCKET_NAME = "/tmp/performance_profiler/_sock";
+string GetServerSocketName()
+{
+	string name = SERVER_SOCKET_NAME;
+	string idStr(to_string((long long)GetProcessId()));
+	name += idStr;
+	return name;
+}
+
+static void StopIPCMonitorServer()
+{
+	IPCMonitorServer::GetInstance()->Stop();
+}
+
+static void RestartIPCMonitorServerInChild()
+{
+	IPCMonitorServer::GetInstance()->RestartInChild();
+}
+
+IPCMonitorServer::IPCMonitorServer()
+	:_server(GetServerSocketName().c_str())
+{
+	printf("%s IPC Monitor Server Start\n", GetServerSocketName().c_str());
+
+	_cmdFuncsMap["state"] = GetState;
+	_cmdFuncsMap["save"] = Save;
+	_cmdFuncsMap["disable"] = Disable;
+	_cmdFuncsMap["enable"] = Enable;
+	_cmdFuncsMap["trace_on"] = TraceOn;
+	_cmdFuncsMap["trace_off"] = TraceOff;
+	_cmdFuncsMap["trace_save"] = TraceSave;
+	_cmdFuncsMap["report"] = Report;
+	_cmdFuncsMap["report_json"] = ReportJson;
+	_cmdFuncsMap["report_csv"] = ReportCsv;
+	_cmdFuncsMap["calibrate"] = Calibrate;
+	_cmdFuncsMap["interval_on"] = IntervalOn;
+	_cmdFuncsMap["interval_off"] = IntervalOff;
+	_cmdFuncsMap["interval"] = Interval;
+	_cmdFuncsMap["interval_json"] = IntervalJson;
+	_cmdFuncsMap["sample_on"] = SampleOn;
+	_cmdFuncsMap["sample_off"] = SampleOff;
+	_cmdFuncsMap["sample"] = Sample;
+	_cmdFuncsMap["sample_folded"] = SampleFolded;
+	_cmdFuncsMap["sample_clear"] = SampleClear;
+
+	// ɺ߳
+	_onMsgThread = std::thread(&IPCMonitorServer::OnMessage, this);
+	atexit(StopIPCMonitorServer);
+	pthread_atfork(NULL, NULL, RestartIPCMonitorServerInChild);
+}
+
+void IPCMonitorServer::Start()
+{
+}
+
+void IPCMonitorServer::Stop()
+{
+	_server.Stop();
+	if (_onMsgThread.joinable())
+	{
+		_onMsgThread.join();
+	}
+	_server.Close();
+}
+
+void IPCMonitorServer::RestartInChild()
+{
+	// ֹͣķ
+	if (!_onMsgThread.joinable())
+		return;
+
+	_server.ResetInChild(GetServerSocketName().c_str());
+	printf("%s IPC Monitor Server Start\n", GetServerSocketName().c_str());
+
+	new(&_onMsgThread) std::thread(&IPCMonitorServer::OnMessage, this);
+}
+
+void IPCMonitorServer::OnMessage()
+{
+	if(!_server.Listen())
+	{
+		return;
+	}
+
+	_server.Run(std::bind(&IPCMonitorServer::OnCommand, this,
+		std::placeholders::_1, std::placeholders::_2));
+}
+
+void IPCMonitorServer::OnCommand(const string& msg, string& reply)
+{
+	printf("Receiver Cmd Msg: %s\n", msg.c_str());
+
+	CmdFuncMap::iterator it = _cmdFuncsMap.find(msg);
+	if (it != _cmdFuncsMap.end())
+	{
+		CmdFunc func = it->second;
+		func(reply);
+	}
+	else
+	{
+		reply = "Invalid Command";
+	}
+}
+
+void IPCMonitorServer::GetState(string& reply)
+{
+	reply += "State:";
+	int flag = OptionManager::GetInstance()->GetOptions();
+
+	if (flag == PPCO_NONE)
+	{
+		reply += "None\n";
+		return;
+	}
+
+	if (flag & PPCO_PROFILER)
+	{
+		reply += "Performance Profiler \n";
+	}
+
+	if (flag & PPCO_SAVE_TO_CONSOLE)
+	{
+		reply += "Save To Console\n";
+	}
+
+	if (flag & PPCO_SAVE_TO_FILE)
+	{
+		reply += "Save To File\n";
+	}
+
+	if (flag & PPCO_TRACE)
+	{
+		reply += "Trace\n";
+	}
+
+	if (flag & PPCO_PERF_COUNTER)
+	{
+		reply += "Perf Counter\n";
+	}
+
+	if (flag & PPCO_SAVE_PERIODICALLY)
+	{
+		reply += "Save Periodically\n";
+	}
+
+	if (flag & PPCO_INTERVAL_STATS)
+	{
+		reply += "Interval Stats\n";
+	}
+
+	if (flag & PPCO_HEAP_PROFILER)
+	{
+		reply += "Heap Profiler\n";
+	}
+
+	if (flag & PPCO_OS_STAT)
+	{
+		reply += "Os Stat\n";
+	}
+
+	if (flag & PPCO_LOCK_PROFILER)
+	{
+		reply += "Lock Profiler\n";
+	}
+
+	if (flag & PPCO_FUNC_INSTRUMENT)
+	{
+		reply += "Function Instrument\n";
+	}
+
+	if (flag & PPCO_STACK_SAMPLER)
+	{
+		reply += "Stack Sampler\n";
+	}
+
+	if (flag & PPCO_SAVE_AS_JSON)
+	{
+		reply += "Save As JSON\n";
+	}
+
+	if (flag & PPCO_SAVE_AS_CSV)
+	{
+		reply += "Save As CSV\n";
+	}
+}
+
+void IPCMonitorServer::Enable(string& reply)
+{
+	OptionManager::GetInstance()->SetOptions(PPCO_PROFILER | PPCO_SAVE_TO_FILE);
+
+	reply += "Enable Success";
+}
+
+void IPCMonitorServer::Disable(string& reply)
+{
+	OptionManager::GetInstance()->SetOptions(PPCO_NONE);
+
+	reply += "Disable Success";
+}
+
+void IPCMonitorServer::Save(string& reply)
+{
+	OptionManager::GetInstance()->SetOptions(
+		OptionManager::GetInstance()->GetOptions() | PPCO_SAVE_TO_FILE);
+	Performance::GetInstance()->OutPut();
+
+	// ȴд߳д꣬ʱ˵I/OסIPC߳
+	if (ReportWriter::GetInstance()->Flush(PP_IPC_SAVE_TIMEOUT))
+		reply += "Save Success";
+	else
+		reply += "Save Submitted, Writing In Background";
+}
+
+void IPCMonitorServer::Report(string& reply)
+{
+	StringSaveAdapter SSA(reply);
+	Performance::GetInstance()->_OutPut(SSA);
+}
+
+void IPCMonitorServer::ReportJson(string& reply)
+{
+	BufferSaveAdapter BSA;
+	Performance::GetInstance()->_OutPutJson(BSA);
+	BSA.Release(reply);
+}
+
+void IPCMonitorServer::ReportCsv(string& reply)
+{
+	BufferSaveAdapter BSA;
+	Performance::GetInstance()->_OutPutCsv(BSA);
+	BSA.Release(reply);
+}
+
+void IPCMonitorServer::Calibrate(string& reply)
+{
+	Performance::GetInstance()->CalibrateOverhead();
+
+	PerformanceOverhead overhead = Performance::GetInstance()->GetOverhead();
+	StringSaveAdapter SSA(reply);
+	SSA.Save("Calibrate Success. Inner:%lldns, Outer:%lldns",
+		overhead._inner, overhead._outer);
+}
+
+void IPCMonitorServer::IntervalOn(string& reply)
+{
+	OptionManager::GetInstance()->SetOptions(
+		OptionManager::GetInstance()->GetOptions() | PPCO_INTERVAL_STATS);
+
+	reply += "Interval On Success";
+}
+
+void IPCMonitorServer::IntervalOff(string& reply)
+{
+	OptionManager::GetInstance()->SetOptions(
+		OptionManager::GetInstance()->GetOptions() & ~PPCO_INTERVAL_STATS);
+
+	reply += "Interval Off Success";
+}
+
+void IPCMonitorServer::Interval(string& reply)
+{
+	StringSaveAdapter SSA(reply);
+	IntervalRecorder::GetInstance()->OutPutLatest(SSA);
+}
+
+void IPCMonitorServer::IntervalJson(string& reply)
+{
+	StringSaveAdapter SSA(reply);
+	IntervalRecorder::GetInstance()->OutPutSeries(SSA);
+}
+
+void IPCMonitorServer::SampleOn(string& reply)
+{
+	OptionManager::GetInstance()->SetOptions(
+		OptionManager::GetInstance()->GetOptions() | PPCO_STACK_SAMPLER);
+
+	reply += "Sample On Success";
+}
+
+void IPCMonitorServer::SampleOff(string& reply)
+{
+	OptionManager::GetInstance()->SetOptions(
+		OptionManager::GetInstance()->GetOptions() & ~PPCO_STACK_SAMPLER);
+
+	reply += "Sample Off Success";
+}
+
+void IPCMonitorServer::Sample(string& reply)
+{
+	StringSaveAdapter SSA(reply);
+	Performance::GetInstance()->_OutPutStackSamples(SSA, false);
+}
+
+void IPCMonitorServer::SampleFolded(string& reply)
+{
+	StringSaveAdapter SSA(reply);
+	Performance::GetInstance()->_OutPutStackSamples(SSA, true);
+}
+
+void IPCMonitorServer::SampleClear(string& reply)
+{
+	StackSampler::GetInstance()->Clear();
+
+	reply += "Sample Clear Success";
+}
+
+void IPCMonitorServer::TraceOn(string& reply)
+{
+	OptionManager::GetInstance()->SetOptions(
+		OptionManager::GetInstance()->GetOptions() | PPCO_TRACE);
+
+	reply += "Trace On Success";
+}
+
+void IPCMonitorServer::TraceOff(string& reply)
+{
+	OptionManager::GetInstance()->SetOptions(
+		OptionManager::GetInstance()->GetOptions() & ~PPCO_TRACE);
+
+	reply += "Trace Off Success";
+}
+
+void IPCMonitorServer::TraceSave(string& reply)
+{
+	Performance::GetInstance()->OutPutTrace();
+
+	if (ReportWriter::GetInstance()->Flush(PP_IPC_SAVE_TIMEOUT))
+		reply += "Trace Save Success";
+	else
+		reply += "Trace Save Submitted, Writing In Background";
+}
+
+//////////////////////////////////////////////////////////////
+// Ч
+
+//ȡ·ļ
+static string GetFileName(const string& path)
+{
+	char ch = '/';
+	size_t pos = path.rfind(ch);
+	if (pos == string::npos)
+	{
+		return path;
+	}
+	else
+	{
+		return path.substr(pos + 1);
+	}
+}
+
+// PerformanceNode
+PerformanceNode::PerformanceNode(const char* fileName, const char* function,
+	int line, const char* desc)
+	:_fileName(GetFileName(fileName))
+	,_function(function)
+	,_line(line)
+	,_desc(desc)
+{}
+
+bool PerformanceNode::operator<(const PerformanceNode& p) const
+{
+	if (_line > p._line)
+		return false;
+
+	if (_line < p._line)
+		return true;
+
+	if (_fileName > p._fileName)
+		return false;
+	
+	if (_fileName < p._fileName)
+		return true;
+
+	if (_function > p._function)
+		return false;
+
+	if (_function < p._function)
+		return true;
+
+	return false;
+}
+
+bool PerformanceNode::operator == (const PerformanceNode& p) const
+{
+	return _fileName == p._fileName
+		&&_function == p._function
+		&&_line == p._line;
+}
+
+void PerformanceNode::Serialize(SaveAdapter& SA) const
+{
+	SA.Save("FileName:%s, Fuction:%s, Line:%d\n",
+		_fileName.c_str(), _function.c_str(), _line);
+}
+
+///////////////////////////////////////////////////////////////
+// PerformanceThreadContext
+
+//
+// ߳ŷ̵ֻ߳һνκ߳˳ʱ
+//
+class ThreadIndexAllocator
+{
+public:
+	ThreadIndexAllocator()
+		:_nextIndex(0)
+	{}
+
+	int Alloc()
+	{
+		unique_lock<mutex> Lock(_mutex);
+		if (!_freeIndexs.empty())
+		{
+			int index = _freeIndexs.back();
+			_freeIndexs.pop_back();
+			return index;
+		}
+
+		if (_nextIndex < PP_MAX_THREADS)
+			return _nextIndex++;
+
+		return -1;
+	}
+
+	void Free(int index)
+	{
+		unique_lock<mutex> Lock(_mutex);
+		_freeIndexs.push_back(index);
+	}
+
+	// forkӽֻеforḳ̵߳߳
+	void ResetInChild(int current)
+	{
+		RebuildInChild(_mutex);
+		_freeIndexs.clear();
+		for (int i = 0; i < _nextIndex; ++i)
+		{
+			if (i != current)
+				_freeIndexs.push_back(i);
+		}
+	}
+
+	static ThreadIndexAllocator& Instance()
+	{
+		// ߳˳ʱõԲ
+		static ThreadIndexAllocator* allocator = new ThreadIndexAllocator;
+		return *allocator;
+	}
+private:
+	mutex _mutex;
+	int _nextIndex;
+	vector<int> _freeIndexs;
+};
+
+// ߳ŵĵڵ㣬Ÿʱۼ
+static atomic<CallTreeNode*> s_callTreeRoots[PP_MAX_THREADS];
+
+// ǰ߳Ѵģѷͨһ
+static __thread PerformanceThreadContext* s_currentContext;
+
+// Ѵ߳ĸı
+static atomic<LongType> s_contextGeneration(0);
+
+//
+// ֲ߳̾ĳߣ߳˳ʱ߳š
+//
+class ThreadContextHolder
+{
+public:
+	ThreadContextHolder()
+	{
+		_context._index = ThreadIndexAllocator::Instance().Alloc();
+		_context._threadId = GetThreadId();
+		_context._tid = syscall(SYS_gettid);
+		_context._generation = ++s_contextGeneration;
+		_context._traceRing = NULL;
+		_context._perfCounters = NULL;
+		_context._osStat = NULL;
+		_context._root = NULL;
+		_context._depth = 0;
+		_context._random = (((uint64_t)_context._tid << 32)
+			^ (uint64_t)PerformanceTimer::MonotonicTimeNs()) | 1;
+
+		if (_context._index >= 0)
+		{
+			atomic<CallTreeNode*>& root = s_callTreeRoots[_context._index];
+			_context._root = root.load(memory_order_acquire);
+			if (_context._root == NULL)
+			{
+				_context._root = new CallTreeNode(NULL, NULL);
+				root.store(_context._root, memory_order_release);
+			}
+
+			s_currentContext = &_context;
+		}
+	}
+
+	~ThreadContextHolder()
+	{
+		s_currentContext = NULL;
+
+		// ֻͳƱ̣߳߳˳ʱر
+		delete _context._perfCounters;
+		_context._perfCounters = NULL;
+		delete _context._osStat;
+		_context._osStat = NULL;
+
+		if (_context._index >= 0)
+		{
+			ThreadIndexAllocator::Instance().Free(_context._index);
+		}
+	}
+
+	PerformanceThreadContext* Get()
+	{
+		return _context._index >= 0 ? &_context : NULL;
+	}
+private:
+	PerformanceThreadContext _context;
+};
+
+PerformanceThreadContext* GetThreadContext()
+{
+	static thread_local ThreadContextHolder holder;
+	return holder.Get();
+}
+
+PerformanceThreadContext* PeekThreadContext()
+{
+	return s_currentContext;
+}
+
+// ǰ߳ڲĻΣʱȡ¼һ
+static PerformanceSection* InnermostSection(PerformanceThreadContext* context)
+{
+	int depth = context->_depth;
+	if (depth <= 0)
+		return NULL;
+
+	if (depth > PP_MAX_STACK_DEPTH)
+		depth = PP_MAX_STACK_DEPTH;
+
+	return context->_stack[depth - 1]._node->_section;
+}
+
+PerformanceSection* CurrentSection()
+{
+	PerformanceThreadContext* context = PeekThreadContext();
+	if (context == NULL)
+		return NULL;
+
+	return InnermostSection(context);
+}
+
+void OnHeapAlloc(size_t bytes)
+{
+	PerformanceThreadContext* context = PeekThreadContext();
+	if (context == NULL)
+		return;
+
+	PerformanceSection* section = InnermostSection(context);
+	if (section)
+	{
+		section->RecordHeapAlloc(context, bytes);
+	}
+}
+
+void OnHeapFree(size_t bytes)
+{
+	PerformanceThreadContext* context = PeekThreadContext();
+	if (context == NULL)
+		return;
+
+	PerformanceSection* section = InnermostSection(context);
+	if (section)
+	{
+		section->RecordHeapFree(context, bytes);
+	}
+}
+
+///////////////////////////////////////////////////////////////
+// CallTree
+
+CallTreeNode* CallTreeNode::GetChild(PerformanceSection* section)
+{
+	CallTreeNode* child = _firstChild.load(memory_order_relaxed);
+	for (; child; child = child->_nextSibling)
+	{
+		if (child->_section == section)
+			return child;
+	}
+
+	// ÿñֻһΣʼɺٷ߳
+	child = new CallTreeNode(section, this);
+	child->_nextSibling = _firstChild.load(memory_order_relaxed);
+	_firstChild.store(child, memory_order_release);
+
+	return child;
+}
+
+static void PushCallFrame(PerformanceThreadContext* context,
+	PerformanceSection* section, LongType now)
+{
+	int depth = context->_depth;
+	if (depth >= PP_MAX_STACK_DEPTH)
+	{
+		context->_depth = depth + 1;
+		return;
+	}
+
+	//
+	// GetChildһξñʱڴ棬ջ֡úȣ
+	// ѷڷпջġ
+	//
+	CallTreeNode* parent = depth ? context->_stack[depth - 1]._node : context->_root;
+	CallStackFrame& frame = context->_stack[depth];
+	frame._node = parent->GetChild(section);
+	frame._beginTime = now;
+	context->_depth = depth + 1;
+}
+
+// forkӽյۼֵڵ㱣ڽеĵ
+static void ClearCallTree(CallTreeNode* node)
+{
+	node->_callCount.store(0, memory_order_relaxed);
+	node->_sampledCount.store(0, memory_order_relaxed);
+	node->_inclusiveTime.store(0, memory_order_relaxed);
+
+	CallTreeNode* child = node->_firstChild.load(memory_order_acquire);
+	for (; child; child = child->_nextSibling)
+	{
+		ClearCallTree(child);
+	}
+}
+
+static void PopCallFrame(PerformanceThreadContext* context,
+	PerformanceSection* section, LongType now)
+{
+	// ȵջ֡ûм¼
+	if (context->_depth > PP_MAX_STACK_DEPTH)
+	{
+		--context->_depth;
+		return;
+	}
+
+	// ջ²ұΣβƥʱδջ֡
+	for (int depth = context->_depth - 1; depth >= 0; --depth)
+	{
+		CallStackFrame& frame = context->_stack[depth];
+		if (frame._node->_section == section)
+		{
+			LocalAdd(frame._node->_callCount, 1);
+			if (frame._beginTime && now)
+			{
+				LocalAdd(frame._node->_sampledCount, 1);
+				LocalAdd(frame._node->_inclusiveTime, now - frame._beginTime);
+			}
+			context->_depth = depth;
+			return;
+		}
+	}
+}
+
+//
+// ʱϲ̵߳õĽڵ
+//
+struct CallTreeReportNode
+{
+	PerformanceSection* _section;
+	LongType _callCount;
+	LongType _sampledCount;
+	LongType _inclusiveTime;
+	bool _recursive;				// Ƿڵ·(ݹ)
+	LongType _nestedOverhead;		// иεBegin/EndڵĿ
+	map<PerformanceSection*, CallTreeReportNode> _children;
+
+	CallTreeReportNode()
+		:_section(NULL)
+		, _callCount(0)
+		, _sampledCount(0)
+		, _inclusiveTime(0)
+		, _recursive(false)
+		, _nestedOverhead(0)
+	{}
+
+	//
+	// ۳
+	// ÿ۳նκʱÿεðʱݹ롢
+	// δʱ۳Begin/Endʱ
+	// رεĿ
+	//
+	LongType SubtractOverhead(const PerformanceOverhead& overhead,
+		vector<PerformanceSection*>& path)
+	{
+		_recursive = find(path.begin(), path.end(), _section) != path.end();
+
+		path.push_back(_section);
+		_nestedOverhead = 0;
+		auto it = _children.begin();
+		for (; it != _children.end(); ++it)
+		{
+			_nestedOverhead += it->second.SubtractOverhead(overhead, path);
+		}
+		path.pop_back();
+
+		// ݹĵֻѹջջڵĿԺ
+		LongType selfOverhead = _recursive ? 0 : overhead._inner * _callCount;
+		LongType total = selfOverhead + _nestedOverhead;
+		_inclusiveTime = _inclusiveTime > total ? _inclusiveTime - total : 0;
+
+		LongType untimedCount = _callCount - _sampledCount;
+		return _nestedOverhead + overhead._untimed * untimedCount
+			+ (_recursive ? overhead._recursive : overhead._outer) * _sampledCount;
+	}
+
+	// ʱ = ʱ - Ӷΰʱ֮
+	LongType SelfTime() const
+	{
+		LongType childTime = 0;
+		auto it = _children.begin();
+		for (; it != _children.end(); ++it)
+		{
+			childTime += it->second._inclusiveTime;
+		}
+
+		return _inclusiveTime > childTime ? _inclusiveTime - childTime : 0;
+	}
+
+	void Merge(const CallTreeNode* node)
+	{
+		LongType callCount = node->_callCount.load(memory_order_relaxed);
+		LongType sampledCount = node->_sampledCount.load(memory_order_relaxed);
+		LongType inclusiveTime = node->_inclusiveTime.load(memory_order_relaxed);
+
+		// ʱʱôʱ֮ȹʱ
+		if (sampledCount && sampledCount != callCount)
+		{
+			inclusiveTime = (LongType)((double)inclusiveTime * callCount / sampledCount);
+		}
+
+		_callCount += callCount;
+		_sampledCount += sampledCount;
+		_inclusiveTime += inclusiveTime;
+
+		const CallTreeNode* child = node->_firstChild.load(memory_order_acquire);
+		for (; child; child = child->_nextSibling)
+		{
+			// У׼ʱµĽڵ
+			if (!child->_section->IsRegistered())
+				continue;
+
+			CallTreeReportNode& dst = _children[child->_section];
+			dst._section = child->_section;
+			dst.Merge(child);
+		}
+	}
+};
+
+static bool CompareByInclusiveTime(const CallTreeReportNode* lhs,
+	const CallTreeReportNode* rhs)
+{
+	return lhs->_inclusiveTime > rhs->_inclusiveTime;
+}
+
+static void MergeCallTrees(CallTreeReportNode& root)
+{
+	for (int i = 0; i < PP_MAX_THREADS; ++i)
+	{
+		CallTreeNode* node = s_callTreeRoots[i].load(memory_order_acquire);
+		if (node)
+		{
+			root.Merge(node);
+		}
+	}
+}
+
+//
+// ܸμʱǶ׵ôĿ
+// ֻͳڵ·ϵһγֵĽڵ㣬üʱһ¡
+//
+static void CollectNestedOverhead(const CallTreeReportNode& node,
+	map<PerformanceSection*, LongType>& nestedOverhead)
+{
+	auto it = node._children.begin();
+	for (; it != node._children.end(); ++it)
+	{
+		const CallTreeReportNode& child = it->second;
+		if (!child._recursive)
+		{
+			nestedOverhead[child._section] += child._nestedOverhead;
+		}
+
+		CollectNestedOverhead(child, nestedOverhead);
+	}
+}
+
+static void SerializeCallTree(SaveAdapter& SA, const CallTreeReportNode& node, int depth)
+{
+	vector<const CallTreeReportNode*> children;
+	auto it = node._children.begin();
+	for (; it != node._children.end(); ++it)
+	{
+		children.push_back(&it->second);
+	}
+	sort(children.begin(), children.end(), CompareByInclusiveTime);
+
+	for (size_t i = 0; i < children.size(); ++i)
+	{
+		const CallTreeReportNode* child = children[i];
+		SA.Save("%*s%s, Calls:%lld, Inclusive:%.6fs, Self:%.6fs\n",
+			depth * 4, "", child->_section->GetName(), child->_callCount,
+			(double)child->_inclusiveTime / PP_NS_PER_SEC,
+			(double)child->SelfTime() / PP_NS_PER_SEC);
+
+		SerializeCallTree(SA, *child, depth + 1);
+	}
+}
+
+// ۵ջе֡ܺ';'ͻ
+static string FoldedFrameName(const char* name)
+{
+	string frame(name);
+	for (size_t i = 0; i < frame.size(); ++i)
+	{
+		if (frame[i] == ';' || frame[i] == '\n')
+			frame[i] = ':';
+	}
+
+	return frame;
+}
+
+static void SerializeFoldedStacks(SaveAdapter& SA, const CallTreeReportNode& node,
+	const string& path)
+{
+	auto it = node._children.begin();
+	for (; it != node._children.end(); ++it)
+	{
+		const CallTreeReportNode& child = it->second;
+		string childPath = path;
+		if (!childPath.empty())
+			childPath += ';';
+		childPath += FoldedFrameName(child._section->GetName());
+
+		LongType selfTime = child.SelfTime() / 1000;
+		if (selfTime > 0)
+		{
+			SA.Save("%s %lld\n", childPath.c_str(), selfTime);
+		}
+
+		SerializeFoldedStacks(SA, child, childPath);
+	}
+}
+
+///////////////////////////////////////////////////////////////
+//PerformanceSection
+PerformanceSection::PerformanceSection()
+	:_totalCostTime(0)
+	, _totalCpuTime(0)
+	, _totalRef(0)
+	, _totalCallCount(0)
+	, _totalCounterCallCount(0)
+	, _totalOsStatCallCount(0)
+	, _totalSkippedCount(0)
+	, _totalAllocCount(0)
+	, _totalAllocBytes(0)
+	, _totalFreeCount(0)
+	, _totalFreeBytes(0)
+	, _totalPeakNetBytes(0)
+	, _overheadTime(0)
+	, _totalP99(0)
+	, _sampleInterval(0)
+	, _sampleMode(PPSM_EVERY_NTH)
+	, _rsStatistics(0)
+	, _node(NULL)
+	, _id(0)
+{
+	for (int i = 0; i < PP_MAX_THREADS; ++i)
+	{
+		_slots[i].store(NULL, memory_order_relaxed);
+	}
+
+	for (int i = 0; i < PPC_COUNT; ++i)
+	{
+		_totalCounters[i] = 0;
+	}
+
+	for (int i = 0; i < PPOS_COUNT; ++i)
+	{
+		_totalOsStats[i] = 0;
+	}
+}
+
+PerformanceSlot* PerformanceSection::_GetSlot(PerformanceThreadContext* context)
+{
+	PerformanceSlot* slot = _slots[context->_index].load(memory_order_acquire);
+	if (slot == NULL)
+	{
+		// ÿ߳ÿֻһΣж
+		void* buf = NULL;
+		if (posix_memalign(&buf, PP_CACHE_LINE_SIZE, sizeof(PerformanceSlot)))
+		{
+			return NULL;
+		}
+
+		slot = new(buf) PerformanceSlot(context->_threadId, context->_tid, context->_generation);
+		_slots[context->_index].store(slot, memory_order_release);
+	}
+	else if (slot->_generation != context->_generation)
+	{
+		// ߳ڼʱ˳ʱûֹͣԴͳƣɽŵ߳ͷ
+		if (_rsStatistics && slot->_sampled && slot->_refCount.load(memory_order_relaxed) > 0)
+		{
+			_rsStatistics->StopStatistics(context->_index);
+		}
+
+		// ̵߳߳id˳ľ߳ͬıж
+		slot->Reown(context->_threadId, context->_tid, context->_generation);
+	}
+
+	return slot;
+}
+
+//
+// ͷżǵͷʱڵΣ׷ݷʱΣ
+// Լ˵Ǿֽ(ǵεķͷ)ǱηĴֽ
+// ͷηڴʱΪ
+//
+void PerformanceSection::RecordHeapAlloc(PerformanceThreadContext* context, LongType bytes)
+{
+	PerformanceSlot* slot = _slots[context->_index].load(memory_order_relaxed);
+	if (slot == NULL)
+		return;
+
+	LocalAdd(slot->_allocCount, 1);
+	LocalAdd(slot->_allocBytes, bytes);
+
+	LongType liveBytes = slot->_allocBytes.load(memory_order_relaxed)
+		- slot->_freeBytes.load(memory_order_relaxed);
+	if (liveBytes > slot->_peakNetBytes.load(memory_order_relaxed))
+	{
+		slot->_peakNetBytes.store(liveBytes, memory_order_relaxed);
+	}
+}
+
+void PerformanceSection::RecordHeapFree(PerformanceThreadContext* context, LongType bytes)
+{
+	PerformanceSlot* slot = _slots[context->_index].load(memory_order_relaxed);
+	if (slot == NULL)
+		return;
+
+	LocalAdd(slot->_freeCount, 1);
+	LocalAdd(slot->_freeBytes, bytes);
+}
+
+void PerformanceSection::SetSymbol(const string& symbol, const string& module)
+{
+	_symbol = symbol;
+	_module = module;
+}
+
+const char* PerformanceSection::GetName() const
+{
+	if (_node == NULL)
+		return "";
+
+	if (!_symbol.empty())
+		return _symbol.c_str();
+
+	return _node->_desc.empty() ? _node->_function.c_str() : _node->_desc.c_str();
+}
+
+void PerformanceSection::Merge()
+{
+	_totalCostTime = 0;
+	_totalCpuTime = 0;
+	_totalRef = 0;
+	_totalCallCount = 0;
+	_totalCounterCallCount = 0;
+	_totalOsStatCallCount = 0;
+	_totalSkippedCount = 0;
+	_totalAllocCount = 0;
+	_totalAllocBytes = 0;
+	_totalFreeCount = 0;
+	_totalFreeBytes = 0;
+	_totalPeakNetBytes = 0;
+	_totalHistogram.Reset();
+	for (int i = 0; i < PPC_COUNT; ++i)
+	{
+		_totalCounters[i] = 0;
+	}
+	for (int i = 0; i < PPOS_COUNT; ++i)
+	{
+		_totalOsStats[i] = 0;
+	}
+
+	for (int i = 0; i < PP_MAX_THREADS; ++i)
+	{
+		PerformanceSlot* slot = _slots[i].load(memory_order_acquire);
+		if (slot == NULL)
+			continue;
+
+		_totalCostTime += slot->_costTime.load(memory_order_relaxed);
+		_totalCpuTime += slot->_cpuTime.load(memory_order_relaxed);
+		_totalRef += slot->_refCount.load(memory_order_relaxed);
+		_totalCallCount += slot->_callCount.load(memory_order_relaxed);
+		_totalSkippedCount += slot->_skippedCount.load(memory_order_relaxed);
+		_totalHistogram.Merge(slot->_histogram);
+
+		_totalCounterCallCount += slot->_counterCallCount.load(memory_order_relaxed);
+		for (int j = 0; j < PPC_COUNT; ++j)
+		{
+			_totalCounters[j] += slot->_counters[j].load(memory_order_relaxed);
+		}
+
+		_totalOsStatCallCount += slot->_osStatCallCount.load(memory_order_relaxed);
+		for (int j = 0; j < PPOS_COUNT; ++j)
+		{
+			_totalOsStats[j] += slot->_osStats[j].load(memory_order_relaxed);
+		}
+
+		_totalAllocCount += slot->_allocCount.load(memory_order_relaxed);
+		_totalAllocBytes += slot->_allocBytes.load(memory_order_relaxed);
+		_totalFreeCount += slot->_freeCount.load(memory_order_relaxed);
+		_totalFreeBytes += slot->_freeBytes.load(memory_order_relaxed);
+		_totalPeakNetBytes = max(_totalPeakNetBytes,
+			slot->_peakNetBytes.load(memory_order_relaxed));
+	}
+}
+
+LongType PerformanceSection::_ActivityCount() const
+{
+	LongType count = 0;
+	for (int i = 0; i < PP_MAX_THREADS; ++i)
+	{
+		PerformanceSlot* slot = _slots[i].load(memory_order_acquire);
+		if (slot == NULL)
+			continue;
+
+		count += slot->_callCount.load(memory_order_relaxed);
+		count += slot->_histogram._count.load(memory_order_relaxed);
+	}
+
+	return count;
+}
+
+void PerformanceSection::_ResetInChild(int current, int tid)
+{
+	for (int i = 0; i < PP_MAX_THREADS; ++i)
+	{
+		PerformanceSlot* slot = _slots[i].load(memory_order_relaxed);
+		if (slot == NULL)
+			continue;
+
+		if (i == current)
+		{
+			slot->ClearTotals();
+			slot->_tid.store(tid, memory_order_relaxed);
+		}
+		else
+			new(slot) PerformanceSlot(slot->_threadId.load(memory_order_relaxed),
+				slot->_tid.load(memory_order_relaxed), slot->_generation);
+	}
+}
+
+PerformanceSection* PerformanceSection::SetSampling(int interval, int mode)
+{
+	_sampleInterval.store(interval > 0 ? interval : 0, memory_order_relaxed);
+	_sampleMode.store(mode, memory_order_relaxed);
+	return this;
+}
+
+double PerformanceSection::_SampleScale() const
+{
+	if (_totalSkippedCount == 0 || _totalHistogram._count == 0)
+		return 1.0;
+
+	return (double)(_totalHistogram._count + _totalSkippedCount) / _totalHistogram._count;
+}
+
+LongType PerformanceSection::EstimatedCostTime() const
+{
+	return (LongType)(_totalCostTime * _SampleScale());
+}
+
+LongType PerformanceSection::EstimatedCpuTime() const
+{
+	return (LongType)(_totalCpuTime * _SampleScale());
+}
+
+LongType PerformanceSection::CorrectedCostTime() const
+{
+	LongType costTime = EstimatedCostTime();
+	return costTime > _overheadTime ? costTime - _overheadTime : 0;
+}
+
+void PerformanceSection::_SerializeOverhead(SaveAdapter& SA)
+{
+	LongType costTime = EstimatedCostTime();
+	if (_overheadTime <= 0 || costTime <= 0)
+		return;
+
+	SA.Save("Overhead Corrected Cost Time:%.6fs, Subtracted:%.6fs(%.1f%%)\n",
+		(double)CorrectedCostTime() / PP_NS_PER_SEC,
+		(double)_overheadTime / PP_NS_PER_SEC,
+		_overheadTime * 100.0 / costTime);
+
+	// ռһʱõʱҪĺʱ
+	if (_overheadTime * 2 >= costTime)
+	{
+		SA.Save("Warning: Cost Time Is Close To The Profiler Overhead Floor!\n");
+	}
+}
+
+void PerformanceSection::_SerializeSampling(SaveAdapter& SA)
+{
+	if (_totalSkippedCount == 0 || _totalHistogram._count == 0)
+		return;
+
+	//
+	// ʱĵÿȫгȡ
+	// ʱĹֵ = ܵô  ֵ
+	// ׼Ϊ95%(1.96׼)
+	//
+	double sampled = (double)_totalHistogram._count;
+	double total = sampled + _totalSkippedCount;
+	double meanError = _totalHistogram.StdDev() / sqrt(sampled) * sqrt(1.0 - sampled / total);
+	double mean = _totalHistogram.Mean();
+
+	SA.Save("Sampled Timing Timed Calls:%lld/%lld, Estimated Cost Time:%.6fs(%.6fs), Estimated Cpu Time:%.6fs, Avg(us) 95%% CI:[%.3f, %.3f]\n",
+		_totalHistogram._count, (LongType)total,
+		(double)EstimatedCostTime() / PP_NS_PER_SEC,
+		1.96 * meanError * total / PP_NS_PER_SEC,
+		(double)EstimatedCpuTime() / PP_NS_PER_SEC,
+		(mean - 1.96 * meanError) / 1000.0,
+		(mean + 1.96 * meanError) / 1000.0);
+}
+
+void PerformanceSection::_SerializeCounters(SaveAdapter& SA)
+{
+	if (_totalCounterCallCount == 0)
+		return;
+
+	const LongType* counters = _totalCounters;
+
+	//
+	// ӲʱȫΪ0ֻ
+	// IPC = ָ / CPUڣδаÿǧָĴ(MPKI)
+	// ֧Ԥʧܰռָ֧ı
+	//
+	if (counters[PPC_CYCLES] || counters[PPC_INSTRUCTIONS])
+	{
+		SA.Save("Hardware Counters Cycles:%lld, Instructions:%lld, IPC:%.2f, Cache Misses:%lld(MPKI:%.2f), Branch Misses:%lld(%.2f%%)\n",
+			counters[PPC_CYCLES], counters[PPC_INSTRUCTIONS],
+			counters[PPC_CYCLES] ? (double)counters[PPC_INSTRUCTIONS] / counters[PPC_CYCLES] : 0.0,
+			counters[PPC_CACHE_MISSES],
+			counters[PPC_INSTRUCTIONS] ? counters[PPC_CACHE_MISSES] * 1000.0 / counters[PPC_INSTRUCTIONS] : 0.0,
+			counters[PPC_BRANCH_MISSES],
+			counters[PPC_BRANCHES] ? counters[PPC_BRANCH_MISSES] * 100.0 / counters[PPC_BRANCHES] : 0.0);
+	}
+
+	SA.Save("Software Counters Context Switches:%lld, Page Faults:%lld, Counted Calls:%lld\n",
+		counters[PPC_CONTEXT_SWITCHES], counters[PPC_PAGE_FAULTS], _totalCounterCallCount);
+}
+
+void PerformanceSection::_SerializeOsStats(SaveAdapter& SA, const char* prefix,
+	const LongType stats[PPOS_COUNT], LongType callCount)
+{
+	SA.Save("%s Os Stats Voluntary Switches:%lld, Involuntary Switches:%lld, Minor Faults:%lld, Major Faults:%lld, "
+		"Read:%lldB(Disk:%lldB), Write:%lldB(Disk:%lldB), Run Delay:%.6fs, Counted Calls:%lld\n",
+		prefix, stats[PPOS_VOLUNTARY_SWITCHES], stats[PPOS_INVOLUNTARY_SWITCHES],
+		stats[PPOS_MINOR_FAULTS], stats[PPOS_MAJOR_FAULTS],
+		stats[PPOS_READ_CHARS], stats[PPOS_READ_BYTES],
+		stats[PPOS_WRITE_CHARS], stats[PPOS_WRITE_BYTES],
+		(double)stats[PPOS_RUN_DELAY] / PP_NS_PER_SEC, callCount);
+}
+
+void PerformanceSection::_SerializeHeap(SaveAdapter& SA)
+{
+	if (_totalAllocCount == 0 && _totalFreeCount == 0)
+		return;
+
+	SA.Save("Heap Alloc Count:%lld, Alloc Bytes:%lld, Free Count:%lld, Free Bytes:%lld, Peak Net Bytes:%lld, Bytes Per Call:%.1f\n",
+		_totalAllocCount, _totalAllocBytes, _totalFreeCount, _totalFreeBytes, _totalPeakNetBytes,
+		_totalCallCount ? (double)_totalAllocBytes / _totalCallCount : 0.0);
+}
+
+void PerformanceSection::Serialize(SaveAdapter& SA)
+{
+	// ܵü0ʾβƥ
+	if (_totalRef)
+		SA.Save("Performance Profiler Not Match!\n");
+
+	// лЧͳϢ
+	for (int i = 0; i < PP_MAX_THREADS; ++i)
+	{
+		PerformanceSlot* slot = _slots[i].load(memory_order_acquire);
+		if (slot == NULL)
+			continue;
+
+		SA.Save("Thread Id:%d, Cost Time:%.6fs, Cpu Time:%.6fs, Call Count:%lld\n",
+			slot->_threadId.load(memory_order_relaxed),
+			(double)slot->_costTime.load(memory_order_relaxed) / PP_NS_PER_SEC,
+			(double)slot->_cpuTime.load(memory_order_relaxed) / PP_NS_PER_SEC,
+			slot->_callCount.load(memory_order_relaxed));
+
+		LongType osStatCallCount = slot->_osStatCallCount.load(memory_order_relaxed);
+		if (osStatCallCount)
+		{
+			LongType osStats[PPOS_COUNT];
+			for (int j = 0; j < PPOS_COUNT; ++j)
+			{
+				osStats[j] = slot->_osStats[j].load(memory_order_relaxed);
+			}
+
+			_SerializeOsStats(SA, "  Thread", osStats, osStatCallCount);
+		}
+	}
+
+	//
+	// Cost Timeǽʱ䣬Cpu Time߳ĵCPUʱ䣬
+	// Cpu Usageӽ100%˵ڼ㣬Զ100%˵ȴ
+	//
+	SA.Save("Total Cost Time:%.6fs, Total Cpu Time:%.6fs, Cpu Usage:%.1f%%, Total Call Count:%lld\n",
+		(double)_totalCostTime / PP_NS_PER_SEC, (double)_totalCpuTime / PP_NS_PER_SEC,
+		_totalCostTime ? _totalCpuTime * 100.0 / _totalCostTime : 0.0,
+		_totalCallCount);
+
+	// лӳٷֲλΪ΢
+	if (_totalHistogram._count)
+	{
+		SA.Save("Latency(us) Min:%.3f, P50:%.3f, P90:%.3f, P99:%.3f, P99.9:%.3f, Max:%.3f, Avg:%.3f, StdDev:%.3f\n",
+			_totalHistogram._min / 1000.0,
+			_totalHistogram.Percentile(50) / 1000.0,
+			_totalHistogram.Percentile(90) / 1000.0,
+			_totalHistogram.Percentile(99) / 1000.0,
+			_totalHistogram.Percentile(99.9) / 1000.0,
+			_totalHistogram._max / 1000.0,
+			_totalHistogram.Mean() / 1000.0,
+			_totalHistogram.StdDev() / 1000.0);
+	}
+
+	// лʱĹֵ
+	_SerializeSampling(SA);
+
+	// л۳ʱ
+	_SerializeOverhead(SA);
+
+	// лܼ
+	_SerializeCounters(SA);
+
+	// лϵͳԴ
+	if (_totalOsStatCallCount)
+	{
+		_SerializeOsStats(SA, "Total", _totalOsStats, _totalOsStatCallCount);
+	}
+
+	// лѷͳ
+	_SerializeHeap(SA);
+
+	// лԴͳϢ
+	if (_rsStatistics)
+	{
+		_rsStatistics->GetCpuInfo().Serialize(SA, "Cpu", "%");
+		_rsStatistics->GetThreadCpuInfo().Serialize(SA, "Thread Cpu", "%");
+
+		// ߳ڱڵCPUʹʣӽ100%߳Ѿ
+		ResourceStatistics::ThreadInfoMap threadInfos = _rsStatistics->GetThreadInfos();
+		ResourceStatistics::ThreadInfoMap::iterator it = threadInfos.begin();
+		for (; it != threadInfos.end(); ++it)
+		{
+			const ResourceInfo& info = it->second._cpuInfo;
+			if (info._count == 0)
+				continue;
+
+			SA.Save("  Thread Tid:%d, Cpu Peak:%lld%%, Avg:%lld%%, EWMA:%.1f%%, Samples:%lld\n",
+				it->first, info._peak, info._avg, info._ewma, info._count);
+		}
+
+		_rsStatistics->GetMemoryInfo().Serialize(SA, "Memory", "K");
+	}
+}
+
+//////////////////////////////////////////////////////////////
+// Performance
+PerformanceSection* Performance::CreateSection(const char* fileName,
+	const char* function, int line, const char* extraDesc, bool isStatistics)
+{
+	PerformanceSection* section = NULL;
+	PerformanceNode node(fileName, function, line, extraDesc);
+
+	unique_lock<mutex> Lock(_mutex);
+	auto it = _ppMap.find(node);
+	if (it != _ppMap.end())
+	{
+		section = it->second;
+	}
+	else
+	{
+		section = new PerformanceSection;
+		if (isStatistics)
+		{
+			section->_rsStatistics = new ResourceStatistics();
+		}
+		section->_id = _ppMap.size();
+		it = _ppMap.insert(make_pair(node, section)).first;
+		section->_node = &it->first;
+	}
+
+	return section;
+}
+
+void Performance::SetSymbols(const vector<SectionSymbol>& symbols)
+{
+	unique_lock<mutex> Lock(_mutex);
+	for (size_t i = 0; i < symbols.size(); ++i)
+	{
+		symbols[i]._section->SetSymbol(symbols[i]._symbol, symbols[i]._module);
+	}
+}
+
+bool PerformanceSection::_ReadCounters(PerformanceThreadContext* context, LongType values[PPC_COUNT])
+{
+	if (!OptionManager::IsEnabled(PPCO_PERF_COUNTER))
+		return false;
+
+	// ÿֻ߳ԴһΣʧܺ
+	if (context->_perfCounters == NULL)
+	{
+		context->_perfCounters = new PerfCounterGroup;
+		context->_perfCounters->Open();
+	}
+
+	return context->_perfCounters->Read(values);
+}
+
+bool PerformanceSection::_ReadOsStats(PerformanceThreadContext* context, LongType values[PPOS_COUNT])
+{
+	if (!OptionManager::IsEnabled(PPCO_OS_STAT))
+		return false;
+
+	// ÿֻ߳һΣ򲻿/procļӦֵһֱΪ0
+	if (context->_osStat == NULL)
+	{
+		context->_osStat = new OsStatReader;
+		context->_osStat->Open();
+	}
+
+	return context->_osStat->Read(values);
+}
+
+//
+// ʱһμʱĵôӾֵΪ@intervalļηֲ
+// ÿμʱֻһ
+//
+static int RandomSampleSkip(PerformanceThreadContext* context, int interval)
+{
+	// xorshift64*
+	uint64_t x = context->_random;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	context->_random = x;
+
+	double u = ((x * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+	double skip = floor(log(1.0 - u) / log(1.0 - 1.0 / interval)) + 1;
+	return skip < INT_MAX ? (int)skip : INT_MAX;
+}
+
+bool PerformanceSection::_ShouldSample(PerformanceThreadContext* context, PerformanceSlot* slot)
+{
+	int interval = _sampleInterval.load(memory_order_relaxed);
+	int mode = _sampleMode.load(memory_order_relaxed);
+	if (interval == 0)
+	{
+		interval = OptionManager::GetInstance()->GetSampleInterval();
+		mode = OptionManager::GetInstance()->GetSampleMode();
+	}
+
+	if (interval <= 1)
+		return true;
+
+	if (--slot->_sampleCountdown > 0)
+	{
+		LocalAdd(slot->_skippedCount, 1);
+		return false;
+	}
+
+	slot->_sampleCountdown = mode == PPSM_RANDOM ? RandomSampleSkip(context, interval) : interval;
+	return true;
+}
+
+void PerformanceSection::Begin(int)
+{
+	PerformanceThreadContext* context = GetThreadContext();
+	if (context == NULL)
+		return;
+
+	PerformanceSlot* slot = _GetSlot(context);
+	if (slot == NULL)
+		return;
+
+	// µôͳ
+	LocalAdd(slot->_callCount, 1);
+
+	// þǷʱݹĵø
+	LongType refCount = slot->_refCount.load(memory_order_relaxed);
+	if (refCount == 0)
+	{
+		slot->_sampled = _ShouldSample(context, slot);
+	}
+
+	// δʱĵֻάü͵ջȡʱ
+	if (!slot->_sampled)
+	{
+		slot->_refCount.store(refCount + 1, memory_order_relaxed);
+		PushCallFrame(context, this, 0);
+		return;
+	}
+
+	// ϵͳԴĶȡϴڼʱȡ
+	if (refCount == 0)
+	{
+		LongType osStats[PPOS_COUNT];
+		slot->_osStatBegun = _ReadOsStats(context, osStats);
+		if (slot->_osStatBegun)
+		{
+			for (int i = 0; i < PPOS_COUNT; ++i)
+			{
+				slot->_beginOsStats[i].store(osStats[i], memory_order_relaxed);
+			}
+		}
+	}
+
+	LongType now = PerformanceTimer::WallTimeNs();
+
+	// ü == 0 ʱ¶οʼʱͳƣݹ⡣
+	if (refCount == 0)
+	{
+		// ǽʱסCPUʱ䣬̶εCPUʱ䲻ᳬǽʱ
+		slot->_beginTime.store(now, memory_order_relaxed);
+		slot->_beginCpuTime.store(PerformanceTimer::ThreadCpuTimeNs(), memory_order_relaxed);
+
+		// CPUʱ
+		LongType counters[PPC_COUNT];
+		slot->_counterBegun = _ReadCounters(context, counters);
+		if (slot->_counterBegun)
+		{
+			for (int i = 0; i < PPC_COUNT; ++i)
+			{
+				slot->_beginCounters[i].store(counters[i], memory_order_relaxed);
+			}
+		}
+
+		// ʼԴͳ
+		if (_rsStatistics)
+		{
+			_rsStatistics->StartStatistics(context->_index, context->_tid);
+		}
+	}
+
+	// οʼüͳ
+	slot->_refCount.store(refCount + 1, memory_order_relaxed);
+
+	// ѹջݹʱҲ¼һñ
+	PushCallFrame(context, this, now);
+
+	// ¼׷¼
+	if (OptionManager::IsEnabled(PPCO_TRACE) && _id >= 0)
+	{
+		if (context->_traceRing == NULL)
+			context->_traceRing = GetTraceRing(context);
+
+		context->_traceRing->Append(now, _id, false, context->_tid);
+	}
+}
+
+void PerformanceSection::End(int)
+{
+	PerformanceThreadContext* context = GetThreadContext();
+	if (context == NULL)
+		return;
+
+	PerformanceSlot* slot = _GetSlot(context);
+	if (slot == NULL)
+		return;
 
 	// ü
-	LongType refCount = --_refCountMap[threadId];
-	--_totalRef;
+	LongType refCount = slot->_refCount.load(memory_order_relaxed) - 1;
+	slot->_refCount.store(refCount, memory_order_relaxed);
+
+	if (!slot->_sampled)
+	{
+		PopCallFrame(context, this, 0);
+		return;
+	}
+
+	LongType counters[PPC_COUNT];
+	bool counterEnded = refCount == 0 && slot->_counterBegun && _ReadCounters(context, counters);
+
+	LongType endCpuTime = refCount <= 0 ? PerformanceTimer::ThreadCpuTimeNs() : 0;
+	LongType now = PerformanceTimer::WallTimeNs();
+
+	PopCallFrame(context, this, now);
+
+	LongType osStats[PPOS_COUNT];
+	bool osStatEnded = refCount == 0 && slot->_osStatBegun && _ReadOsStats(context, osStats);
+
+	// ʼ¼Ѽ¼ʱż¼¼ʱٶƥĲ֣δעУ׼β¼
+	if (context->_traceRing && OptionManager::IsEnabled(PPCO_TRACE) && _id >= 0)
+	{
+		context->_traceRing->Append(now, _id, true, context->_tid);
+	}
 
 	//
 	// ü <= 0 ʱλʱ䡣
@@ -404,50 +2519,343 @@ void PerformanceSection::End(int threadId)
 	//
 	if (refCount <= 0)
 	{
-		auto it = _beginTimeMap.find(threadId);
-		if (it != _beginTimeMap.end())
+		LongType beginTime = slot->_beginTime.load(memory_order_relaxed);
+		if (beginTime != 0)
 		{
-			LongType costTime = clock() - it->second;
+			LongType cpuTime = endCpuTime - slot->_beginCpuTime.load(memory_order_relaxed);
+			LongType costTime = now - beginTime;
 			if (refCount == 0)
-				_costTimeMap[threadId] += costTime;
+			{
+				LocalAdd(slot->_costTime, costTime);
+				LocalAdd(slot->_cpuTime, cpuTime);
+				slot->_histogram.Record(costTime);
+
+				if (counterEnded)
+				{
+					for (int i = 0; i < PPC_COUNT; ++i)
+					{
+						LocalAdd(slot->_counters[i],
+							counters[i] - slot->_beginCounters[i].load(memory_order_relaxed));
+					}
+					LocalAdd(slot->_counterCallCount, 1);
+				}
+
+				if (osStatEnded)
+				{
+					for (int i = 0; i < PPOS_COUNT; ++i)
+					{
+						LocalAdd(slot->_osStats[i],
+							osStats[i] - slot->_beginOsStats[i].load(memory_order_relaxed));
+					}
+					LocalAdd(slot->_osStatCallCount, 1);
+				}
+			}
 			else
-				_costTimeMap[threadId] = costTime;
-
-			_totalCostTime += costTime;
+			{
+				slot->_costTime.store(costTime, memory_order_relaxed);
+				slot->_cpuTime.store(cpuTime, memory_order_relaxed);
+			}
 		}
 
 		// ֹͣԴͳ
 		if (_rsStatistics)
 		{
-			_rsStatistics->StopStatistics();
+			_rsStatistics->StopStatistics(context->_index);
 		}
 	}
 }
 
+static void OutPutAtExit()
+{
+	Performance::OutPut();
+
+	// ȴPP_EXIT_FLUSH_TIMEOUT룬I/Oסʱס˳
+	ReportWriter::GetInstance()->Stop(PP_EXIT_FLUSH_TIMEOUT);
+}
+
+static void PrepareForkPerformance()
+{
+	Performance::GetInstance()->PrepareFork();
+}
+
+static void ParentAfterForkPerformance()
+{
+	Performance::GetInstance()->ParentAfterFork();
+}
+
+static void ChildAfterForkPerformance()
+{
+	Performance::GetInstance()->ChildAfterFork();
+}
+
 Performance::Performance()
 {
 	// ʱ
-	atexit(OutPut);
+	atexit(OutPutAtExit);
+
+	// ڸ̵̨߳עᣬӽͳ̨߳
+	pthread_atfork(PrepareForkPerformance, ParentAfterForkPerformance,
+		ChildAfterForkPerformance);
 
 	time(&_beginTime);
 
+	// У׼߾ȼʱ
+	PerformanceTimer::Calibrate();
+
+	// 
+	_calibrateSection._id = -1;
+	_calibrateSection.SetSampling(1, PPSM_EVERY_NTH);
+	CalibrateOverhead();
+
+	// ڴͳƷ̣߳PPCO_PUBLISH_SHMŻᷢ
+	SharedStatsPublisher::GetInstance();
+
+	// д̣߳PPCO_SAVE_PERIODICALLYŻڱ
+	ReportWriter::GetInstance();
+
+	// ͳ̣߳PPCO_INTERVAL_STATSŻ¼
+	IntervalRecorder::GetInstance();
+
+	// ջ̣߳PPCO_STACK_SAMPLERŻ
+	StackSampler::GetInstance();
+
 	IPCMonitorServer::GetInstance()->Start();
 }
 
+void Performance::PrepareFork()
+{
+	_mutex.lock();
+}
+
+void Performance::ParentAfterFork()
+{
+	_mutex.unlock();
+}
+
+void Performance::ChildAfterFork()
+{
+	_mutex.unlock();
+	RebuildInChild(_calibrateMutex);
+
+	// fork߳ӽµں߳
+	PerformanceThreadContext* context = PeekThreadContext();
+	int current = context ? context->_index : -1;
+	int tid = syscall(SYS_gettid);
+	if (context)
+		context->_tid = tid;
+
+	auto it = _ppMap.begin();
+	for (; it != _ppMap.end(); ++it)
+	{
+		it->second->_ResetInChild(current, tid);
+	}
+
+	for (int i = 0; i < PP_MAX_THREADS; ++i)
+	{
+		CallTreeNode* root = s_callTreeRoots[i].load(memory_order_acquire);
+		if (root)
+			ClearCallTree(root);
+	}
+
+	ThreadIndexAllocator::Instance().ResetInChild(current);
+	time(&_beginTime);
+}
+
 void Performance::OutPut()
 {
 	int flag = OptionManager::GetInstance()->GetOptions();
 	if (flag & PPCO_SAVE_TO_CONSOLE)
 	{
-		ConsoleSaveAdapter CSA;
-		Performance::GetInstance()->_OutPut(CSA);
+		// һдˢstdoutѻ֤˳
+		BufferSaveAdapter BSA;
+		Performance::GetInstance()->_OutPutByFormat(BSA, flag);
+
+		fflush(stdout);
+		BSA.Flush(STDOUT_FILENO);
 	}
 
 	if (flag & PPCO_SAVE_TO_FILE)
 	{
-		FileSaveAdapter FSA("/tmp/performance_profiler/PerformanceReport.txt");
-		Performance::GetInstance()->_OutPut(FSA);
+		// ˽ṹʽʱÿָʽһݣδʱı
+		if (!(flag & (PPCO_SAVE_AS_JSON | PPCO_SAVE_AS_CSV)))
+		{
+			string report;
+			BufferSaveAdapter BSA;
+			Performance::GetInstance()->_OutPut(BSA);
+			BSA.Release(report);
+			ReportWriter::GetInstance()->Submit(PP_REPORT_DIRECTORY "/PerformanceReport.txt", report);
+		}
+
+		if (flag & PPCO_SAVE_AS_JSON)
+		{
+			string report;
+			BufferSaveAdapter BSA;
+			Performance::GetInstance()->_OutPutJson(BSA);
+			BSA.Release(report);
+			ReportWriter::GetInstance()->Submit(PP_REPORT_DIRECTORY "/PerformanceReport.json", report);
+		}
+
+		if (flag & PPCO_SAVE_AS_CSV)
+		{
+			string report;
+			BufferSaveAdapter BSA;
+			Performance::GetInstance()->_OutPutCsv(BSA);
+			BSA.Release(report);
+			ReportWriter::GetInstance()->Submit(PP_REPORT_DIRECTORY "/PerformanceReport.csv", report);
+		}
+
+		string folded;
+		StringSaveAdapter foldedSSA(folded);
+		Performance::GetInstance()->_OutPutFoldedStacks(foldedSSA);
+		ReportWriter::GetInstance()->Submit(PP_REPORT_DIRECTORY "/PerformanceReport.folded", folded);
+
+		string sampleFolded;
+		StringSaveAdapter sampleSSA(sampleFolded);
+		Performance::GetInstance()->_OutPutStackSamples(sampleSSA, true);
+		if (!sampleFolded.empty())
+		{
+			ReportWriter::GetInstance()->Submit(PP_REPORT_DIRECTORY "/PerformanceSampler.folded", sampleFolded);
+		}
+
+		if (flag & PPCO_TRACE)
+		{
+			OutPutTrace();
+		}
+
+		if (flag & PPCO_INTERVAL_STATS)
+		{
+			string series;
+			StringSaveAdapter seriesSSA(series);
+			IntervalRecorder::GetInstance()->OutPutSeries(seriesSSA);
+			ReportWriter::GetInstance()->Submit(PP_REPORT_DIRECTORY "/PerformanceInterval.json", series);
+		}
+	}
+}
+
+#define PP_CALIBRATE_ROUNDS 10
+#define PP_CALIBRATE_ITERATIONS 500
+
+static volatile LongType s_calibrateSink;
+
+#if PP_HAS_TSC
+static LongType ReadTsc()
+{
+	return __rdtsc();
+}
+#endif
+
+// ȡһμʱĿ()ȡƽֵеСֵųȸ
+static LongType MeasureTimerRead(LongType (*read)())
+{
+	LongType best = LLONG_MAX;
+	for (int round = 0; round < PP_CALIBRATE_ROUNDS; ++round)
+	{
+		LongType sum = 0;
+		LongType begin = PerformanceTimer::MonotonicTimeNs();
+		for (int i = 0; i < PP_CALIBRATE_ITERATIONS; ++i)
+		{
+			sum += read();
+		}
+		LongType cost = (PerformanceTimer::MonotonicTimeNs() - begin) / PP_CALIBRATE_ITERATIONS;
+
+		s_calibrateSink = sum;
+		best = min(best, cost);
+	}
+
+	return best;
+}
+
+void Performance::CalibrateOverhead()
+{
+	unique_lock<mutex> calibrateLock(_calibrateMutex);
+
+	PerformanceOverhead overhead;
+	overhead._flag = OptionManager::GetInstance()->GetOptions();
+	overhead._wallTimeRead = MeasureTimerRead(PerformanceTimer::WallTimeNs);
+	overhead._monotonicRead = MeasureTimerRead(PerformanceTimer::MonotonicTimeNs);
+	overhead._threadCpuRead = MeasureTimerRead(PerformanceTimer::ThreadCpuTimeNs);
+#if PP_HAS_TSC
+	overhead._tscRead = MeasureTimerRead(ReadTsc);
+#endif
+
+	//
+	// ִпΣڲõƽʱÿμʱöʱ䣬
+	// ѭƽʱΪÿǶ׵öึʱ䡣
+	// ȡеСֵ
+	//
+	LongType bestInner = LLONG_MAX;
+	LongType bestOuter = LLONG_MAX;
+	LongType bestRecursive = LLONG_MAX;
+	LongType bestUntimed = LLONG_MAX;
+	int threadId = GetThreadId();
+	for (int round = 0; round < PP_CALIBRATE_ROUNDS; ++round)
+	{
+		// ѽĶڷͬһ
+		_calibrateSection.Begin(threadId);
+		LongType begin = PerformanceTimer::WallTimeNs();
+		for (int i = 0; i < PP_CALIBRATE_ITERATIONS; ++i)
+		{
+			_calibrateSection.Begin(threadId);
+			_calibrateSection.End(threadId);
+		}
+		bestRecursive = min(bestRecursive,
+			(PerformanceTimer::WallTimeNs() - begin) / PP_CALIBRATE_ITERATIONS);
+		_calibrateSection.End(threadId);
+
+		// ʱĵãһε֮󶼲ʱ
+		_calibrateSection.SetSampling(INT_MAX, PPSM_EVERY_NTH);
+		_calibrateSection.Begin(threadId);
+		_calibrateSection.End(threadId);
+		begin = PerformanceTimer::WallTimeNs();
+		for (int i = 0; i < PP_CALIBRATE_ITERATIONS; ++i)
+		{
+			_calibrateSection.Begin(threadId);
+			_calibrateSection.End(threadId);
+		}
+		bestUntimed = min(bestUntimed,
+			(PerformanceTimer::WallTimeNs() - begin) / PP_CALIBRATE_ITERATIONS);
+		_calibrateSection.SetSampling(1, PPSM_EVERY_NTH);
+	}
+
+	for (int round = 0; round < PP_CALIBRATE_ROUNDS; ++round)
+	{
+		_calibrateSection.Merge();
+		LongType costTime = _calibrateSection._totalCostTime;
+		LongType count = _calibrateSection._totalHistogram._count;
+
+		LongType begin = PerformanceTimer::WallTimeNs();
+		for (int i = 0; i < PP_CALIBRATE_ITERATIONS; ++i)
+		{
+			_calibrateSection.Begin(threadId);
+			_calibrateSection.End(threadId);
+		}
+		LongType outer = (PerformanceTimer::WallTimeNs() - begin) / PP_CALIBRATE_ITERATIONS;
+
+		_calibrateSection.Merge();
+		count = _calibrateSection._totalHistogram._count - count;
+		if (count <= 0)
+			break;
+
+		bestInner = min(bestInner, (_calibrateSection._totalCostTime - costTime) / count);
+		bestOuter = min(bestOuter, outer);
+	}
+
+	if (bestInner != LLONG_MAX)
+	{
+		overhead._inner = bestInner;
+		overhead._outer = bestOuter;
+		overhead._recursive = bestRecursive;
+		overhead._untimed = bestUntimed;
 	}
+
+	unique_lock<mutex> Lock(_mutex);
+	_overhead = overhead;
+}
+
+PerformanceOverhead Performance::GetOverhead()
+{
+	unique_lock<mutex> Lock(_mutex);
+	return _overhead;
 }
 
 bool Performance::CompareByCallCount(PerformanceMap::iterator lhs,
@@ -459,38 +2867,297 @@ bool Performance::CompareByCallCount(PerformanceMap::iterator lhs,
 bool Performance::CompareByCostTime(PerformanceMap::iterator lhs,
 	PerformanceMap::iterator rhs)
 {
-	return lhs->second->_totalCostTime > rhs->second->_totalCostTime;
+	return lhs->second->CorrectedCostTime() > rhs->second->CorrectedCostTime();
+}
+
+bool Performance::CompareByP99(PerformanceMap::iterator lhs,
+	PerformanceMap::iterator rhs)
+{
+	return lhs->second->_totalP99 > rhs->second->_totalP99;
 }
 
 void Performance::_OutPut(SaveAdapter& SA)
 {
 	SA.Save("=============Performance Profiler Report==============\n\n");
-	SA.Save("Profiler Begin Time: %s\n", ctime(&_beginTime));
+	SA.Save("Profiler Begin Time: %s", ctime(&_beginTime));
+	SA.Save("Wall Time Source: %s\n", PerformanceTimer::WallTimeSource());
 
+	FunctionInstrument::GetInstance()->ResolveSymbols();
+	StackSampler::GetInstance()->ResolveFrames();
 	unique_lock<mutex> Lock(_mutex);
 
+	SA.Save("Profiler Overhead(ns) Inner:%lld, Outer:%lld, Recursive:%lld, Untimed:%lld\n",
+		_overhead._inner, _overhead._outer, _overhead._recursive, _overhead._untimed);
+	SA.Save("Timer Read(ns) Wall:%lld, CLOCK_MONOTONIC:%lld, Thread Cpu:%lld, TSC:%lld\n\n",
+		_overhead._wallTimeRead, _overhead._monotonicRead,
+		_overhead._threadCpuRead, _overhead._tscRead);
+
+	CallTreeReportNode root;
 	vector<PerformanceMap::iterator> vInfos;
+	_PrepareSections(vInfos, root);
+
+	for (int index = 0; index < vInfos.size(); ++index)
+	{
+		PerformanceSection* section = vInfos[index]->second;
+		if (section->_symbol.empty())
+		{
+			SA.Save("NO%d. Description:%s\n", index + 1, vInfos[index]->first._desc.c_str());
+			vInfos[index]->first.Serialize(SA);
+		}
+		else
+		{
+			SA.Save("NO%d. Description:%s\n", index + 1, section->_symbol.c_str());
+			SA.Save("FileName:%s, Fuction:%s, Line:%d\n",
+				section->_module.c_str(), section->_symbol.c_str(), 0);
+		}
+		vInfos[index]->second->Serialize(SA);
+		SA.Save("\n");
+	}
+
+	_OutPutCallTree(SA, root);
+
+	LockRegistry::GetInstance()->Serialize(SA);
+
+	StackSampler::GetInstance()->OutPut(SA);
+
+	SA.Save("==========================end========================\n\n");
+}
+
+void Performance::_PrepareSections(vector<PerformanceMap::iterator>& vInfos, CallTreeReportNode& root)
+{
+	_MergeCallTree(root);
+
+	map<PerformanceSection*, LongType> nestedOverhead;
+	CollectNestedOverhead(root, nestedOverhead);
+
+	// ϲ̲߳λ۳ֵٰ
 	auto it = _ppMap.begin();
 	for (; it != _ppMap.end(); ++it)
 	{
+		PerformanceSection* section = it->second;
+		section->Merge();
+
+		LongType outerCalls = section->_totalHistogram._count + section->_totalSkippedCount;
+		section->_overheadTime = _overhead._inner * outerCalls + nestedOverhead[section];
+
+		// Ƚʱɨӳٷֲ
+		section->_totalP99 = section->_totalHistogram.Percentile(99);
+
 		vInfos.push_back(it);
 	}
 
 	// 
 	int flag = OptionManager::GetInstance()->GetOptions();
-	if (flag & PPCO_SAVE_BY_COST_TIME)
+	if (flag & PPCO_SAVE_BY_P99)
+		sort(vInfos.begin(), vInfos.end(), CompareByP99);
+	else if (flag & PPCO_SAVE_BY_COST_TIME)
 		sort(vInfos.begin(), vInfos.end(), CompareByCostTime);
 	else if (flag & PPCO_SAVE_BY_CALL_COUNT)
 		sort(vInfos.begin(), vInfos.end(), CompareByCallCount);
+}
 
+void Performance::_OutPutJson(SaveAdapter& SA)
+{
+	ReportHeader header;
+	header._pid = getpid();
+	header._beginTime = _beginTime;
+	header._wallTimeSource = PerformanceTimer::WallTimeSource();
+
+	FunctionInstrument::GetInstance()->ResolveSymbols();
+	unique_lock<mutex> Lock(_mutex);
+	header._overhead = _overhead;
+
+	CallTreeReportNode root;
+	vector<PerformanceMap::iterator> vInfos;
+	_PrepareSections(vInfos, root);
+
+	vector<PerformanceSection*> sections;
 	for (int index = 0; index < vInfos.size(); ++index)
 	{
-		SA.Save("NO%d. Description:%s\n", index + 1, vInfos[index]->first._desc.c_str());
-		vInfos[index]->first.Serialize(SA);
-		vInfos[index]->second->Serialize(SA);
-		SA.Save("\n");
+		sections.push_back(vInfos[index]->second);
 	}
 
-	SA.Save("==========================end========================\n\n");
+	JsonReportExporter exporter(SA);
+	exporter.Export(header, sections);
+}
+
+void Performance::_OutPutCsv(SaveAdapter& SA)
+{
+	FunctionInstrument::GetInstance()->ResolveSymbols();
+	unique_lock<mutex> Lock(_mutex);
+
+	CallTreeReportNode root;
+	vector<PerformanceMap::iterator> vInfos;
+	_PrepareSections(vInfos, root);
+
+	vector<PerformanceSection*> sections;
+	for (int index = 0; index < vInfos.size(); ++index)
+	{
+		sections.push_back(vInfos[index]->second);
+	}
+
+	CsvReportExporter exporter(SA);
+	exporter.Export(sections);
+}
+
+const char* Performance::_OutPutByFormat(SaveAdapter& SA, int flag)
+{
+	if (flag & PPCO_SAVE_AS_JSON)
+	{
+		_OutPutJson(SA);
+		return ".json";
+	}
+
+	if (flag & PPCO_SAVE_AS_CSV)
+	{
+		_OutPutCsv(SA);
+		return ".csv";
+	}
+
+	_OutPut(SA);
+	return ".txt";
+}
+
+static void CopyName(char* dst, const string& src)
+{
+	strncpy(dst, src.c_str(), PP_SHM_NAME_LEN - 1);
+	dst[PP_SHM_NAME_LEN - 1] = '\0';
+}
+
+void Performance::PublishSharedStats(SharedStatsRegion& region)
+{
+	FunctionInstrument::GetInstance()->ResolveSymbols();
+	unique_lock<mutex> Lock(_mutex);
+
+	int count = 0;
+	auto it = _ppMap.begin();
+	for (; it != _ppMap.end(); ++it)
+	{
+		PerformanceSection* section = it->second;
+		if (section->_id >= PP_SHM_MAX_SECTIONS)
+			continue;
+
+		section->Merge();
+
+		region.BeginWrite(section->_id);
+		SharedSectionStats* stats = region.Section(section->_id);
+		stats->_line = it->first._line;
+		CopyName(stats->_name, section->GetName());
+		CopyName(stats->_function, it->first._function);
+		CopyName(stats->_fileName, it->first._fileName);
+		stats->_callCount = section->_totalCallCount;
+		stats->_costTime = section->EstimatedCostTime();
+		stats->_cpuTime = section->EstimatedCpuTime();
+		stats->_cpuPeak = stats->_cpuAvg = -1;
+		stats->_memoryPeak = stats->_memoryAvg = -1;
+		if (section->_rsStatistics)
+		{
+			ResourceInfo cpuInfo = section->_rsStatistics->GetCpuInfo();
+			ResourceInfo memoryInfo = section->_rsStatistics->GetMemoryInfo();
+			stats->_cpuPeak = cpuInfo._peak;
+			stats->_cpuAvg = cpuInfo._avg;
+			stats->_memoryPeak = memoryInfo._peak;
+			stats->_memoryAvg = memoryInfo._avg;
+		}
+		memcpy(stats->_histogram, section->_totalHistogram._counts, sizeof(stats->_histogram));
+		region.EndWrite(section->_id);
+
+		if (section->_id + 1 > count)
+			count = section->_id + 1;
+	}
+
+	region.Header()->_sectionCount.store(count, memory_order_release);
+}
+
+void Performance::SnapshotSections(vector<SectionTotals>& totals)
+{
+	FunctionInstrument::GetInstance()->ResolveSymbols();
+	unique_lock<mutex> Lock(_mutex);
+
+	totals.resize(_ppMap.size());
+	auto it = _ppMap.begin();
+	for (; it != _ppMap.end(); ++it)
+	{
+		PerformanceSection* section = it->second;
+		SectionTotals& total = totals[section->_id];
+		LongType activity = section->_ActivityCount();
+		if (activity == total._activity)
+			continue;
+
+		section->Merge();
+		total._activity = activity;
+		if (total._name.empty())
+		{
+			total._name = section->GetName();
+			total._location = it->first._fileName + ":" + to_string((long long)it->first._line);
+		}
+		total._callCount = section->_totalCallCount;
+		total._costTime = section->EstimatedCostTime();
+		total._cpuTime = section->EstimatedCpuTime();
+		total._histogram = section->_totalHistogram;
+	}
+}
+
+void Performance::OutPutTrace()
+{
+	string trace;
+	StringSaveAdapter SSA(trace);
+	Performance::GetInstance()->_OutPutTrace(SSA);
+	ReportWriter::GetInstance()->Submit(PP_REPORT_DIRECTORY "/PerformanceTrace.json", trace);
+}
+
+void Performance::_OutPutTrace(SaveAdapter& SA)
+{
+	FunctionInstrument::GetInstance()->ResolveSymbols();
+	unique_lock<mutex> Lock(_mutex);
+
+	// id
+	vector<PerformanceSection*> sections(_ppMap.size(), NULL);
+	auto it = _ppMap.begin();
+	for (; it != _ppMap.end(); ++it)
+	{
+		sections[it->second->_id] = it->second;
+	}
+
+	ChromeTraceExporter exporter(SA);
+	exporter.Export(sections);
+}
+
+void Performance::_MergeCallTree(CallTreeReportNode& root)
+{
+	MergeCallTrees(root);
+
+	vector<PerformanceSection*> path;
+	root.SubtractOverhead(_overhead, path);
+}
+
+void Performance::_OutPutCallTree(SaveAdapter& SA, const CallTreeReportNode& root)
+{
+	SA.Save("=====================Call Tree======================\n\n");
+	SerializeCallTree(SA, root, 0);
+	SA.Save("\n");
+}
+
+void Performance::_OutPutStackSamples(SaveAdapter& SA, bool folded)
+{
+	FunctionInstrument::GetInstance()->ResolveSymbols();
+	StackSampler::GetInstance()->ResolveFrames();
+	unique_lock<mutex> Lock(_mutex);
+
+	if (folded)
+		StackSampler::GetInstance()->OutPutFolded(SA);
+	else
+		StackSampler::GetInstance()->OutPut(SA);
+}
+
+void Performance::_OutPutFoldedStacks(SaveAdapter& SA)
+{
+	FunctionInstrument::GetInstance()->ResolveSymbols();
+	unique_lock<mutex> Lock(_mutex);
+
+	CallTreeReportNode root;
+	_MergeCallTree(root);
+
+	SerializeFoldedStacks(SA, root, "");
 }
 
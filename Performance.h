@@ -6,6 +6,8 @@
 #include <assert.h>
 #include <string>
 #include <map>
+#include <vector>
+#include <deque>
 #include <algorithm>
 
 // C++11
@@ -17,6 +19,11 @@
 #include <pthread.h>
 
 #include "IPCManager.h"
+#include "Timer.h"
+#include "PerfCounter.h"
+#include "OsStat.h"
+#include "Histogram.h"
+#include "SharedStats.h"
 
 using namespace std;
 
@@ -55,46 +62,171 @@ public:
 	}
 };
 
-// ļ
-class FileSaveAdapter : public SaveAdapter
+// ַͨIPCظ
+class StringSaveAdapter : public SaveAdapter
 {
 public:
-	FileSaveAdapter(const char* path)
-		:_fOut(0)
-	{
-		_fOut = fopen(path, "w");
-	}
+	StringSaveAdapter(string& out)
+		:_out(out)
+	{}
 
-	~FileSaveAdapter()
+	virtual int Save(char* format, ...)
 	{
-		if (_fOut)
+		char buf[1024];
+		va_list argPtr;
+		int cnt;
+
+		va_start(argPtr, format);
+		cnt = vsnprintf(buf, sizeof(buf), format, argPtr);
+		va_end(argPtr);
+
+		if (cnt < 0)
+			return cnt;
+
+		if (cnt < (int)sizeof(buf))
 		{
-			fclose(_fOut);
+			_out.append(buf, cnt);
 		}
+		else
+		{
+			// ջϻʱ¸ʽһ
+			size_t oldSize = _out.size();
+			_out.resize(oldSize + cnt + 1);
+			va_start(argPtr, format);
+			vsnprintf(&_out[oldSize], cnt + 1, format, argPtr);
+			va_end(argPtr);
+			_out.resize(oldSize + cnt);
+		}
+
+		return cnt;
+	}
+private:
+	string& _out;
+};
+
+// 屣ĳʼ
+#ifndef PP_SAVE_BUFFER_SIZE
+#define PP_SAVE_BUFFER_SIZE (64 * 1024)
+#endif
+
+//
+// 屣
+// ֱӸʽڴ滺stdioҲջת
+// һwriteдȡߣ󱨸治ǧСI/Oá
+//
+class BufferSaveAdapter : public SaveAdapter
+{
+public:
+	BufferSaveAdapter(size_t capacity = PP_SAVE_BUFFER_SIZE)
+		:_size(0)
+	{
+		_buffer.resize(capacity ? capacity : PP_SAVE_BUFFER_SIZE);
 	}
 
 	virtual int Save(char* format, ...)
 	{
-		if (_fOut)
-		{
-			va_list argPtr;
-			int cnt;
+		va_list argPtr;
+		int cnt;
+
+		va_start(argPtr, format);
+		cnt = vsnprintf(&_buffer[0] + _size, _buffer.size() - _size, format, argPtr);
+		va_end(argPtr);
+
+		if (cnt < 0)
+			return cnt;
 
+		// ʣռ䲻ʱݺ¸ʽһ
+		if (_size + cnt >= _buffer.size())
+		{
+			_Reserve(_size + cnt + 1);
 			va_start(argPtr, format);
-			cnt = vfprintf(_fOut, format, argPtr);
+			vsnprintf(&_buffer[0] + _size, _buffer.size() - _size, format, argPtr);
 			va_end(argPtr);
+		}
 
-			return cnt;
+		_size += cnt;
+		return cnt;
+	}
+
+	void Append(const char* data, size_t len)
+	{
+		if (_size + len > _buffer.size())
+			_Reserve(_size + len);
+
+		memcpy(&_buffer[0] + _size, data, len);
+		_size += len;
+	}
+
+	const char* Data() const
+	{
+		return _buffer.data();
+	}
+
+	size_t Size() const
+	{
+		return _size;
+	}
+
+	// ȡдݣ
+	void Release(string& out)
+	{
+		_buffer.resize(_size);
+		out.swap(_buffer);
+		_buffer.clear();
+		_size = 0;
+	}
+
+	// дһд@fdֻڲдʱдʣಿ
+	bool Flush(int fd)
+	{
+		bool success = WriteAll(fd, _buffer.data(), _size);
+		_size = 0;
+		return success;
+	}
+
+private:
+	// ݵ@sizeֽ
+	void _Reserve(size_t size)
+	{
+		size_t capacity = _buffer.size() ? _buffer.size() : PP_SAVE_BUFFER_SIZE;
+		while (capacity < size)
+		{
+			capacity *= 2;
 		}
 
-		return 0;
+		_buffer.resize(capacity);
 	}
+
+private:
+	string _buffer;		// ȼ
+	size_t _size;		// дĳ
+};
+
+// ļд뻺ʱһдļ
+class FileSaveAdapter : public BufferSaveAdapter
+{
+public:
+	FileSaveAdapter(const char* path)
+		:_fd(-1)
+	{
+		_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	}
+
+	~FileSaveAdapter()
+	{
+		if (_fd >= 0)
+		{
+			Flush(_fd);
+			close(_fd);
+		}
+	}
+
 private:
 	FileSaveAdapter(const FileSaveAdapter&);
 	FileSaveAdapter& operator==(const FileSaveAdapter&);
 
 private:
-	FILE* _fOut;
+	int _fd;
 };
 
 // 
@@ -137,6 +269,18 @@ private:
 //template<class T>
 //T* Singleton<T>::_sInstance = new T();
 
+//
+// forkӽֻеforḳ̳߳߳еͷţ̨߳Ҳˡ
+// ̵̨߳ڹʱpthread_atforkעӽ̴(RestartInChild)
+// RebuildInChild͵ؽԭλùµ̶߳
+// ɵstd::threadֵӵ̶߳ʱֹ̡
+//
+template<class T>
+inline void RebuildInChild(T& object)
+{
+	new(&object) T();
+}
+
 //
 // Ǿ̬ڴĵ캯лIPCϢ̡߳
 // ɶ̬ʱmain֮ǰͻȼض̬⣬ʹķʽʱ
@@ -153,32 +297,51 @@ public:
 	{
 		//
 		// 1.˫ؼ鱣̰߳ȫЧʡ
+		// 2.ʵָΪԭӱʼɺֻһacquireټ
 		//
-		if (_sInstance == NULL)
+		T* instance = _sInstance.load(memory_order_acquire);
+		if (instance == NULL)
 		{
+			// ̹߳쵥ʱforkӽвͷţǰעӽؽ
+			if (!_forkRegistered.exchange(true))
+			{
+				pthread_atfork(NULL, NULL, _RebuildLockInChild);
+			}
+
 			unique_lock<mutex> lock(_mutex);
-			if (_sInstance == NULL)
+			instance = _sInstance.load(memory_order_relaxed);
+			if (instance == NULL)
 			{
-				_sInstance = new T();
+				instance = new T();
+				_sInstance.store(instance, memory_order_release);
 			}
 		}
 
-		return _sInstance;
+		return instance;
 	}
 protected:
 	Singleton()
 	{}
 
-	static T* _sInstance;	// ʵ
-	static mutex _mutex;	// 
+	static void _RebuildLockInChild()
+	{
+		RebuildInChild(_mutex);
+	}
+
+	static atomic<T*> _sInstance;	// ʵ
+	static mutex _mutex;			// 
+	static atomic<bool> _forkRegistered;	// Ƿעforkӽ̴
 };
 
 template<class T>
-T* Singleton<T>::_sInstance = NULL;
+atomic<T*> Singleton<T>::_sInstance(NULL);
 
 template<class T>
 mutex Singleton<T>::_mutex;
 
+template<class T>
+atomic<bool> Singleton<T>::_forkRegistered(false);
+
 enum PP_CONFIG_OPTION
 {
 	PPCO_NONE = 0,					// 
@@ -187,6 +350,30 @@ enum PP_CONFIG_OPTION
 	PPCO_SAVE_TO_FILE = 8,			// 浽ļ
 	PPCO_SAVE_BY_CALL_COUNT = 16,	// ô򱣴
 	PPCO_SAVE_BY_COST_TIME = 32,	// ûʱ併򱣴
+	PPCO_SAVE_BY_P99 = 64,			// P99ӳٽ򱣴
+	PPCO_TRACE = 128,				// ¼׷¼ɵChrome trace
+	PPCO_PUBLISH_SHM = 256,			// ʵʱͳƵڴ
+	PPCO_PERF_COUNTER = 512,		// ͳܼ(CPUڡָδе)
+	PPCO_SAVE_PERIODICALLY = 1024,	// ̨Աʱıļ
+	PPCO_INTERVAL_STATS = 2048,		// ¼1s/10s/60sͳ
+	PPCO_HEAP_PROFILER = 4096,		// ͳƶѷ䣬ӻԤlibperformance_heap
+	PPCO_OS_STAT = 8192,			// ͳлȱҳI/Oֽжеȴ
+	PPCO_LOCK_PROFILER = 16384,		// ͳProfiledMutexĵȴʱ䡢ʱ;
+	PPCO_FUNC_INSTRUMENT = 32768,	// -finstrument-functionsĺ
+	PPCO_STACK_SAMPLER = 65536,		// ߳CPUʱ䶨ʱջ
+	PPCO_SAVE_AS_JSON = 131072,		// 汣ΪJSONʽ
+	PPCO_SAVE_AS_CSV = 262144,		// 汣ΪCSVʽ
+};
+
+//
+// ʱʽ
+// ΪNʱÿεĵôǾȷͳƣ
+// ֻԼ1/Nĵöȡʱ¼ӳٷֲаʱ䡣
+//
+enum PP_SAMPLE_MODE
+{
+	PPSM_EVERY_NTH = 0,			// ÿNεüʱһ
+	PPSM_RANDOM = 1,			// ÿε1/Nĸʼʱѭͬ
 };
 
 //
@@ -197,24 +384,172 @@ class  OptionManager : public Singleton<OptionManager>
 public:
 	void SetOptions(int flag)
 	{
-		_flag = flag;
+		_sFlag.store(flag, memory_order_relaxed);
 	}
 	int GetOptions()
 	{
-		return _flag;
+		return _sFlag.load(memory_order_relaxed);
+	}
+
+	//
+	// ѡǷ
+	// ѡǾֻ̬һڴһ֧Ҫȡ
+	//
+	static bool IsEnabled(int option)
+	{
+		return (_sFlag.load(memory_order_relaxed) & option) != 0;
+	}
+
+	// Դ()
+	void SetSamplePeriod(int ms)
+	{
+		_samplePeriod = ms > 0 ? ms : 1;
+	}
+	int GetSamplePeriod()
+	{
+		return _samplePeriod;
+	}
+
+	// ʱ1ʾÿεöʱ
+	void SetSampleInterval(int interval)
+	{
+		_sampleInterval = interval > 0 ? interval : 1;
+	}
+	int GetSampleInterval()
+	{
+		return _sampleInterval.load(memory_order_relaxed);
+	}
+
+	// ʱʽPP_SAMPLE_MODE
+	void SetSampleMode(int mode)
+	{
+		_sampleMode = mode;
+	}
+	int GetSampleMode()
+	{
+		return _sampleMode.load(memory_order_relaxed);
+	}
+
+	// ڴͳƷ()
+	void SetPublishPeriod(int ms)
+	{
+		_publishPeriod = ms > 0 ? ms : 1;
+	}
+	int GetPublishPeriod()
+	{
+		return _publishPeriod;
+	}
+
+	// ڱı()
+	void SetReportPeriod(int ms)
+	{
+		_reportPeriod = ms > 0 ? ms : 1;
+	}
+	int GetReportPeriod()
+	{
+		return _reportPeriod;
+	}
+
+	//
+	// ڱļתƣౣ@maxFilesļܼ@maxBytesֽڣ
+	// Ŀ¼н̵ڱϼƣʱɾɵļµһǱ
+	//
+	void SetReportRotation(int maxFiles, LongType maxBytes)
+	{
+		_reportMaxFiles = maxFiles > 0 ? maxFiles : 1;
+		_reportMaxBytes = maxBytes > 0 ? maxBytes : 1;
+	}
+	int GetReportMaxFiles()
+	{
+		return _reportMaxFiles;
+	}
+	LongType GetReportMaxBytes()
+	{
+		return _reportMaxBytes;
+	}
+
+	//
+	// Դͳƴ()һڵԴֵֵͰٷλ
+	// ҲԴEWMAʱ䳣
+	//
+	void SetResourceWindow(int ms)
+	{
+		_resourceWindow = ms > 0 ? ms : 1;
+	}
+	int GetResourceWindow()
+	{
+		return _resourceWindow;
+	}
+
+	// ջƵ(Hz)ÿ߳ĵCPUʱ
+	void SetStackSampleFrequency(int hz)
+	{
+		_stackSampleFrequency = hz > 0 ? (hz < 1000 ? hz : 1000) : 1;
+	}
+	int GetStackSampleFrequency()
+	{
+		return _stackSampleFrequency;
 	}
 
 	OptionManager()
-		:_flag(PPCO_NONE)
+		:_samplePeriod(100)
+		, _resourceWindow(10 * 1000)
+		, _publishPeriod(1000)
+		, _reportPeriod(60 * 1000)
+		, _reportMaxFiles(10)
+		, _reportMaxBytes(64LL * 1024 * 1024)
+		, _sampleInterval(1)
+		, _sampleMode(PPSM_EVERY_NTH)
+		, _stackSampleFrequency(99)
 	{}
 private:
-	int _flag;
+	static atomic<int> _sFlag;
+	atomic<int> _samplePeriod;
+	atomic<int> _resourceWindow;
+	atomic<int> _publishPeriod;
+	atomic<int> _reportPeriod;
+	atomic<int> _reportMaxFiles;
+	atomic<LongType> _reportMaxBytes;
+	atomic<int> _sampleInterval;
+	atomic<int> _sampleMode;
+	atomic<int> _stackSampleFrequency;
 };
 
 ///////////////////////////////////////////////////////////////////////////
 // Դͳ
 
+//
+// ԴֵλĬ100msĲԼ100롣
+// ԴͳƴڳǵʱʱͳֻڻڵĲ
+//
+#ifndef PP_RESOURCE_RING_SIZE
+#define PP_RESOURCE_RING_SIZE 1024
+#endif
+
+// һԴ
+struct ResourceSample
+{
+	LongType _time;		// ʱCLOCK_MONOTONICʱ()
+	LongType _value;	// ֵ
+};
+
+// Դͳƴڵͳֵ
+struct ResourceWindowStats
+{
+	LongType _count;	// ڵĲ
+	LongType _min;		// Сֵ
+	LongType _max;		// ֵ
+	LongType _avg;		// ƽֵ
+	LongType _p50;		// λ
+	LongType _p95;		// 95ٷλ
+	LongType _p99;		// 99ٷλ
+};
+
+//
 // ԴͳϢ
+// _peak_avgڵķֵ;ֵĲڻλУ
+// һڵֵֵͰٷλʱļ岻ᱻھֵû
+//
 struct ResourceInfo
 {
 	LongType _peak;	 // ֵ
@@ -223,55 +558,292 @@ struct ResourceInfo
 	LongType _total;  // ֵ
 	LongType _count;  // 
 
+	double _ewma;			// ָȨƶƽʱ䳣ΪԴͳƴ
+	LongType _lastTime;		// һβʱ()
+	vector<ResourceSample> _samples;	// Ĳд󸲸ɵ
+	LongType _sampleIndex;	// һдλ
+
 	ResourceInfo()
 		: _peak(0)
 		,_avg(0)
 		, _total(0)
 		,_count(0)
+		, _ewma(0)
+		, _lastTime(0)
+		, _sampleIndex(0)
 	{}
 
-	void Update(LongType value);
-	void Serialize(SaveAdapter& SA) const;
+	// ¼һ@timeʱ̵Ĳֵ
+	void Update(LongType value, LongType time);
+
+	// һβ֮ǰ@windowNsڵͳֵ
+	ResourceWindowStats GetWindowStats(LongType windowNs) const;
+
+	// лͳƺʹͳƣ@unitΪֵλ
+	void Serialize(SaveAdapter& SA, const char* name, const char* unit) const;
+};
+
+//
+// ̲߳λޣͬʱ߳ʱ̲߳
+//
+#ifndef PP_MAX_THREADS
+#define PP_MAX_THREADS 256
+#endif
+
+// ߳ԴͳƶڵCPUϢ
+struct ThreadResourceInfo
+{
+	ResourceInfo _cpuInfo;		// ߳ڱʱCPUʹ(%)
 };
 
 // Դͳ
+// ֻ¼εCPU/ڴϢResourceSamplerͳһ¡
+// CPU̵߳ģⰴ/proc/self/task/<tid>/statֻͳƶ̵߳CPU
+// ڵ̰߳߳ż¼Уֻдԭӱ
 class ResourceStatistics
 {
 public:
+	typedef map<int, ThreadResourceInfo> ThreadInfoMap;
+
 	ResourceStatistics();
 	~ResourceStatistics();
 
-	// ʼͳ
-	void StartStatistics();
+	// ߳Ϊ@indexں߳idΪ@tid߳̽뱾Σʼͳ
+	void StartStatistics(int index, int tid);
+
+	// ߳Ϊ@index߳뿪Σֹͣͳ
+	void StopStatistics(int index);
+
+	// ǰڱڵ߳
+	void GetActiveThreads(vector<int>& tids);
+
+	//
+	// forkӽؽ̵߳Ľ״̬
+	// @currentǵfork̵߳ţӽеں߳idΪ@tid
+	//
+	void ResetInChild(int current, int tid);
 
-	// ֹͣͳ
-	void StopStatistics();
+	// Ƿ̴߳ڱ
+	bool IsActive()
+	{
+		return _refCount > 0;
+	}
+
+	//
+	// һ@timeʱ̵Ĳֵcpu < 0ʱʾûЧCPU
+	// @threadCpusǸ̵߳CPUʹʣֻۼƵǰڱڵ̣߳
+	// ˳̵߳Ϣɾ
+	//
+	void Update(LongType cpu, LongType memory, LongType time,
+		const map<int, LongType>& threadCpus);
 
 	// ȡCPU/ڴϢ 
-	const ResourceInfo& GetCpuInfo();
-	const ResourceInfo& GetMemoryInfo();
+	ResourceInfo GetCpuInfo();
+	ResourceInfo GetMemoryInfo();
+
+	// ߳CPUʹ֮
+	ResourceInfo GetThreadCpuInfo();
+
+	// ̵߳CPUϢں߳idֻδ˳߳
+	ThreadInfoMap GetThreadInfos();
 
 private:
-	void _Statistics();
-	void _UpdateStatistics();
+	// ɾ˳̣߳вгҲռò÷_infoMutex
+	void _PruneExitedThreads();
+
+	ResourceInfo _cpuInfo;				// CPUϢ(ٷֱ)
+	ResourceInfo _memoryInfo;			// ڴϢ(KB)
+	ResourceInfo _threadCpuInfo;		// ߳CPUʹ֮(ٷֱ)
+	ThreadInfoMap _threadInfos;			// δ˳ֻ̣߳ɲ߳޸
+	mutex _infoMutex;					// CPU/ڴϢ߳뱨̻߳
 
+	atomic<int> _activeTids[PP_MAX_THREADS];	// ̵߳߳ں߳idڶʱΪ0
+	atomic<int> _refCount;				// ü
+};
+
+//
+// Դȡ
+// Ԥȴ/proc/self/stat/proc/self/statmÿpreadȡfork̡
+// ָ߳ʱȡ/proc/self/task/<tid>/statֻͳƸ̵߳CPU
+//
+class ProcessStatReader
+{
 public:
+	ProcessStatReader();
+	explicit ProcessStatReader(int tid);
+	~ProcessStatReader();
+
+	// Ƿɹ
+	bool IsOpen() const
+	{
+		return _statFd >= 0;
+	}
 
-	int	_cpuCount;				// CPU
+	// ۼCPUʱ(ʱӵδ)
+	bool ReadCpuTicks(LongType& ticks);
 
-	LongType _lastSystemTime;	// ϵͳʱ
-	LongType _lastKernelTime;	// ںʱ
+	// ̳פڴ(KB)
+	bool ReadResidentSize(LongType& kb);
 
-	int _pid;					// ID
+	// ϴβȽϼCPUʹ(%)ûЧϴβʱ-1
+	LongType SampleCpuUsage();
 
+	// ϴβ´SampleCpuUsage½׼
+	void Reset()
+	{
+		_lastSampleTime = -1;
+	}
 
-	ResourceInfo _cpuInfo;				// CPUϢ
-	ResourceInfo _memoryInfo;			// ڴϢ
+	// forkӽ´򿪣̳еȡǸ
+	void Reopen();
 
-	atomic<int> _refCount;				// ü
-	mutex _lockMutex;					// ̻߳
-	condition_variable _condVariable;	// ǷͳƵ
-	std::thread _statisticsThread;			// ͳ߳
+private:
+	int _statFd;					// /proc/self/stat/proc/self/task/<tid>/stat
+	int _statmFd;					// /proc/self/statm̶߳ȡ
+	long _clockTicks;				// ÿʱӵδ
+	long _pageSizeKB;				// ҳС(KB)
+
+	LongType _lastCpuTicks;			// ϴβĽCPUʱ(δ)
+	LongType _lastSampleTime;		// ϴβʱ()-1ʾЧ
+};
+
+//
+// Դ
+// Դͳƶιһ̣߳ͨProcessStatReaderȡԴ
+// ûԴͳƶδڻ״̬ʱ߳ϡ
+//
+class ResourceSampler : public Singleton<ResourceSampler>
+{
+	friend class Singleton<ResourceSampler>;
+public:
+	// עԴͳƶ
+	void Register(ResourceStatistics* rs);
+
+	// Դͳƶν/˳״̬
+	void Activate();
+	void Deactivate();
+
+	// ֹ̣ͣ߳˳ʱ
+	void Stop();
+
+	// forkӽ߳
+	void RestartInChild();
+
+protected:
+	ResourceSampler();
+	~ResourceSampler();
+
+	void _Sample();
+
+	// ڸ̵߳CPUʹʣر뿪жε̵߳Ķȡ
+	void _SampleThreads(const vector<ResourceStatistics*>& rsList,
+		map<int, LongType>& threadCpus);
+
+private:
+	ProcessStatReader _statReader;	// Դȡ
+	map<int, ProcessStatReader*> _threadReaders;	// ̵߳Ķȡֻɲ̷߳
+
+	vector<ResourceStatistics*> _rsList;	// עԴͳƶ
+	atomic<int> _activeCount;		// Դͳƶθ
+	atomic<bool> _rebase;			// ǷҪ½CPU׼
+	bool _stop;						// Ƿֹͣ
+	mutex _mutex;					// _rsList_stop
+	condition_variable _condVariable;	// Ѳ߳
+	std::thread _samplerThread;		// ߳
+};
+
+//
+// ڴͳƷ
+// PPCO_PUBLISH_SHMÿڰѸεۼֵд빲ڴ棬
+// ֻӳ鿴Ŀ̲Ҫκ
+//
+class SharedStatsPublisher : public Singleton<SharedStatsPublisher>
+{
+	friend class Singleton<SharedStatsPublisher>;
+public:
+	// ֹ̲ͣ߳ɾڴ棬˳ʱ
+	void Stop();
+
+	//
+	// forkӽ̡߳
+	// ̳еӳǸ̵ͳֻӳ䣬֮ӽ̵pid´
+	//
+	void RestartInChild();
+
+protected:
+	SharedStatsPublisher();
+	~SharedStatsPublisher();
+
+	void _Publish();
+
+private:
+	SharedStatsRegion _region;		// ڴͳ
+	bool _created;					// ͳǷѴ
+	ProcessStatReader _statReader;	// Դȡ
+
+	bool _stop;						// Ƿֹͣ
+	mutex _mutex;
+	condition_variable _condVariable;
+	std::thread _publishThread;		// ߳
+};
+
+//////////////////////////////////////////////////////////////////////
+// д
+
+//
+// ̨д߳
+// ڴɣύд߳һдʱļٸ
+// ̺߳ͽ˳·ļI/Oϡ
+// PPCO_SAVE_PERIODICALLYд̰߳ɴʱı沢תļ
+//
+class ReportWriter : public Singleton<ReportWriter>
+{
+	friend class Singleton<ReportWriter>;
+public:
+	//
+	// ύһݱ棬@contentȡߡ
+	// ͬһ·ϻδдıֱӱ滻дв
+	//
+	void Submit(const string& path, string& content);
+
+	// ȴύıд꣬ȴ@timeoutMs룬д귵true
+	bool Flush(int timeoutMs);
+
+	//
+	// дύıֹͣд̣߳˳ʱá
+	// ȴ@timeoutMs룬ʱд̣߳ÿסI/Oס˳
+	//
+	void Stop(int timeoutMs);
+
+	// forkӽд̴̣߳дıɸд
+	void RestartInChild();
+
+protected:
+	ReportWriter();
+	~ReportWriter();
+
+	void _Write();
+
+	// һݴʱڱ
+	void _WritePeriodicReport();
+
+	// ɾʹСƵľڱ
+	void _Rotate();
+
+private:
+	struct ReportJob
+	{
+		string _path;				// ļ·
+		string _content;			// 
+	};
+
+	deque<ReportJob> _jobs;			// дı
+	bool _writing;					// д߳Ƿд
+	bool _stop;						// Ƿֹͣ
+	mutex _mutex;
+	condition_variable _condVariable;		// д߳
+	condition_variable _idleCondVariable;	// ֪ͨд
+	std::thread _writeThread;		// д߳
 };
 
 //////////////////////////////////////////////////////////////////////
@@ -287,10 +859,22 @@ public:
 	// IPCϢ߳
 	void Start();
 
+	// ֹͣIPCϢ̣߳˳ʱ
+	void Stop();
+
+	//
+	// forkӽаӽ̵pid¼̡߳
+	// ̳еļ׽֡epoll֪ͨڸ̵ķֻرղʹá
+	//
+	void RestartInChild();
+
 protected:
 	// IPC̴߳Ϣĺ
 	void OnMessage();
 
+	// һϢ
+	void OnCommand(const string& msg, string& reply);
+
 	//
 	// ¾Ϊ۲ģʽУӦϢĵĴ
 	//
@@ -298,9 +882,26 @@ protected:
 	static void Enable(string& reply);
 	static void Disable(string& reply);
 	static void Save(string& reply);
+	static void TraceOn(string& reply);
+	static void TraceOff(string& reply);
+	static void TraceSave(string& reply);
+	static void Report(string& reply);
+	static void ReportJson(string& reply);
+	static void ReportCsv(string& reply);
+	static void Calibrate(string& reply);
+	static void IntervalOn(string& reply);
+	static void IntervalOff(string& reply);
+	static void Interval(string& reply);
+	static void IntervalJson(string& reply);
+	static void SampleOn(string& reply);
+	static void SampleOff(string& reply);
+	static void Sample(string& reply);
+	static void SampleFolded(string& reply);
+	static void SampleClear(string& reply);
 
 	IPCMonitorServer();
 private:
+	IPCServer _server;				// IPC
 	std::thread	_onMsgThread;			// Ϣ߳
 	CmdFuncMap _cmdFuncsMap;		// Ϣִкӳ
 };
@@ -360,40 +961,390 @@ public:
 	}
 };
 
+#define PP_CACHE_LINE_SIZE 64
+
+//
+// ȣǶ׶ֻͳƣ
+//
+#ifndef PP_MAX_STACK_DEPTH
+#define PP_MAX_STACK_DEPTH 64
+#endif
+
+class PerformanceSection;
+struct CallTreeReportNode;
+class TraceRing;
+struct SectionTotals;
+
+// ηģ
+struct SectionSymbol
+{
+	PerformanceSection* _section;
+	string _symbol;
+	string _module;
+};
+
+//
+// ڵ㣬ÿ߳һֻ߳޸ġ
+// ӽڵԵڸڵϣ½ڵʼɺreleaseʽ
+// ߳̿Բر
+//
+struct CallTreeNode
+{
+	PerformanceSection* _section;			// ӦΣڵΪNULL
+	CallTreeNode* _parent;					// ڵ
+	atomic<CallTreeNode*> _firstChild;		// һӽڵ
+	CallTreeNode* _nextSibling;				// һֵܽڵ㣬޸
+	atomic<LongType> _callCount;			// ñߵĵô
+	atomic<LongType> _sampledCount;			// ʱĵôʱʱС_callCount
+	atomic<LongType> _inclusiveTime;		// ʱĵðӶεǽʱ()
+
+	CallTreeNode(PerformanceSection* section, CallTreeNode* parent)
+		:_section(section)
+		, _parent(parent)
+		, _firstChild(NULL)
+		, _nextSibling(NULL)
+		, _callCount(0)
+		, _sampledCount(0)
+		, _inclusiveTime(0)
+	{}
+
+	// һ򴴽ӽڵ㣬̵ֻ߳
+	CallTreeNode* GetChild(PerformanceSection* section);
+};
+
+//
+// ջ֡
+//
+struct CallStackFrame
+{
+	CallTreeNode* _node;		// ڵ
+	LongType _beginTime;		// ʼǽʱ()εδʱΪ0
+};
+
+//
+// ߳ģÿ߳һݡ
+// _index߳ţֱ̲߳λҪhashҡ
+// ߳˳Żո̸߳ãҲű
+//
+struct PerformanceThreadContext
+{
+	int _index;			// ߳
+	int _threadId;		// ߳id
+	int _tid;			// ں߳id
+	LongType _generation;	// ĵıţÿ̲߳ͬŸʱλݴ˷ֻ߳
+
+	TraceRing* _traceRing;							// ׷ٻ׷ٺ
+	PerfCounterGroup* _perfCounters;				// ܼ飬ͳƺ
+	OsStatReader* _osStat;							// ϵͳԴȡԴͳƺ
+	CallTreeNode* _root;							// ߳ŵĵڵ
+	CallStackFrame _stack[PP_MAX_STACK_DEPTH];		// ջ
+	int _depth;										// ջȣܳPP_MAX_STACK_DEPTH
+	uint64_t _random;								// ʱ״̬
+};
+
+// ȡǰ̵߳ģ߳PP_MAX_THREADSʱNULL
+PerformanceThreadContext* GetThreadContext();
+
+// ȡǰ߳ѴģҲڴ棬ûʱNULL
+PerformanceThreadContext* PeekThreadContext();
+
+//
+// ѷ(heap/HeapHook.cpp)Ļص@bytesΪĿôС
+// ǵǰ߳ڲĻΣʱԡ
+// ֻдǰ̵߳ĲλҲڴ档
+//
+void OnHeapAlloc(size_t bytes);
+void OnHeapFree(size_t bytes);
+
+// ǰ߳ڲĻΣʱNULL
+PerformanceSection* CurrentSection();
+
+//
+// ֻ߳д롢̶߳ȡļۼӡ
+// Ҫlockǰ׺ԭӶдrelaxedload/storeɱֵ֤
+//
+inline void LocalAdd(atomic<LongType>& value, LongType delta)
+{
+	value.store(value.load(memory_order_relaxed) + delta, memory_order_relaxed);
+}
+
+//
+// ε̲߳λж룬ⲻ̵ͬ߳Ĳλα
+//
+struct PerformanceSlot
+{
+	atomic<LongType> _beginTime;	// ʼǽʱ()
+	atomic<LongType> _beginCpuTime;	// ʼ߳CPUʱ()
+	atomic<LongType> _costTime;		// ѵǽʱ()
+	atomic<LongType> _cpuTime;		// ѵ߳CPUʱ()
+	atomic<LongType> _refCount;		// ü(βƥ䣬ݹ麯ڲ)
+	atomic<LongType> _callCount;	// ô
+	atomic<int> _threadId;			// ߳idŸʱ̸߳д̶߳ȡ
+	atomic<int> _tid;				// ں߳idԴͳе߳idͬдʽͬ
+	LongType _generation;			// ߳ĵıţ̷ֻ߳
+	bool _counterBegun;				// εÿʼʱǷȡܼ
+	bool _sampled;					// εǷʱ
+	int _sampleCountdown;			// һμʱĵô
+	atomic<LongType> _skippedCount;	// δʱô
+	LatencyHistogram _histogram;	// ÿεǽʱӳٷֲ
+
+	atomic<LongType> _beginCounters[PPC_COUNT];	// ʼʱֵܼ
+	atomic<LongType> _counters[PPC_COUNT];		// ۼƵܼ
+	atomic<LongType> _counterCallCount;			// ͳܼĵô
+
+	bool _osStatBegun;							// εÿʼʱǷȡ˲ϵͳԴ
+	atomic<LongType> _beginOsStats[PPOS_COUNT];	// ʼʱĲϵͳԴֵ
+	atomic<LongType> _osStats[PPOS_COUNT];		// ۼƵĲϵͳԴ
+	atomic<LongType> _osStatCallCount;			// ͳ˲ϵͳԴĵô
+
+	atomic<LongType> _allocCount;		// ѷ
+	atomic<LongType> _allocBytes;		// ѷֽ
+	atomic<LongType> _freeCount;		// ͷŴ
+	atomic<LongType> _freeBytes;		// ͷֽ
+	atomic<LongType> _peakNetBytes;	// ǵεķͷֽ(ֽ)ˮλ
+
+	PerformanceSlot(int threadId, int tid, LongType generation)
+		:_beginTime(0)
+		, _beginCpuTime(0)
+		, _costTime(0)
+		, _cpuTime(0)
+		, _refCount(0)
+		, _callCount(0)
+		, _threadId(threadId)
+		, _tid(tid)
+		, _generation(generation)
+		, _counterBegun(false)
+		, _sampled(true)
+		, _sampleCountdown(0)
+		, _skippedCount(0)
+		, _counterCallCount(0)
+		, _osStatBegun(false)
+		, _osStatCallCount(0)
+		, _allocCount(0)
+		, _allocBytes(0)
+		, _freeCount(0)
+		, _freeBytes(0)
+		, _peakNetBytes(0)
+	{
+		for (int i = 0; i < PPC_COUNT; ++i)
+		{
+			_beginCounters[i].store(0, memory_order_relaxed);
+			_counters[i].store(0, memory_order_relaxed);
+		}
+
+		for (int i = 0; i < PPOS_COUNT; ++i)
+		{
+			_beginOsStats[i].store(0, memory_order_relaxed);
+			_osStats[i].store(0, memory_order_relaxed);
+		}
+	}
+
+	//
+	// ߳ű̸߳ãλеͳۼƵ߳ϡ
+	// ߳˳ʱδĵ״̵̬߳ĵûᱻݹ롣
+	//
+	void Reown(int threadId, int tid, LongType generation)
+	{
+		_threadId.store(threadId, memory_order_relaxed);
+		_tid.store(tid, memory_order_relaxed);
+		_generation = generation;
+		_refCount.store(0, memory_order_relaxed);
+		_beginTime.store(0, memory_order_relaxed);
+		_beginCpuTime.store(0, memory_order_relaxed);
+		_sampled = true;
+		_counterBegun = false;
+		_osStatBegun = false;
+	}
+
+	// ۼֵڽеĵõĿʼ״̬
+	void ClearTotals()
+	{
+		_costTime.store(0, memory_order_relaxed);
+		_cpuTime.store(0, memory_order_relaxed);
+		_callCount.store(0, memory_order_relaxed);
+		_skippedCount.store(0, memory_order_relaxed);
+		new(&_histogram) LatencyHistogram();
+
+		for (int i = 0; i < PPC_COUNT; ++i)
+		{
+			_counters[i].store(0, memory_order_relaxed);
+		}
+		_counterCallCount.store(0, memory_order_relaxed);
+
+		for (int i = 0; i < PPOS_COUNT; ++i)
+		{
+			_osStats[i].store(0, memory_order_relaxed);
+		}
+		_osStatCallCount.store(0, memory_order_relaxed);
+
+		_allocCount.store(0, memory_order_relaxed);
+		_allocBytes.store(0, memory_order_relaxed);
+		_freeCount.store(0, memory_order_relaxed);
+		_freeBytes.store(0, memory_order_relaxed);
+		_peakNetBytes.store(0, memory_order_relaxed);
+	}
+} __attribute__((aligned(PP_CACHE_LINE_SIZE)));
+
 //
 // 
+// Begin/Endֻдǰ̵߳ĲλҲhashң
+// ʱPerformance::_OutPutMergeϲ̲߳λ
 //
 class  PerformanceSection
 {
-	//typedef unordered_map<thread::id, LongType> StatisMap;
-	typedef unordered_map<int, LongType> StatisMap;
-
 	friend class Performance;
+	friend class JsonReportExporter;
+	friend class CsvReportExporter;
 public:
-	PerformanceSection()
-		:_totalRef(0)
-		, _rsStatistics(0)
-		, _totalCallCount(0)
-		, _totalCostTime(0)
-	{}
+	PerformanceSection();
 
+	// λǰ̵߳Ĳң@threadIdʹãԼеĵ
 	void Begin(int threadId);
 	void End(int threadId);
 
 	void Serialize(SaveAdapter& SA);
+
+	// ε֣Ϊʱʹú
+	const char* GetName() const;
+
+	//
+	// Զ׮ķģ飬עʱĵַռλ
+	// Performance::SetSymbolsʱá
+	//
+	void SetSymbol(const string& symbol, const string& module);
+
+	//
+	// ñεļʱ@intervalΪ0ʱʹOptionManagerȫá
+	// עʱʽá
+	//
+	PerformanceSection* SetSampling(int interval, int mode);
+
+	// ʱǽʱCPUʱ()
+	LongType EstimatedCostTime() const;
+	LongType EstimatedCpuTime() const;
+
+	// ۳ǽʱ()
+	LongType CorrectedCostTime() const;
+
+	//
+	// ѵǰ̵߳һζѷ/ͷżǵΣɶѷصá
+	// ڵǰ̵߳ĵջϣλѾ䣬ٷڴ档
+	//
+	void RecordHeapAlloc(PerformanceThreadContext* context, LongType bytes);
+	void RecordHeapFree(PerformanceThreadContext* context, LongType bytes);
+
+	// ǷΪעΣУ׼õβע
+	bool IsRegistered() const
+	{
+		return _node != NULL;
+	}
 private:
-	mutex _mutex;					// 
-	StatisMap _beginTimeMap;		// ʼʱͳ
-	StatisMap _costTimeMap;			// ʱͳ
-	LongType _totalCostTime;		// ܻʱ
+	// Ƿʱ
+	bool _ShouldSample(PerformanceThreadContext* context, PerformanceSlot* slot);
 
-	StatisMap _refCountMap;			// ü(βƥ䣬ݹ麯ڲ)
-	LongType _totalRef;				// ܵü
+	// ܵôʱ֮
+	double _SampleScale() const;
 
-	StatisMap _callCountMap;		// ôͳ
+	// лʱĹֵ
+	void _SerializeSampling(SaveAdapter& SA);
+
+	// л۳ʱ
+	void _SerializeOverhead(SaveAdapter& SA);
+
+	// ȡǰ̵߳Ĳλһνʱ
+	PerformanceSlot* _GetSlot(PerformanceThreadContext* context);
+
+	// ϲ̲߳λֵ
+	void Merge();
+
+	//
+	// ̲߳λĵôʱ֮ͣÿʼͽʱ仯
+	// ͬ˵ϴζȡ󱾶ûеãºϲ
+	//
+	LongType _ActivityCount() const;
+
+	//
+	// forkӽո̲߳λۼֵ
+	// @currentǵfork̵߳ţڽеĵãں߳idΪӽе@tid
+	// ߳ӽвڣλá
+	//
+	void _ResetInChild(int current, int tid);
+
+	// ȡǰ̵ܼ߳δ򲻿ʱfalse
+	static bool _ReadCounters(PerformanceThreadContext* context, LongType values[PPC_COUNT]);
+
+	// лܼIPCδ
+	void _SerializeCounters(SaveAdapter& SA);
+
+	// ȡǰ̵߳ĲϵͳԴδʱfalse
+	static bool _ReadOsStats(PerformanceThreadContext* context, LongType values[PPOS_COUNT]);
+
+	// лϵͳԴ@statsΪ@callCountεõۼֵ
+	static void _SerializeOsStats(SaveAdapter& SA, const char* prefix,
+		const LongType stats[PPOS_COUNT], LongType callCount);
+
+	// лѷͳ
+	void _SerializeHeap(SaveAdapter& SA);
+private:
+	atomic<PerformanceSlot*> _slots[PP_MAX_THREADS];	// ̲߳λ߳
+
+	LongType _totalCostTime;		// ܻѵǽʱ()
+	LongType _totalCpuTime;			// ܻѵ߳CPUʱ()
+	LongType _totalRef;				// ܵü
 	LongType _totalCallCount;		// ܵĵô
+	HistogramSnapshot _totalHistogram;	// ϲӳٷֲ
+	LongType _totalCounters[PPC_COUNT];	// ϲܼ
+	LongType _totalCounterCallCount;	// ͳܼܵô
+	LongType _totalOsStats[PPOS_COUNT];	// ϲĲϵͳԴ
+	LongType _totalOsStatCallCount;		// ͳ˲ϵͳԴܵô
+	LongType _totalSkippedCount;		// δʱܴ
+	LongType _totalAllocCount;			// ѷܴ
+	LongType _totalAllocBytes;			// ѷֽ
+	LongType _totalFreeCount;			// ͷܴ
+	LongType _totalFreeBytes;			// ͷֽ
+	LongType _totalPeakNetBytes;		// ֽ߳̾ˮλֵǴֽ
+	LongType _overheadTime;				// ʱ()
+	LongType _totalP99;					// ϲӳٷֲP99ʱ㣬()
+
+	atomic<int> _sampleInterval;		// εļʱ0ʾʹȫ
+	atomic<int> _sampleMode;			// εļʱʽ
 
 	ResourceStatistics* _rsStatistics;	// Դͳ̶߳
+
+	string _symbol;						// Զ׮ķֹΪ
+	string _module;						// Զ׮ڵģ
+	const PerformanceNode* _node;		// νڵϢ
+	int _id;							// id˳ţδעΪ-1
+};
+
+//
+// 
+// βõĺʱÿμʱãһBegin/EndʱΣ
+// ʱǽʱп۳
+//
+struct PerformanceOverhead
+{
+	LongType _inner;			// βõĺʱ()
+	LongType _outer;			// һBegin/Endʱ()
+	LongType _recursive;		// ݹһBegin/Endʱ()
+	LongType _untimed;			// ʱһBegin/Endʱ()
+	LongType _wallTimeRead;		// ȡһǽʱĿ()
+	LongType _monotonicRead;	// ȡһCLOCK_MONOTONICĿ()
+	LongType _threadCpuRead;	// ȡһ߳CPUʱĿ()
+	LongType _tscRead;			// ȡһTSCĿ()֧TSCΪ-1
+	int _flag;					// У׼ʱѡ
+
+	PerformanceOverhead()
+		:_inner(0)
+		, _outer(0)
+		, _recursive(0)
+		, _untimed(0)
+		, _wallTimeRead(0)
+		, _monotonicRead(0)
+		, _threadCpuRead(0)
+		, _tscRead(-1)
+		, _flag(PPCO_NONE)
+	{}
 };
 
 class  Performance : public Singleton<Performance>
@@ -401,6 +1352,9 @@ class  Performance : public Singleton<Performance>
 public:
 
 	friend class Singleton<Performance>;
+	friend class IPCMonitorServer;
+	friend class ReportWriter;
+	friend class IntervalRecorder;
 
 	//
 	// unordered_mapڲʹhash_tableʵ֣ʱ临ӶΪmapڲʹú
@@ -412,35 +1366,249 @@ public:
 
 	//
 	// 
+	// ÿõֻһ(ADD_PERFORMANCE_SECTION_BEGIN)ص
+	// ڽһֱЧ
 	//
 	PerformanceSection* CreateSection(const char* fileName,
 		const char* funcName, int line, const char* desc, bool isStatistics);
 
+	// Զ׮εķ(FunctionInstrument::ResolveSymbols)
+	void SetSymbols(const vector<SectionSymbol>& symbols);
+
+	//
+	// ѡ棬ֱ̨
+	// ļڴɺ󽻸д̱߳档
+	//
 	static void OutPut();
+
+	// Chrome trace-eventʽ׷¼
+	static void OutPutTrace();
+
+	// Ѹεۼֵڴͳ
+	void PublishSharedStats(SharedStatsRegion& region);
+
+	//
+	// ϲεۼֵid
+	// @totalsһεĽδ仯βٺϲ
+	//
+	void SnapshotSections(vector<SectionTotals>& totals);
+
+	//
+	// ǰѡµʱһΣ
+	// ֮ʱ²(翪ܼ)ڵִ߳С
+	//
+	void CalibrateOverhead();
+
+	PerformanceOverhead GetOverhead();
+
+	//
+	// forkǰĴpthread_atforkáforkʱ_mutexӽв
+	// Ѳڵ̳߳еӽմӸ̼̳еͳƣֻfork֮ĵã
+	// ռϲӽʱظ
+	//
+	void PrepareFork();
+	void ParentAfterFork();
+	void ChildAfterFork();
 protected:
 
 	static bool CompareByCallCount(PerformanceMap::iterator lhs,
 		PerformanceMap::iterator rhs);
 	static bool CompareByCostTime(PerformanceMap::iterator lhs,
 		PerformanceMap::iterator rhs);
+	static bool CompareByP99(PerformanceMap::iterator lhs,
+		PerformanceMap::iterator rhs);
 
 	Performance();
 
 	// лϢ
 	void _OutPut(SaveAdapter& SA);
+
+	// JSON/CSVʽĽṹ棬ṹReport.h
+	void _OutPutJson(SaveAdapter& SA);
+	void _OutPutCsv(SaveAdapter& SA);
+
+	//
+	// @flagѡĸʽһݱ棺PPCO_SAVE_AS_JSONʱΪJSON
+	// PPCO_SAVE_AS_CSVʱΪCSVδʱΪıرļչ
+	//
+	const char* _OutPutByFormat(SaveAdapter& SA, int flag);
+
+	//
+	// ϲ͸̲߳λõʽΡ
+	// ÷_mutexǰѵFunctionInstrument::ResolveSymbols
+	// طűУעε̡߳
+	//
+	void _PrepareSections(vector<PerformanceMap::iterator>& vInfos, CallTreeReportNode& root);
+
+	// ϲ̵߳۳
+	void _MergeCallTree(CallTreeReportNode& root);
+
+	// ϲĵ
+	void _OutPutCallTree(SaveAdapter& SA, const CallTreeReportNode& root);
+
+	// ۵ջʽ(flamegraph.plֱӶȡ)ֵΪʱ(΢)
+	void _OutPutFoldedStacks(SaveAdapter& SA);
+
+	// ׷¼
+	void _OutPutTrace(SaveAdapter& SA);
+
+	//
+	// ջȵ㺯۵ջԶȡ֣
+	// ջ֡ķڼǰ
+	//
+	void _OutPutStackSamples(SaveAdapter& SA, bool folded);
 private:
 	time_t  _beginTime;
 	mutex _mutex;
 	PerformanceMap _ppMap;
+
+	mutex _calibrateMutex;					// ͬһʱֻһУ׼
+	PerformanceSection _calibrateSection;	// У׼õĿΣע
+	PerformanceOverhead _overhead;			// һУ׼Ľ_mutex
+};
+
+//
+// עϢÿõһ̬
+// 캯constexpr̬ڱɳʼṵ̂߳ȫĳʼ飻
+// ڵһοִеʱעᣬͬʱüʱ
+//
+struct PerformanceSite
+{
+	const char* _fileName;
+	const char* _function;
+	int _line;
+	const char* _desc;
+	bool _isStatistics;
+	int _sampleInterval;		// ʱ0ʾʹȫ
+	int _sampleMode;			// ʱʽ
+	atomic<PerformanceSection*> _section;
+
+	constexpr PerformanceSite(const char* fileName, const char* function,
+		int line, const char* desc, bool isStatistics,
+		int sampleInterval = 0, int sampleMode = PPSM_EVERY_NTH)
+		:_fileName(fileName)
+		, _function(function)
+		, _line(line)
+		, _desc(desc)
+		, _isStatistics(isStatistics)
+		, _sampleInterval(sampleInterval)
+		, _sampleMode(sampleMode)
+		, _section(nullptr)
+	{}
+
+	PerformanceSection* GetSection()
+	{
+		PerformanceSection* section = _section.load(memory_order_acquire);
+		if (section == NULL)
+		{
+			// CreateSectionͬһõǷͬһΣעҲû
+			section = Performance::GetInstance()->CreateSection(_fileName,
+				_function, _line, _desc, _isStatistics)
+				->SetSampling(_sampleInterval, _sampleMode);
+			_section.store(section, memory_order_release);
+		}
+
+		return section;
+	}
+};
+
+//
+// ʱزԣPPCO_PROFILERǷ
+//
+struct RuntimeEnablePolicy
+{
+	static bool IsEnabled()
+	{
+		return OptionManager::IsEnabled(PPCO_PROFILER);
+	}
+};
+
+//
+// رղԣȥ
+//
+struct DisabledPolicy
+{
+	static bool IsEnabled()
+	{
+		return false;
+	}
+};
+
+//
+// ΣʱBeginʱEnd
+// ǰreturn׳쳣ʱҲȷβƥ䡣
+// @EnablePolicyǷRuntimeEnablePolicyDisabledPolicy
+//
+template<class EnablePolicy>
+class ScopedPerformanceSection
+{
+public:
+	explicit ScopedPerformanceSection(PerformanceSite& site)
+		:_section(NULL)
+	{
+		if (EnablePolicy::IsEnabled())
+		{
+			_section = site.GetSection();
+			_section->Begin(GetThreadId());
+		}
+	}
+
+	~ScopedPerformanceSection()
+	{
+		if (_section)
+		{
+			_section->End(GetThreadId());
+		}
+	}
+
+private:
+	ScopedPerformanceSection(const ScopedPerformanceSection&);
+	ScopedPerformanceSection& operator=(const ScopedPerformanceSection&);
+
+	PerformanceSection* _section;
 };
 
+#define PP_CONCAT_IMPL(a, b) a##b
+#define PP_CONCAT(a, b) PP_CONCAT_IMPL(a, b)
+
+//
+// ڹر
+// PP_DISABLE_PROFILERչΪ䣬κδݡ
+//
+#ifndef PP_DISABLE_PROFILER
+
+//
+// Σ@policyǷ
+// ÿֻһ
+//
+#define ADD_PERFORMANCE_SCOPE(desc, isStatistics, policy)					\
+	static PerformanceSite PP_CONCAT(PPSite_, __LINE__)(						\
+		__FILE__, __FUNCTION__, __LINE__, desc, isStatistics);				\
+	ScopedPerformanceSection<policy> PP_CONCAT(PPScope_, __LINE__)(			\
+		PP_CONCAT(PPSite_, __LINE__))
+
+//
 // οʼ
+// ÿõһڳʼPerformanceSiteһִʱעΣ
+// ֻ֮һacquire·ûڴ䡢ȫַȽϺ;̬ĳʼ顣
+//
 #define ADD_PERFORMANCE_SECTION_BEGIN(sign, desc, isStatistics) \
-	PerformanceSection* PPS_##sign = NULL;						\
-	if (OptionManager::GetInstance()->GetOptions()&PPCO_PROFILER)		\
-	{																	\
-		PPS_##sign = Performance::GetInstance()->CreateSection(__FILE__, __FUNCTION__, __LINE__, desc, isStatistics);\
-		PPS_##sign->Begin(GetThreadId());								\
+	ADD_PERFORMANCE_SAMPLED_SECTION_BEGIN(sign, desc, isStatistics, 0, PPSM_EVERY_NTH)
+
+//
+// Ӽʱοʼ
+// @intervalǼʱ0ʾʹSET_PERFORMANCE_SAMPLE_INTERVALȫ
+// @modeǼʱʽPP_SAMPLE_MODE
+// @interval@modeΪõ˻Ϊʱʼ
+//
+#define ADD_PERFORMANCE_SAMPLED_SECTION_BEGIN(sign, desc, isStatistics, interval, mode) \
+	static PerformanceSite PPSite_##sign(										\
+		__FILE__, __FUNCTION__, __LINE__, desc, isStatistics, interval, mode);	\
+	PerformanceSection* PPS_##sign = NULL;										\
+	if (OptionManager::IsEnabled(PPCO_PROFILER))								\
+	{																			\
+		PPS_##sign = PPSite_##sign.GetSection();								\
+		PPS_##sign->Begin(GetThreadId());										\
 	}
 
 // ν
@@ -450,6 +1618,29 @@ private:
 			PPS_##sign->End(GetThreadId());			\
 	}while(0);
 
+#else // PP_DISABLE_PROFILER
+
+#define ADD_PERFORMANCE_SCOPE(desc, isStatistics, policy) ((void)0)
+#define ADD_PERFORMANCE_SECTION_BEGIN(sign, desc, isStatistics) ((void)0)
+#define ADD_PERFORMANCE_SAMPLED_SECTION_BEGIN(sign, desc, isStatistics, interval, mode) ((void)0)
+#define ADD_PERFORMANCE_SECTION_END(sign) ((void)0)
+
+#endif // PP_DISABLE_PROFILER
+
+//
+// Чʡ򣬴Ӷ崦
+// @desc
+//
+#define PERFORMANCE_SCOPE(desc)	\
+	ADD_PERFORMANCE_SCOPE(desc, false, RuntimeEnablePolicy)
+
+//
+// Ч&Դ
+// @desc
+//
+#define PERFORMANCE_RS_SCOPE(desc)	\
+	ADD_PERFORMANCE_SCOPE(desc, true, RuntimeEnablePolicy)
+
 //
 // Чʡʼ
 // @signΨһʶΨһα
@@ -465,9 +1656,19 @@ private:
 #define PERFORMANCE_EE_END(sign)	\
 	ADD_PERFORMANCE_SECTION_END(sign)
 
+//
+// Чʡʼÿ@intervalεֻʱһΣôԾȷͳơ
+// ÿðεȵΣиʱ估䡣
+// ʹPERFORMANCE_EE_END
+// @signΨһʶΨһα
+// @desc
+//
+#define PERFORMANCE_EE_SAMPLED_BEGIN(sign, desc, interval)	\
+	ADD_PERFORMANCE_SAMPLED_SECTION_BEGIN(sign, desc, false, interval, PPSM_EVERY_NTH)
+
 //
 // Ч&Դʼ
-// psǱԴͳƶΣΪÿԴͳƶζῪһ߳̽ͳ
+// psԴͳƶιһ̣߳ڼSET_PERFORMANCE_SAMPLE_PERIOD
 // @signΨһʶΨһα
 // @desc
 //
@@ -476,14 +1677,73 @@ private:
 
 //
 // Ч&Դ
-// psǱԴͳƶΣΪÿԴͳƶζῪһ߳̽ͳ
 // @signΨһʶ
 //
 #define PERFORMANCE_EE_RS_END(sign)		\
 	ADD_PERFORMANCE_SECTION_END(sign)
 
+#ifndef PP_DISABLE_PROFILER
+
 //
 // ѡ
 //
 #define SET_PERFORMANCE_OPTIONS(flag)		\
 	OptionManager::GetInstance()->SetOptions(flag)
+
+//
+// ԴͳƶεĲ()Ĭ100ms
+//
+#define SET_PERFORMANCE_SAMPLE_PERIOD(ms)	\
+	OptionManager::GetInstance()->SetSamplePeriod(ms)
+
+//
+// ȫֵļʱͷʽĬÿεöʱ
+//
+#define SET_PERFORMANCE_SAMPLE_INTERVAL(interval, mode)	\
+	do{															\
+		OptionManager::GetInstance()->SetSampleInterval(interval);	\
+		OptionManager::GetInstance()->SetSampleMode(mode);			\
+	}while(0)
+
+//
+// ùڴͳƵķ()Ĭ1000ms
+//
+#define SET_PERFORMANCE_PUBLISH_PERIOD(ms)	\
+	OptionManager::GetInstance()->SetPublishPeriod(ms)
+
+//
+// Դͳƴ()Ĭ10000ms
+//
+#define SET_PERFORMANCE_RESOURCE_WINDOW(ms)	\
+	OptionManager::GetInstance()->SetResourceWindow(ms)
+
+//
+// ڱı()Ĭ60000ms迪PPCO_SAVE_PERIODICALLY
+//
+#define SET_PERFORMANCE_REPORT_PERIOD(ms)	\
+	OptionManager::GetInstance()->SetReportPeriod(ms)
+
+//
+// ڱתƣĬ10ļ64MB
+//
+#define SET_PERFORMANCE_REPORT_ROTATION(maxFiles, maxBytes)	\
+	OptionManager::GetInstance()->SetReportRotation(maxFiles, maxBytes)
+
+//
+// ջƵ(Hz)Ĭ99Hz1000Hz迪PPCO_STACK_SAMPLER
+//
+#define SET_PERFORMANCE_STACK_SAMPLE_FREQUENCY(hz)	\
+	OptionManager::GetInstance()->SetStackSampleFrequency(hz)
+
+#else // PP_DISABLE_PROFILER
+
+#define SET_PERFORMANCE_OPTIONS(flag) ((void)0)
+#define SET_PERFORMANCE_SAMPLE_PERIOD(ms) ((void)0)
+#define SET_PERFORMANCE_SAMPLE_INTERVAL(interval, mode) ((void)0)
+#define SET_PERFORMANCE_PUBLISH_PERIOD(ms) ((void)0)
+#define SET_PERFORMANCE_RESOURCE_WINDOW(ms) ((void)0)
+#define SET_PERFORMANCE_REPORT_PERIOD(ms) ((void)0)
+#define SET_PERFORMANCE_REPORT_ROTATION(maxFiles, maxBytes) ((void)0)
+#define SET_PERFORMANCE_STACK_SAMPLE_FREQUENCY(hz) ((void)0)
+
+#endif // PP_DISABLE_PROFILER
@@ -0,0 +1,237 @@
+#include "ProfiledMutex.h"
+
+// 剖析段数超过PP_LOCK_MAX_SECTIONS后合并到的统计项标记
+static char s_otherSectionsTag;
+static PerformanceSection* const s_otherSections = (PerformanceSection*)&s_otherSectionsTag;
+
+ProfiledMutex::ProfiledMutex(const char* name)
+	:_acquireTick(0)
+	, _name(name ? name : "")
+	, _holdBegin(0)
+	, _holdContended(false)
+	, _holdEntry(NULL)
+{
+	LockRegistry::GetInstance()->Register(this);
+}
+
+ProfiledMutex::~ProfiledMutex()
+{
+	LockRegistry::GetInstance()->Unregister(this);
+}
+
+void ProfiledMutex::_OnAcquire(bool contended, LongType begin)
+{
+	LockSectionEntry* entry = _GetEntry(CurrentSection());
+	LocalAdd(entry->_acquireCount, 1);
+
+	if (!contended && (++_acquireTick & (PP_LOCK_HOLD_SAMPLE_INTERVAL - 1)) != 0)
+	{
+		_holdBegin = 0;
+		return;
+	}
+
+	LongType now = PerformanceTimer::WallTimeNs();
+	if (contended)
+	{
+		LongType waitTime = now - begin;
+		LocalAdd(entry->_contendedCount, 1);
+		LocalAdd(entry->_waitTime, waitTime);
+		if (waitTime > entry->_maxWaitTime.load(memory_order_relaxed))
+			entry->_maxWaitTime.store(waitTime, memory_order_relaxed);
+	}
+
+	_holdBegin = now;
+	_holdContended = contended;
+	_holdEntry = entry;
+}
+
+void ProfiledMutex::_OnRelease()
+{
+	LongType holdTime = PerformanceTimer::WallTimeNs() - _holdBegin;
+	if (_holdContended)
+	{
+		LocalAdd(_holdEntry->_contendedHoldTime, holdTime);
+	}
+	else
+	{
+		LocalAdd(_holdEntry->_holdTime, holdTime);
+		LocalAdd(_holdEntry->_timedCount, 1);
+	}
+	_holdBegin = 0;
+}
+
+LockSectionEntry* ProfiledMutex::_GetEntry(PerformanceSection* section)
+{
+	// 持有锁时调用，统计项的占用由锁本身互斥
+	for (int i = 0; i < PP_LOCK_MAX_SECTIONS - 1; ++i)
+	{
+		LockSectionEntry& entry = _entries[i];
+		if (!entry._used.load(memory_order_relaxed))
+		{
+			entry._section = section;
+			entry._used.store(true, memory_order_release);
+			return &entry;
+		}
+
+		if (entry._section == section)
+			return &entry;
+	}
+
+	LockSectionEntry& other = _entries[PP_LOCK_MAX_SECTIONS - 1];
+	if (!other._used.load(memory_order_relaxed))
+	{
+		other._section = s_otherSections;
+		other._used.store(true, memory_order_release);
+	}
+
+	return &other;
+}
+
+void ProfiledMutex::GetStats(vector<pair<PerformanceSection*, LockStats> >& stats) const
+{
+	for (int i = 0; i < PP_LOCK_MAX_SECTIONS; ++i)
+	{
+		const LockSectionEntry& entry = _entries[i];
+		if (!entry._used.load(memory_order_acquire))
+			break;
+
+		LockStats value;
+		value._acquireCount = entry._acquireCount.load(memory_order_relaxed);
+		value._contendedCount = entry._contendedCount.load(memory_order_relaxed);
+		value._waitTime = entry._waitTime.load(memory_order_relaxed);
+		value._maxWaitTime = entry._maxWaitTime.load(memory_order_relaxed);
+		value._contendedHoldTime = entry._contendedHoldTime.load(memory_order_relaxed);
+		value._holdTime = entry._holdTime.load(memory_order_relaxed);
+		value._timedCount = entry._timedCount.load(memory_order_relaxed);
+		stats.push_back(make_pair(entry._section, value));
+	}
+}
+
+///////////////////////////////////////////////////////////////
+// LockRegistry
+
+static void ResetLockRegistryInChild()
+{
+	LockRegistry::GetInstance()->ResetInChild();
+}
+
+LockRegistry::LockRegistry()
+{
+	pthread_atfork(NULL, NULL, ResetLockRegistryInChild);
+}
+
+void LockRegistry::ResetInChild()
+{
+	RebuildInChild(_mutex);
+}
+
+void LockRegistry::Register(ProfiledMutex* mutex)
+{
+	unique_lock<std::mutex> Lock(_mutex);
+	_mutexs.push_back(mutex);
+}
+
+void LockRegistry::Unregister(ProfiledMutex* mutex)
+{
+	unique_lock<std::mutex> Lock(_mutex);
+
+	auto it = find(_mutexs.begin(), _mutexs.end(), mutex);
+	if (it == _mutexs.end())
+		return;
+
+	_mutexs.erase(it);
+
+	vector<pair<PerformanceSection*, LockStats> > stats;
+	mutex->GetStats(stats);
+	if (stats.empty())
+		return;
+
+	SectionStatsMap& retired = _retired[mutex->_name.empty() ? "(Unnamed)" : mutex->_name];
+	for (size_t i = 0; i < stats.size(); ++i)
+	{
+		retired[stats[i].first].Add(stats[i].second);
+	}
+}
+
+typedef pair<string, LockStats> NamedLockStats;
+
+static bool CompareByWaitTime(const NamedLockStats& lhs, const NamedLockStats& rhs)
+{
+	if (lhs.second._waitTime != rhs.second._waitTime)
+		return lhs.second._waitTime > rhs.second._waitTime;
+
+	return lhs.second._contendedCount > rhs.second._contendedCount;
+}
+
+static const char* LockSectionName(PerformanceSection* section)
+{
+	if (section == NULL)
+		return "(No Section)";
+	if (section == s_otherSections)
+		return "(Other Sections)";
+
+	return section->GetName();
+}
+
+void LockRegistry::Serialize(SaveAdapter& SA)
+{
+	map<PerformanceSection*, vector<NamedLockStats> > sectionLocks;
+
+	{
+		unique_lock<std::mutex> Lock(_mutex);
+
+		char name[64];
+		for (size_t i = 0; i < _mutexs.size(); ++i)
+		{
+			ProfiledMutex* mutex = _mutexs[i];
+			const char* lockName = mutex->_name.c_str();
+			if (mutex->_name.empty())
+			{
+				snprintf(name, sizeof(name), "ProfiledMutex@%p", (void*)mutex);
+				lockName = name;
+			}
+
+			vector<pair<PerformanceSection*, LockStats> > stats;
+			mutex->GetStats(stats);
+			for (size_t j = 0; j < stats.size(); ++j)
+			{
+				sectionLocks[stats[j].first].push_back(make_pair(lockName, stats[j].second));
+			}
+		}
+
+		auto it = _retired.begin();
+		for (; it != _retired.end(); ++it)
+		{
+			auto sectionIt = it->second.begin();
+			for (; sectionIt != it->second.end(); ++sectionIt)
+			{
+				sectionLocks[sectionIt->first].push_back(make_pair(it->first + "(Destroyed)", sectionIt->second));
+			}
+		}
+	}
+
+	if (sectionLocks.empty())
+		return;
+
+	SA.Save("===================Lock Contention==================\n\n");
+
+	auto it = sectionLocks.begin();
+	for (; it != sectionLocks.end(); ++it)
+	{
+		vector<NamedLockStats>& locks = it->second;
+		sort(locks.begin(), locks.end(), CompareByWaitTime);
+
+		SA.Save("Section:%s, Locks:%d\n", LockSectionName(it->first), (int)locks.size());
+		for (size_t i = 0; i < locks.size() && i < PP_LOCK_REPORT_TOP; ++i)
+		{
+			const LockStats& stats = locks[i].second;
+			double contendedRate = stats._acquireCount ? 100.0 * stats._contendedCount / stats._acquireCount : 0;
+			SA.Save("  NO%d. Lock:%s, Acquire:%lld, Contended:%lld(%.2f%%), Wait:%.6fs, Max Wait:%.3fms, Hold:%.6fs\n",
+				(int)i + 1, locks[i].first.c_str(), stats._acquireCount, stats._contendedCount, contendedRate,
+				(double)stats._waitTime / PP_NS_PER_SEC, (double)stats._maxWaitTime / 1000000,
+				(double)stats.EstimatedHoldTime() / PP_NS_PER_SEC);
+		}
+	}
+
+	SA.Save("\n");
+}
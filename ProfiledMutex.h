@@ -0,0 +1,321 @@
+#pragma once
+
+#include "Performance.h"
+
+//
+// 每个锁最多分别统计的剖析段数，超出的剖析段合并到最后一项。
+//
+#ifndef PP_LOCK_MAX_SECTIONS
+#define PP_LOCK_MAX_SECTIONS 8
+#endif
+
+//
+// 未竞争的加锁每N次计时一次持有时间，必须是2的幂。
+// 竞争的加锁总是计时，两类加锁的持有时间分别累计，
+// 报告中只按未竞争加锁的计时比例估算其总持有时间。
+//
+#ifndef PP_LOCK_HOLD_SAMPLE_INTERVAL
+#define PP_LOCK_HOLD_SAMPLE_INTERVAL 16
+#endif
+
+// 报告中每个剖析段列出的竞争最多的锁数
+#ifndef PP_LOCK_REPORT_TOP
+#define PP_LOCK_REPORT_TOP 5
+#endif
+
+// 锁统计值
+struct LockStats
+{
+	LongType _acquireCount;		// 加锁次数
+	LongType _contendedCount;	// 加锁时锁已被占用的次数
+	LongType _waitTime;			// 等待加锁的时间(纳秒)
+	LongType _maxWaitTime;		// 最长的一次等待(纳秒)
+	LongType _contendedHoldTime;	// 竞争的加锁持有锁的时间(纳秒)，每次都计时
+	LongType _holdTime;			// 计时的未竞争加锁持有锁的时间(纳秒)
+	LongType _timedCount;		// 计时持有时间的未竞争加锁次数
+
+	LockStats()
+		:_acquireCount(0)
+		, _contendedCount(0)
+		, _waitTime(0)
+		, _maxWaitTime(0)
+		, _contendedHoldTime(0)
+		, _holdTime(0)
+		, _timedCount(0)
+	{}
+
+	//
+	// 估算的总持有时间：竞争的加锁直接累计，
+	// 未竞争的加锁按其计时比例估算，两者的持有时间往往差别很大，不能共用一个比例。
+	//
+	LongType EstimatedHoldTime() const
+	{
+		LongType holdTime = _contendedHoldTime;
+		if (_timedCount > 0)
+		{
+			LongType uncontendedCount = _acquireCount - _contendedCount;
+			holdTime += (LongType)((double)_holdTime * uncontendedCount / _timedCount);
+		}
+
+		return holdTime;
+	}
+
+	void Add(const LockStats& stats)
+	{
+		_acquireCount += stats._acquireCount;
+		_contendedCount += stats._contendedCount;
+		_waitTime += stats._waitTime;
+		_maxWaitTime = max(_maxWaitTime, stats._maxWaitTime);
+		_contendedHoldTime += stats._contendedHoldTime;
+		_holdTime += stats._holdTime;
+		_timedCount += stats._timedCount;
+	}
+};
+
+//
+// 锁在一个剖析段内的统计。
+// 只在持有锁时写入，由锁本身保证互斥；报告线程用relaxed读取。
+//
+struct LockSectionEntry
+{
+	atomic<bool> _used;							// 是否已被占用
+	PerformanceSection* _section;				// 加锁时最内层的剖析段，NULL表示不在剖析段内
+	atomic<LongType> _acquireCount;
+	atomic<LongType> _contendedCount;
+	atomic<LongType> _waitTime;
+	atomic<LongType> _maxWaitTime;
+	atomic<LongType> _contendedHoldTime;
+	atomic<LongType> _holdTime;
+	atomic<LongType> _timedCount;
+
+	LockSectionEntry()
+		:_used(false)
+		, _section(NULL)
+		, _acquireCount(0)
+		, _contendedCount(0)
+		, _waitTime(0)
+		, _maxWaitTime(0)
+		, _contendedHoldTime(0)
+		, _holdTime(0)
+		, _timedCount(0)
+	{}
+};
+
+//
+// 剖析锁竞争的互斥锁，可直接替换std::mutex，
+// 配合std::lock_guard、ProfiledUniqueLock和ProfiledConditionVariable使用。
+// 开启PPCO_LOCK_PROFILER后统计等待时间、持有时间和竞争次数，
+// 记到加锁线程当时最内层的剖析段上。
+// 未竞争时先try_lock成功，只计数，每PP_LOCK_HOLD_SAMPLE_INTERVAL次读两次时间；
+// 未开启时只多一次选项判断。
+//
+class ProfiledMutex
+{
+	friend class ProfiledConditionVariable;
+	friend class LockRegistry;
+public:
+	explicit ProfiledMutex(const char* name = "");
+	~ProfiledMutex();
+
+	void lock()
+	{
+		if (!OptionManager::IsEnabled(PPCO_LOCK_PROFILER))
+		{
+			_mutex.lock();
+			_holdBegin = 0;
+			return;
+		}
+
+		if (_mutex.try_lock())
+		{
+			_OnAcquire(false, 0);
+			return;
+		}
+
+		LongType begin = PerformanceTimer::WallTimeNs();
+		_mutex.lock();
+		_OnAcquire(true, begin);
+	}
+
+	bool try_lock()
+	{
+		if (!_mutex.try_lock())
+			return false;
+
+		if (OptionManager::IsEnabled(PPCO_LOCK_PROFILER))
+			_OnAcquire(false, 0);
+		else
+			_holdBegin = 0;
+
+		return true;
+	}
+
+	void unlock()
+	{
+		if (_holdBegin)
+			_OnRelease();
+
+		_mutex.unlock();
+	}
+
+	std::mutex::native_handle_type native_handle()
+	{
+		return _mutex.native_handle();
+	}
+
+	const string& GetName() const
+	{
+		return _name;
+	}
+
+	// 各剖析段的统计快照
+	void GetStats(vector<pair<PerformanceSection*, LockStats> >& stats) const;
+
+private:
+	ProfiledMutex(const ProfiledMutex&);
+	ProfiledMutex& operator=(const ProfiledMutex&);
+
+	// 加锁成功后记录，@begin为开始等待的时间
+	void _OnAcquire(bool contended, LongType begin);
+
+	// 解锁前记录持有时间
+	void _OnRelease();
+
+	// 查找或占用剖析段对应的统计项
+	LockSectionEntry* _GetEntry(PerformanceSection* section);
+
+private:
+	std::mutex _mutex;
+	unsigned _acquireTick;				// 未竞争加锁的计数，决定是否计时持有时间
+	string _name;						// 锁的名字，为空时报告中用地址
+	LongType _holdBegin;				// 本次持有锁的开始时间，0表示本次不统计
+	bool _holdContended;				// 本次加锁是否发生了竞争
+	LockSectionEntry* _holdEntry;		// 本次持有锁记入的统计项
+	LockSectionEntry _entries[PP_LOCK_MAX_SECTIONS];
+};
+
+typedef std::unique_lock<ProfiledMutex> ProfiledUniqueLock;
+
+//
+// 配合ProfiledMutex的条件变量，可直接替换std::condition_variable。
+// 等待期间释放锁，持有时间在等待前结束；被唤醒后重新计为一次加锁，
+// 条件变量上的等待不计入锁的等待时间。
+//
+class ProfiledConditionVariable
+{
+public:
+	void notify_one() noexcept
+	{
+		_condVariable.notify_one();
+	}
+
+	void notify_all() noexcept
+	{
+		_condVariable.notify_all();
+	}
+
+	void wait(ProfiledUniqueLock& lock)
+	{
+		ProfiledMutex* mutex = _BeginWait(lock);
+		std::unique_lock<std::mutex> inner(mutex->_mutex, std::adopt_lock);
+		_condVariable.wait(inner);
+		inner.release();
+		_EndWait(mutex);
+	}
+
+	template<class Predicate>
+	void wait(ProfiledUniqueLock& lock, Predicate pred)
+	{
+		while (!pred())
+			wait(lock);
+	}
+
+	template<class Rep, class Period>
+	cv_status wait_for(ProfiledUniqueLock& lock, const chrono::duration<Rep, Period>& relTime)
+	{
+		ProfiledMutex* mutex = _BeginWait(lock);
+		std::unique_lock<std::mutex> inner(mutex->_mutex, std::adopt_lock);
+		cv_status status = _condVariable.wait_for(inner, relTime);
+		inner.release();
+		_EndWait(mutex);
+		return status;
+	}
+
+	template<class Rep, class Period, class Predicate>
+	bool wait_for(ProfiledUniqueLock& lock, const chrono::duration<Rep, Period>& relTime, Predicate pred)
+	{
+		return wait_until(lock, chrono::steady_clock::now() + relTime, pred);
+	}
+
+	template<class Clock, class Duration>
+	cv_status wait_until(ProfiledUniqueLock& lock, const chrono::time_point<Clock, Duration>& absTime)
+	{
+		ProfiledMutex* mutex = _BeginWait(lock);
+		std::unique_lock<std::mutex> inner(mutex->_mutex, std::adopt_lock);
+		cv_status status = _condVariable.wait_until(inner, absTime);
+		inner.release();
+		_EndWait(mutex);
+		return status;
+	}
+
+	template<class Clock, class Duration, class Predicate>
+	bool wait_until(ProfiledUniqueLock& lock, const chrono::time_point<Clock, Duration>& absTime, Predicate pred)
+	{
+		while (!pred())
+		{
+			if (wait_until(lock, absTime) == cv_status::timeout)
+				return pred();
+		}
+
+		return true;
+	}
+
+private:
+	ProfiledMutex* _BeginWait(ProfiledUniqueLock& lock)
+	{
+		ProfiledMutex* mutex = lock.mutex();
+		if (mutex->_holdBegin)
+			mutex->_OnRelease();
+
+		return mutex;
+	}
+
+	void _EndWait(ProfiledMutex* mutex)
+	{
+		if (OptionManager::IsEnabled(PPCO_LOCK_PROFILER))
+			mutex->_OnAcquire(false, 0);
+		else
+			mutex->_holdBegin = 0;
+	}
+
+private:
+	std::condition_variable _condVariable;
+};
+
+//
+// 锁注册表
+// 记录所有存活的ProfiledMutex，锁析构时统计按名字合并保留，输出报告时汇总。
+//
+class LockRegistry : public Singleton<LockRegistry>
+{
+	friend class Singleton<LockRegistry>;
+public:
+	void Register(ProfiledMutex* mutex);
+	void Unregister(ProfiledMutex* mutex);
+
+	// 按剖析段输出竞争最多的锁，没有统计时不输出
+	void Serialize(SaveAdapter& SA);
+
+	// fork出的子进程中重建锁，fork时可能被父进程的其他线程持有
+	void ResetInChild();
+
+protected:
+	LockRegistry();
+
+private:
+	typedef map<PerformanceSection*, LockStats> SectionStatsMap;
+
+	mutex _mutex;
+	vector<ProfiledMutex*> _mutexs;				// 存活的锁
+	map<string, SectionStatsMap> _retired;		// 已析构的锁，按名字合并
+};
@@ -0,0 +1,324 @@
+#include "Report.h"
+#include "Trace.h"
+
+// 操作系统资源和性能计数器在结构化报告中的字段名，按枚举值索引
+static const char* const s_osStatNames[PPOS_COUNT] =
+{
+	"voluntary_switches",
+	"involuntary_switches",
+	"minor_faults",
+	"major_faults",
+	"read_chars",
+	"write_chars",
+	"read_bytes",
+	"write_bytes",
+	"run_delay_ns",
+};
+
+static const char* const s_counterNames[PPC_COUNT] =
+{
+	"cycles",
+	"instructions",
+	"cache_misses",
+	"branches",
+	"branch_misses",
+	"context_switches",
+	"page_faults",
+};
+
+// 剖析段的文件名和函数名，自动插桩函数为所在模块和符号名
+static void SectionLocation(const PerformanceNode* node, const string& symbol, const string& module,
+	const char*& fileName, const char*& function, int& line)
+{
+	if (symbol.empty())
+	{
+		fileName = node->_fileName.c_str();
+		function = node->_function.c_str();
+		line = node->_line;
+	}
+	else
+	{
+		fileName = module.c_str();
+		function = symbol.c_str();
+		line = 0;
+	}
+}
+
+///////////////////////////////////////////////////////////////
+// JsonReportExporter
+
+void JsonReportExporter::Export(const ReportHeader& header, const vector<PerformanceSection*>& sections)
+{
+	_SA.Save("{\"schema\":\"performance_report\",\"version\":%d,\"pid\":%d,\"begin_time\":%lld,"
+		"\"wall_time_source\":\"%s\",\n",
+		PP_REPORT_SCHEMA_VERSION, header._pid, (LongType)header._beginTime,
+		EscapeJson(header._wallTimeSource).c_str());
+
+	const PerformanceOverhead& overhead = header._overhead;
+	_SA.Save("\"overhead_ns\":{\"inner\":%lld,\"outer\":%lld,\"recursive\":%lld,\"untimed\":%lld,"
+		"\"wall_time_read\":%lld,\"monotonic_read\":%lld,\"thread_cpu_read\":%lld,\"tsc_read\":%lld},\n",
+		overhead._inner, overhead._outer, overhead._recursive, overhead._untimed,
+		overhead._wallTimeRead, overhead._monotonicRead, overhead._threadCpuRead, overhead._tscRead);
+
+	_SA.Save("\"sections\":[\n");
+	for (size_t i = 0; i < sections.size(); ++i)
+	{
+		if (i)
+			_SA.Save(",\n");
+		_ExportSection(sections[i]);
+	}
+	_SA.Save("\n]}\n");
+}
+
+void JsonReportExporter::_ExportSection(PerformanceSection* section)
+{
+	const char* fileName;
+	const char* function;
+	int line;
+	SectionLocation(section->_node, section->_symbol, section->_module, fileName, function, line);
+
+	_SA.Save("{\"id\":%d,\"name\":\"%s\",\"file\":\"%s\",\"function\":\"%s\",\"line\":%d,\"matched\":%s,\n",
+		section->_id, EscapeJson(section->GetName()).c_str(), EscapeJson(fileName).c_str(),
+		EscapeJson(function).c_str(), line, section->_totalRef ? "false" : "true");
+
+	_SA.Save("\"call_count\":%lld,\"cost_time_ns\":%lld,\"cpu_time_ns\":%lld,\"skipped_count\":%lld,"
+		"\"estimated_cost_time_ns\":%lld,\"estimated_cpu_time_ns\":%lld,"
+		"\"overhead_time_ns\":%lld,\"corrected_cost_time_ns\":%lld,\n",
+		section->_totalCallCount, section->_totalCostTime, section->_totalCpuTime,
+		section->_totalSkippedCount, section->EstimatedCostTime(), section->EstimatedCpuTime(),
+		section->_overheadTime, section->CorrectedCostTime());
+
+	_SA.Save("\"latency_ns\":");
+	_ExportHistogram(section->_totalHistogram);
+
+	// 各线程的统计
+	_SA.Save(",\n\"threads\":[");
+	bool first = true;
+	for (int i = 0; i < PP_MAX_THREADS; ++i)
+	{
+		PerformanceSlot* slot = section->_slots[i].load(memory_order_acquire);
+		if (slot == NULL)
+			continue;
+
+		_SA.Save("%s{\"thread_id\":%d,\"tid\":%d,\"call_count\":%lld,\"cost_time_ns\":%lld,\"cpu_time_ns\":%lld,\"os_stats\":",
+			first ? "" : ",", slot->_threadId.load(memory_order_relaxed), slot->_tid.load(memory_order_relaxed),
+			slot->_callCount.load(memory_order_relaxed),
+			slot->_costTime.load(memory_order_relaxed),
+			slot->_cpuTime.load(memory_order_relaxed));
+
+		LongType osStats[PPOS_COUNT];
+		for (int j = 0; j < PPOS_COUNT; ++j)
+		{
+			osStats[j] = slot->_osStats[j].load(memory_order_relaxed);
+		}
+		_ExportOsStats(osStats, slot->_osStatCallCount.load(memory_order_relaxed));
+		_SA.Save("}");
+		first = false;
+	}
+	_SA.Save("],\n");
+
+	_SA.Save("\"counters\":{");
+	for (int i = 0; i < PPC_COUNT; ++i)
+	{
+		_SA.Save("\"%s\":%lld,", s_counterNames[i], section->_totalCounters[i]);
+	}
+	_SA.Save("\"counted_calls\":%lld},\n\"os_stats\":", section->_totalCounterCallCount);
+	_ExportOsStats(section->_totalOsStats, section->_totalOsStatCallCount);
+
+	_SA.Save(",\n\"heap\":{\"alloc_count\":%lld,\"alloc_bytes\":%lld,\"free_count\":%lld,"
+		"\"free_bytes\":%lld,\"peak_net_bytes\":%lld},\n",
+		section->_totalAllocCount, section->_totalAllocBytes, section->_totalFreeCount,
+		section->_totalFreeBytes, section->_totalPeakNetBytes);
+
+	// 资源统计
+	_SA.Save("\"resources\":");
+	ResourceStatistics* rs = section->_rsStatistics;
+	if (rs == NULL)
+	{
+		_SA.Save("null}");
+		return;
+	}
+
+	_SA.Save("{");
+	_ExportResource("cpu", rs->GetCpuInfo());
+	_SA.Save(",");
+	_ExportResource("thread_cpu", rs->GetThreadCpuInfo());
+	_SA.Save(",");
+	_ExportResource("memory_kb", rs->GetMemoryInfo());
+	_SA.Save(",\"threads\":[");
+
+	ResourceStatistics::ThreadInfoMap threadInfos = rs->GetThreadInfos();
+	ResourceStatistics::ThreadInfoMap::iterator it = threadInfos.begin();
+	first = true;
+	for (; it != threadInfos.end(); ++it)
+	{
+		const ResourceInfo& info = it->second._cpuInfo;
+		_SA.Save("%s{\"tid\":%d,\"cpu_peak\":%lld,\"cpu_avg\":%lld,\"cpu_ewma\":%.1f,\"samples\":%lld}",
+			first ? "" : ",", it->first, info._peak, info._avg, info._ewma, info._count);
+		first = false;
+	}
+	_SA.Save("]}}");
+}
+
+void JsonReportExporter::_ExportHistogram(const HistogramSnapshot& h)
+{
+	_SA.Save("{\"count\":%lld,\"min\":%lld,\"p50\":%lld,\"p90\":%lld,\"p99\":%lld,\"p999\":%lld,"
+		"\"max\":%lld,\"avg\":%.1f,\"stddev\":%.1f,\"buckets\":[",
+		h._count, h._min, h.Percentile(50), h.Percentile(90), h.Percentile(99),
+		h.Percentile(99.9), h._max, h.Mean(), h.StdDev());
+
+	bool first = true;
+	for (int i = 0; i < HISTOGRAM_BUCKET_COUNT; ++i)
+	{
+		if (h._counts[i] == 0)
+			continue;
+
+		_SA.Save("%s[%lld,%lld]", first ? "" : ",", HistogramBucketUpperValue(i), h._counts[i]);
+		first = false;
+	}
+	_SA.Save("]}");
+}
+
+void JsonReportExporter::_ExportOsStats(const LongType stats[PPOS_COUNT], LongType callCount)
+{
+	_SA.Save("{");
+	for (int i = 0; i < PPOS_COUNT; ++i)
+	{
+		_SA.Save("\"%s\":%lld,", s_osStatNames[i], stats[i]);
+	}
+	_SA.Save("\"counted_calls\":%lld}", callCount);
+}
+
+void JsonReportExporter::_ExportResource(const char* name, const ResourceInfo& info)
+{
+	int windowMs = OptionManager::GetInstance()->GetResourceWindow();
+	ResourceWindowStats stats = info.GetWindowStats(windowMs * 1000000LL);
+
+	_SA.Save("\"%s\":{\"peak\":%lld,\"avg\":%lld,\"ewma\":%.1f,\"samples\":%lld,"
+		"\"window\":{\"ms\":%d,\"count\":%lld,\"min\":%lld,\"max\":%lld,\"avg\":%lld,"
+		"\"p50\":%lld,\"p95\":%lld,\"p99\":%lld}}",
+		name, info._peak, info._avg, info._ewma, info._count, windowMs,
+		stats._count, stats._min, stats._max, stats._avg, stats._p50, stats._p95, stats._p99);
+}
+
+///////////////////////////////////////////////////////////////
+// CsvReportExporter
+
+// CSV字段转义，包含逗号、引号或换行时用引号括起，引号写两次
+static string EscapeCsv(const char* str)
+{
+	if (strpbrk(str, ",\"\r\n") == NULL)
+		return str;
+
+	string escaped = "\"";
+	for (; *str; ++str)
+	{
+		if (*str == '"')
+			escaped += '"';
+		escaped += *str;
+	}
+	escaped += '"';
+
+	return escaped;
+}
+
+void CsvReportExporter::Export(const vector<PerformanceSection*>& sections)
+{
+	_SA.Save("scope,id,name,file,function,line,thread_id,tid,call_count,cost_time_ns,cpu_time_ns,"
+		"latency_count,min_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns,avg_ns,stddev_ns,corrected_cost_time_ns");
+	for (int i = 0; i < PPOS_COUNT; ++i)
+	{
+		_SA.Save(",%s", s_osStatNames[i]);
+	}
+	_SA.Save(",alloc_count,alloc_bytes,free_count,free_bytes,peak_net_bytes,"
+		"cpu_peak,cpu_avg,memory_peak_kb,memory_avg_kb,histogram\n");
+
+	for (size_t i = 0; i < sections.size(); ++i)
+	{
+		_ExportSection(sections[i]);
+	}
+}
+
+void CsvReportExporter::_ExportSection(PerformanceSection* section)
+{
+	const char* fileName;
+	const char* function;
+	int line;
+	SectionLocation(section->_node, section->_symbol, section->_module, fileName, function, line);
+
+	// 各行共用的剖析段标识列
+	string identity = to_string((long long)section->_id) + "," + EscapeCsv(section->GetName())
+		+ "," + EscapeCsv(fileName) + "," + EscapeCsv(function) + "," + to_string((long long)line);
+
+	// 汇总行
+	const HistogramSnapshot& h = section->_totalHistogram;
+	_SA.Save("section,%s,,,%lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld,%.1f,%.1f,%lld",
+		identity.c_str(), section->_totalCallCount, section->_totalCostTime, section->_totalCpuTime,
+		h._count, h._min, h.Percentile(50), h.Percentile(90), h.Percentile(99), h.Percentile(99.9),
+		h._max, h.Mean(), h.StdDev(), section->CorrectedCostTime());
+	for (int i = 0; i < PPOS_COUNT; ++i)
+	{
+		_SA.Save(",%lld", section->_totalOsStats[i]);
+	}
+	_SA.Save(",%lld,%lld,%lld,%lld,%lld", section->_totalAllocCount, section->_totalAllocBytes,
+		section->_totalFreeCount, section->_totalFreeBytes, section->_totalPeakNetBytes);
+
+	ResourceStatistics* rs = section->_rsStatistics;
+	if (rs)
+	{
+		ResourceInfo cpuInfo = rs->GetCpuInfo();
+		ResourceInfo memoryInfo = rs->GetMemoryInfo();
+		_SA.Save(",%lld,%lld,%lld,%lld,", cpuInfo._peak, cpuInfo._avg, memoryInfo._peak, memoryInfo._avg);
+	}
+	else
+	{
+		_SA.Save(",,,,,");
+	}
+
+	bool first = true;
+	for (int i = 0; i < HISTOGRAM_BUCKET_COUNT; ++i)
+	{
+		if (h._counts[i] == 0)
+			continue;
+
+		_SA.Save("%s%lld:%lld", first ? "" : ";", HistogramBucketUpperValue(i), h._counts[i]);
+		first = false;
+	}
+	_SA.Save("\n");
+
+	// 线程行，只有计数、时间和操作系统资源
+	for (int i = 0; i < PP_MAX_THREADS; ++i)
+	{
+		PerformanceSlot* slot = section->_slots[i].load(memory_order_acquire);
+		if (slot == NULL)
+			continue;
+
+		_SA.Save("thread,%s,%d,%d,%lld,%lld,%lld,,,,,,,,,,", identity.c_str(),
+			slot->_threadId.load(memory_order_relaxed), slot->_tid.load(memory_order_relaxed),
+			slot->_callCount.load(memory_order_relaxed),
+			slot->_costTime.load(memory_order_relaxed),
+			slot->_cpuTime.load(memory_order_relaxed));
+		for (int j = 0; j < PPOS_COUNT; ++j)
+		{
+			_SA.Save(",%lld", slot->_osStats[j].load(memory_order_relaxed));
+		}
+		_SA.Save(",,,,,,,,,,\n");
+	}
+
+	if (rs == NULL)
+		return;
+
+	// 资源统计段内各线程的CPU
+	ResourceStatistics::ThreadInfoMap threadInfos = rs->GetThreadInfos();
+	ResourceStatistics::ThreadInfoMap::iterator it = threadInfos.begin();
+	for (; it != threadInfos.end(); ++it)
+	{
+		const ResourceInfo& info = it->second._cpuInfo;
+		_SA.Save("resource_thread,%s,,%d,,,,,,,,,,,,,", identity.c_str(), it->first);
+		for (int j = 0; j < PPOS_COUNT; ++j)
+		{
+			_SA.Save(",");
+		}
+		_SA.Save(",,,,,,%lld,%lld,,,\n", info._peak, info._avg);
+	}
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "Performance.h"
+
+//
+// 结构化报告导出
+// 开启PPCO_SAVE_AS_JSON/PPCO_SAVE_AS_CSV后，报告按固定的结构输出，
+// 看板等工具直接解析，不需要用正则表达式抓取文本报告。
+// 时间单位统一为纳秒，内存单位为KB，CPU为百分比。
+// 只允许追加字段，修改或删除已有字段时必须增加PP_REPORT_SCHEMA_VERSION。
+//
+#define PP_REPORT_SCHEMA_VERSION 3
+
+//
+// 报告的进程级信息
+//
+struct ReportHeader
+{
+	int _pid;							// 进程id
+	time_t _beginTime;					// 剖析开始时间
+	const char* _wallTimeSource;		// 墙上时间的计时源
+	PerformanceOverhead _overhead;		// 剖析开销
+};
+
+//
+// JSON报告导出器
+// 顶层为{"schema":"performance_report","version":3,...,"sections":[...]}，
+// 每个剖析段包含汇总值、延迟分布、各线程统计、性能计数器、操作系统资源、
+// 堆分配和资源统计，没有数据的部分数值为0，非资源统计段的resources为null。
+// 延迟分布只输出非空桶，每个桶为[桶内最大值, 计数]。
+//
+class JsonReportExporter
+{
+public:
+	JsonReportExporter(SaveAdapter& SA)
+		:_SA(SA)
+	{}
+
+	// @sections按报告顺序排列，调用方持有Performance的锁
+	void Export(const ReportHeader& header, const vector<PerformanceSection*>& sections);
+
+private:
+	void _ExportSection(PerformanceSection* section);
+	void _ExportHistogram(const HistogramSnapshot& h);
+	void _ExportOsStats(const LongType stats[PPOS_COUNT], LongType callCount);
+	void _ExportResource(const char* name, const ResourceInfo& info);
+
+private:
+	SaveAdapter& _SA;
+};
+
+//
+// CSV报告导出器
+// 第一行为列名，之后每个剖析段一行汇总(scope为section)，
+// 接着是该段各线程的统计(scope为thread)和资源统计段各线程的CPU(scope为resource_thread)，
+// 不适用的列为空。延迟分布在histogram列中，非空桶以"桶内最大值:计数"用分号分隔。
+// thread_id是剖析段使用的线程id(GetThreadId)，只有thread行有；
+// tid是内核线程id，thread行和resource_thread行都有，可按它关联两种行。
+//
+class CsvReportExporter
+{
+public:
+	CsvReportExporter(SaveAdapter& SA)
+		:_SA(SA)
+	{}
+
+	// @sections按报告顺序排列，调用方持有Performance的锁
+	void Export(const vector<PerformanceSection*>& sections);
+
+private:
+	void _ExportSection(PerformanceSection* section);
+
+private:
+	SaveAdapter& _SA;
+};
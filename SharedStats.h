@@ -0,0 +1,312 @@
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <atomic>
+
+#include "Histogram.h"
+
+//
+// 共享内存实时统计区
+// 被剖析进程周期性地把各剖析段的累计值发布到名为/performance_profiler_<pid>的
+// POSIX共享内存中，PerformanceTool等工具只读映射即可查看，不需要向目标进程发送命令。
+// 布局只允许在末尾追加字段，修改已有字段时必须增加PP_SHM_VERSION。
+//
+#define PP_SHM_MAGIC 0x48535050			// "PPSH"
+#define PP_SHM_VERSION 1
+#define PP_SHM_MAX_SECTIONS 256
+#define PP_SHM_NAME_LEN 64
+
+//
+// 统计区登记目录，每个发布统计的进程在其中建立一个以pid命名的文件，
+// 收集器扫描该目录发现被剖析进程，不需要遍历/dev/shm。
+//
+#define PP_SHM_REGISTRY_DIRECTORY "/tmp/performance_profiler/registry"
+
+// 收集器的IPC服务套接字
+#define PP_COLLECTOR_SOCKET_NAME "/tmp/performance_profiler/_collector"
+
+//
+// 剖析段记录，使用顺序锁保护：写入前后各递增一次_seq，
+// 读者读到奇数或前后不一致时重读。
+//
+struct SharedSectionStats
+{
+	std::atomic<uint32_t> _seq;		// 顺序锁序号
+	int32_t _line;					// 行号
+	char _name[PP_SHM_NAME_LEN];		// 描述，为空时为函数名
+	char _function[PP_SHM_NAME_LEN];	// 函数名
+	char _fileName[PP_SHM_NAME_LEN];	// 文件名
+
+	int64_t _callCount;				// 调用次数
+	int64_t _costTime;				// 墙上时间(纳秒)
+	int64_t _cpuTime;				// 线程CPU时间(纳秒)
+	int64_t _cpuPeak;				// 资源统计段的CPU峰值(%)，非资源统计段为-1
+	int64_t _cpuAvg;				// 资源统计段的CPU均值(%)
+	int64_t _memoryPeak;			// 资源统计段的内存峰值(KB)
+	int64_t _memoryAvg;				// 资源统计段的内存均值(KB)
+	int64_t _histogram[HISTOGRAM_BUCKET_COUNT];	// 延迟分布，桶定义见Histogram.h
+};
+
+struct SharedStatsHeader
+{
+	uint32_t _magic;				// PP_SHM_MAGIC
+	uint32_t _version;				// PP_SHM_VERSION
+	uint32_t _headerSize;			// sizeof(SharedStatsHeader)
+	uint32_t _recordSize;			// sizeof(SharedSectionStats)
+	int32_t _pid;					// 进程id
+	int32_t _capacity;				// 最多记录的剖析段数
+	std::atomic<int32_t> _sectionCount;	// 已发布的剖析段数
+	int32_t _reserved;
+	std::atomic<uint64_t> _publishCount;	// 发布次数
+	std::atomic<int64_t> _publishTime;	// 最近发布时的CLOCK_MONOTONIC时间(纳秒)
+	int64_t _beginTime;				// 剖析开始时间(time_t)
+	std::atomic<int64_t> _processCpu;	// 进程CPU使用率(%)
+	std::atomic<int64_t> _processMemory;	// 进程常驻内存(KB)
+	char _exe[256];					// 可执行文件路径
+};
+
+inline void SharedStatsName(int pid, char* name, size_t len)
+{
+	snprintf(name, len, "/performance_profiler_%d", pid);
+}
+
+inline void SharedStatsRegistryPath(int pid, char* path, size_t len)
+{
+	snprintf(path, len, PP_SHM_REGISTRY_DIRECTORY "/%d", pid);
+}
+
+//
+// 共享内存统计区的映射
+//
+class SharedStatsRegion
+{
+public:
+	SharedStatsRegion()
+		:_header(NULL)
+		, _size(0)
+		, _inode(0)
+	{}
+
+	~SharedStatsRegion()
+	{
+		Close();
+	}
+
+	static size_t RegionSize()
+	{
+		return sizeof(SharedStatsHeader) + sizeof(SharedSectionStats) * PP_SHM_MAX_SECTIONS;
+	}
+
+	// 被剖析进程创建统计区
+	bool Create(int pid)
+	{
+		char name[64];
+		SharedStatsName(pid, name, sizeof(name));
+
+		//
+		// 崩溃进程残留的同名统计区可能仍被收集器映射着，就地截断会使收集器读取时收到SIGBUS，
+		// 先删除再独占创建，新进程总是得到新的统计区，收集器按inode发现替换。
+		//
+		shm_unlink(name);
+		int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+		if (fd < 0)
+			return false;
+
+		_size = RegionSize();
+		if (ftruncate(fd, _size) != 0)
+		{
+			close(fd);
+			shm_unlink(name);
+			return false;
+		}
+
+		void* addr = mmap(NULL, _size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (addr == MAP_FAILED)
+		{
+			shm_unlink(name);
+			return false;
+		}
+
+		// ftruncate出的内存已清零，最后写入magic表示初始化完成
+		_header = (SharedStatsHeader*)addr;
+		_header->_version = PP_SHM_VERSION;
+		_header->_headerSize = sizeof(SharedStatsHeader);
+		_header->_recordSize = sizeof(SharedSectionStats);
+		_header->_pid = pid;
+		_header->_capacity = PP_SHM_MAX_SECTIONS;
+
+		ssize_t len = readlink("/proc/self/exe", _header->_exe, sizeof(_header->_exe) - 1);
+		if (len > 0)
+			_header->_exe[len] = '\0';
+
+		std::atomic_thread_fence(std::memory_order_release);
+		_header->_magic = PP_SHM_MAGIC;
+
+		_Register(pid);
+		return true;
+	}
+
+	// 工具进程只读打开统计区
+	bool Open(int pid)
+	{
+		char name[64];
+		SharedStatsName(pid, name, sizeof(name));
+
+		int fd = shm_open(name, O_RDONLY, 0);
+		if (fd < 0)
+			return false;
+
+		struct stat st;
+		if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SharedStatsHeader))
+		{
+			close(fd);
+			return false;
+		}
+
+		_size = st.st_size;
+		_inode = st.st_ino;
+		void* addr = mmap(NULL, _size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (addr == MAP_FAILED)
+			return false;
+
+		_header = (SharedStatsHeader*)addr;
+		if (_header->_magic != PP_SHM_MAGIC || _header->_version != PP_SHM_VERSION
+			|| _header->_recordSize != sizeof(SharedSectionStats)
+			|| _size < RegionSize())
+		{
+			Close();
+			return false;
+		}
+
+		return true;
+	}
+
+	//
+	// 只读打开的统计区是否已被删除或由新的统计区替换。
+	// 同一pid的新进程总是删除旧的统计区后重新创建，名字相同但inode不同，
+	// 已有的映射仍是旧进程的统计。
+	//
+	bool IsReplaced(int pid)
+	{
+		char name[64];
+		SharedStatsName(pid, name, sizeof(name));
+
+		int fd = shm_open(name, O_RDONLY, 0);
+		if (fd < 0)
+			return true;
+
+		struct stat st;
+		bool replaced = fstat(fd, &st) != 0 || st.st_ino != _inode;
+		close(fd);
+		return replaced;
+	}
+
+	void Close()
+	{
+		if (_header)
+		{
+			munmap(_header, _size);
+			_header = NULL;
+		}
+	}
+
+	// 被剖析进程退出时删除统计区和登记文件，收集器也用它清理崩溃进程的残留
+	static void Unlink(int pid)
+	{
+		char name[64];
+		SharedStatsName(pid, name, sizeof(name));
+		shm_unlink(name);
+
+		char path[128];
+		SharedStatsRegistryPath(pid, path, sizeof(path));
+		unlink(path);
+	}
+
+	SharedStatsHeader* Header()
+	{
+		return _header;
+	}
+
+	SharedSectionStats* Section(int index)
+	{
+		SharedSectionStats* sections = (SharedSectionStats*)(_header + 1);
+		return &sections[index];
+	}
+
+	//
+	// 读取一条剖析段记录的一致快照，写入方正在写时重试。
+	// @withHistogram为false时不复制延迟分布，只需要计数的读者用来减少内存访问。
+	//
+	bool ReadSection(int index, SharedSectionStats& stats, bool withHistogram = true)
+	{
+		SharedSectionStats* src = Section(index);
+		size_t size = withHistogram ? sizeof(stats) : offsetof(SharedSectionStats, _histogram);
+		for (int retry = 0; retry < 100; ++retry)
+		{
+			uint32_t seq = src->_seq.load(std::memory_order_acquire);
+			if (seq & 1)
+				continue;
+
+			memcpy((char*)&stats + sizeof(stats._seq), (char*)src + sizeof(src->_seq),
+				size - sizeof(stats._seq));
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (src->_seq.load(std::memory_order_relaxed) == seq)
+				return true;
+		}
+
+		return false;
+	}
+
+	// 写入一条剖析段记录
+	void BeginWrite(int index)
+	{
+		SharedSectionStats* dst = Section(index);
+		dst->_seq.fetch_add(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+
+	void EndWrite(int index)
+	{
+		Section(index)->_seq.fetch_add(1, std::memory_order_release);
+	}
+
+private:
+	//
+	// 在登记目录中登记统计区，文件内容为可执行文件路径，只用于查看。
+	// 登记失败不影响发布，只是收集器发现不了该进程。
+	//
+	void _Register(int pid)
+	{
+		// 目录不存在时创建，多个用户共用目录
+		if (mkdir("/tmp/performance_profiler", 0777) == 0)
+			chmod("/tmp/performance_profiler", 0777);
+		if (mkdir(PP_SHM_REGISTRY_DIRECTORY, 0777) == 0)
+			chmod(PP_SHM_REGISTRY_DIRECTORY, 0777);
+
+		char path[128];
+		SharedStatsRegistryPath(pid, path, sizeof(path));
+		int fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+		if (fd < 0)
+			return;
+
+		// 写失败时保留空文件
+		ssize_t ret = write(fd, _header->_exe, strlen(_header->_exe));
+		(void)ret;
+		close(fd);
+	}
+
+private:
+	SharedStatsHeader* _header;
+	size_t _size;
+	ino_t _inode;			// 只读打开时统计区的inode
+};
@@ -0,0 +1,751 @@
+#include <ucontext.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <set>
+
+#include "StackSampler.h"
+#include "Symbol.h"
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+// 报告中每个剖析段列出的热点函数数
+#define PP_SAMPLER_SECTION_TOP 5
+
+// 定时器信号值中的标记，区分本采样器的定时器和程序自己的SIGPROF定时器
+#define PP_SAMPLER_SIGNAL_TAG 0x5350
+
+static_assert(PP_MAX_THREADS <= 0x10000, "buffer index must fit in 16 bits of the signal value");
+
+// 按下标索引的缓冲区，信号处理函数按信号值中的下标查找，缓冲区不释放
+static atomic<SampleBuffer*> s_sampleBuffers[PP_MAX_THREADS];
+
+// 安装采样器之前的SIGPROF处理方式，不属于采样器的SIGPROF交给它处理
+static struct sigaction s_oldSigProf;
+
+//
+// 内核线程的CPU时钟，即内核中的MAKE_THREAD_CPUCLOCK(tid, CPUCLOCK_SCHED)，
+// 定时器按该线程消耗的CPU时间到期，空闲的线程不会被采样。
+//
+static clockid_t ThreadCpuClock(int tid)
+{
+	return ((~(clockid_t)tid) << 3) | 6;
+}
+
+// 定时器信号值：高32位是分配代数，低32位是标记和缓冲区下标
+static void* EncodeSampleSignal(SampleBuffer* buffer, unsigned generation)
+{
+	uint64_t value = ((uint64_t)generation << 32)
+		| ((uint64_t)PP_SAMPLER_SIGNAL_TAG << 16) | (uint64_t)buffer->_index;
+	return (void*)(uintptr_t)value;
+}
+
+static bool DecodeSampleSignal(siginfo_t* info, SampleBuffer*& buffer, unsigned& generation)
+{
+	if (info->si_code != SI_TIMER)
+		return false;
+
+	uint64_t value = (uintptr_t)info->si_value.sival_ptr;
+	int index = (int)(value & 0xffff);
+	if (((value >> 16) & 0xffff) != PP_SAMPLER_SIGNAL_TAG || index >= PP_MAX_THREADS)
+		return false;
+
+	buffer = s_sampleBuffers[index].load(memory_order_acquire);
+	generation = (unsigned)(value >> 32);
+	return buffer != NULL;
+}
+
+//
+// 沿帧指针回溯被中断的调用栈，第一帧是被中断的指令。
+// 只读取缓冲区记录的栈映射范围内的栈帧，栈指针不在范围内时只记录第一帧，
+// 由采样线程查找栈所在的映射，之后的样本再完整回溯。
+// 栈帧记录是上一层的帧指针和返回地址，帧指针必须向栈底递增。
+//
+static int UnwindStack(SampleBuffer* buffer, void** frames, void* ucontext)
+{
+	uintptr_t pc, sp, fp;
+#if defined(__x86_64__)
+	const mcontext_t& context = ((ucontext_t*)ucontext)->uc_mcontext;
+	pc = context.gregs[REG_RIP];
+	sp = context.gregs[REG_RSP];
+	fp = context.gregs[REG_RBP];
+#elif defined(__aarch64__)
+	const mcontext_t& context = ((ucontext_t*)ucontext)->uc_mcontext;
+	pc = context.pc;
+	sp = context.sp;
+	fp = context.regs[29];
+#else
+	// 其他平台不回溯，样本只计入剖析段
+	return 0;
+#endif
+
+	int depth = 0;
+	frames[depth++] = (void*)pc;
+
+	uintptr_t high = buffer->_stackHigh;
+	if (sp < buffer->_stackLow || sp >= high)
+	{
+		buffer->_unknownSp.store(sp, memory_order_relaxed);
+		return depth;
+	}
+
+	uintptr_t low = sp;
+	while (depth < PP_SAMPLER_MAX_FRAMES)
+	{
+		if (fp < low || fp > high - 2 * sizeof(uintptr_t) || fp % sizeof(uintptr_t))
+			break;
+
+		const uintptr_t* record = (const uintptr_t*)fp;
+		if (record[1] == 0)
+			break;
+
+		frames[depth++] = (void*)record[1];
+		low = fp + 2 * sizeof(uintptr_t);
+		fp = record[0];
+	}
+
+	return depth;
+}
+
+//
+// 不属于采样器的SIGPROF(如setitimer或程序自己的定时器)交给之前的处理函数。
+// 之前是默认处理方式时忽略，默认处理会终止进程，而采样器删除的定时器也可能留下信号。
+//
+static void ChainSigProf(int sig, siginfo_t* info, void* ucontext)
+{
+	if (s_oldSigProf.sa_flags & SA_SIGINFO)
+	{
+		if (s_oldSigProf.sa_sigaction)
+			s_oldSigProf.sa_sigaction(sig, info, ucontext);
+	}
+	else if (s_oldSigProf.sa_handler != SIG_DFL && s_oldSigProf.sa_handler != SIG_IGN)
+	{
+		s_oldSigProf.sa_handler(sig);
+	}
+}
+
+//
+// SIGPROF信号处理函数
+// 缓冲区和分配代数由定时器的sigev_value带入，代数不一致的是已删除定时器遗留的信号，丢弃。
+// 只读写寄存器、栈和预分配的缓冲区，不调用库函数，不等待锁。
+//
+static void OnSigProf(int sig, siginfo_t* info, void* ucontext)
+{
+	SampleBuffer* buffer = NULL;
+	unsigned generation = 0;
+	if (!DecodeSampleSignal(info, buffer, generation))
+	{
+		ChainSigProf(sig, info, ucontext);
+		return;
+	}
+
+	// 采样线程正在回收缓冲区或设置栈范围，或另一个遗留信号正在检查代数
+	if (buffer->_busy.exchange(1))
+		return;
+
+	if (buffer->_generation.load() == generation)
+	{
+		unsigned head = buffer->_head.load(memory_order_relaxed);
+		if (head - buffer->_tail.load(memory_order_acquire) >= PP_SAMPLER_BUFFER_SIZE)
+		{
+			LocalAdd(buffer->_dropped, 1);
+		}
+		else
+		{
+			StackSample& sample = buffer->_samples[head & (PP_SAMPLER_BUFFER_SIZE - 1)];
+			sample._depth = UnwindStack(buffer, sample._frames, ucontext);
+			sample._section = CurrentSection();
+
+			buffer->_head.store(head + 1, memory_order_release);
+		}
+	}
+
+	buffer->_busy.store(0, memory_order_release);
+}
+
+// 采样线程取得缓冲区的独占访问，信号处理函数只持有很短的时间
+static void LockSampleBuffer(SampleBuffer* buffer)
+{
+	while (buffer->_busy.exchange(1))
+	{
+		std::this_thread::yield();
+	}
+}
+
+static void UnlockSampleBuffer(SampleBuffer* buffer)
+{
+	buffer->_busy.store(0, memory_order_release);
+}
+
+static void StopStackSampler()
+{
+	StackSampler::GetInstance()->Stop();
+}
+
+static void RestartStackSamplerInChild()
+{
+	StackSampler::GetInstance()->RestartInChild();
+}
+
+StackSampler::StackSampler()
+	:_running(false)
+	, _frequency(0)
+	, _samplerTid(0)
+	, _sampleCount(0)
+	, _droppedCount(0)
+	, _stop(false)
+	, _sampleThread(&StackSampler::_Sample, this)
+{
+	atexit(StopStackSampler);
+	pthread_atfork(NULL, NULL, RestartStackSamplerInChild);
+}
+
+StackSampler::~StackSampler()
+{
+	Stop();
+}
+
+void StackSampler::Stop()
+{
+	{
+		unique_lock<mutex> lock(_stopMutex);
+		if (_stop)
+			return;
+
+		_stop = true;
+		_condVariable.notify_one();
+	}
+
+	if (_sampleThread.joinable())
+	{
+		_sampleThread.join();
+	}
+}
+
+void StackSampler::RestartInChild()
+{
+	RebuildInChild(_mutex);
+	RebuildInChild(_stopMutex);
+	RebuildInChild(_condVariable);
+	if (_stop)
+		return;
+
+	// 定时器属于父进程，缓冲区回收复用，其中未取出的样本丢弃。
+	// 父进程其他线程的信号处理函数可能在fork时置了_busy，子进程中直接清除
+	auto it = _timers.begin();
+	for (; it != _timers.end(); ++it)
+	{
+		_freeBuffers.push_back(it->second._buffer);
+	}
+	_timers.clear();
+	_running = false;
+	_frequency = 0;
+
+	for (size_t i = 0; i < _buffers.size(); ++i)
+	{
+		SampleBuffer* buffer = _buffers[i];
+		buffer->_busy.store(0, memory_order_relaxed);
+		buffer->_generation.fetch_add(1);
+		buffer->_stackLow = buffer->_stackHigh = 0;
+		buffer->_unknownSp.store(0, memory_order_relaxed);
+		buffer->_tail.store(buffer->_head.load(memory_order_relaxed), memory_order_relaxed);
+		buffer->_droppedSeen = buffer->_dropped.load(memory_order_relaxed);
+	}
+
+	_stacks.clear();
+	_sampleCount = 0;
+	_droppedCount = 0;
+
+	new(&_sampleThread) std::thread(&StackSampler::_Sample, this);
+}
+
+void StackSampler::_Sample()
+{
+	_samplerTid = syscall(SYS_gettid);
+
+	while (1)
+	{
+		{
+			unique_lock<std::mutex> lock(_stopMutex);
+			if (!_stop)
+			{
+				_condVariable.wait_for(lock, std::chrono::milliseconds(PP_SAMPLER_SCAN_PERIOD));
+			}
+
+			if (_stop)
+				break;
+		}
+
+		if (OptionManager::IsEnabled(PPCO_STACK_SAMPLER))
+		{
+			if (!_running)
+				_Start();
+
+			_ScanThreads(OptionManager::GetInstance()->GetStackSampleFrequency());
+			_UpdateStackRanges();
+		}
+		else if (_running)
+		{
+			_Stop();
+		}
+
+		_Drain();
+	}
+
+	if (_running)
+		_Stop();
+
+	_Drain();
+}
+
+void StackSampler::_Start()
+{
+	// 处理函数安装后一直保留，定时器删除后仍可能有信号未处理，
+	// 之前的处理方式保存下来，不属于采样器的SIGPROF交给它处理
+	static bool installed = false;
+	if (!installed)
+	{
+		struct sigaction action;
+		memset(&action, 0, sizeof(action));
+		action.sa_sigaction = OnSigProf;
+		action.sa_flags = SA_SIGINFO | SA_RESTART;
+		sigemptyset(&action.sa_mask);
+		sigaction(SIGPROF, &action, &s_oldSigProf);
+		installed = true;
+	}
+
+	_running = true;
+}
+
+void StackSampler::_Stop()
+{
+	auto it = _timers.begin();
+	for (; it != _timers.end(); ++it)
+	{
+		timer_delete(it->second._timer);
+		_RecycleBuffer(it->second._buffer);
+	}
+
+	_timers.clear();
+	_running = false;
+	_frequency = 0;
+}
+
+void StackSampler::_RecycleBuffer(SampleBuffer* buffer)
+{
+	// 代数加1后等待正在写入的信号处理函数完成，之后的遗留信号检查代数时丢弃
+	buffer->_generation.fetch_add(1);
+	LockSampleBuffer(buffer);
+	buffer->_stackLow = buffer->_stackHigh = 0;
+	buffer->_unknownSp.store(0, memory_order_relaxed);
+	UnlockSampleBuffer(buffer);
+
+	_freeBuffers.push_back(buffer);
+}
+
+bool StackSampler::_ArmTimer(timer_t timer, int frequency)
+{
+	LongType intervalNs = PP_NS_PER_SEC / frequency;
+
+	struct itimerspec spec;
+	spec.it_interval.tv_sec = intervalNs / PP_NS_PER_SEC;
+	spec.it_interval.tv_nsec = intervalNs % PP_NS_PER_SEC;
+	spec.it_value = spec.it_interval;
+
+	return timer_settime(timer, 0, &spec, NULL) == 0;
+}
+
+void StackSampler::_ScanThreads(int frequency)
+{
+	// 采样频率改变后重新设置已有的定时器
+	if (frequency != _frequency)
+	{
+		auto it = _timers.begin();
+		for (; it != _timers.end(); ++it)
+		{
+			_ArmTimer(it->second._timer, frequency);
+		}
+
+		_frequency = frequency;
+	}
+
+	DIR* dir = opendir("/proc/self/task");
+	if (dir == NULL)
+		return;
+
+	set<int> alive;
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != NULL)
+	{
+		int tid = atoi(entry->d_name);
+		if (tid <= 0 || tid == _samplerTid)
+			continue;
+
+		alive.insert(tid);
+		if (_timers.find(tid) != _timers.end())
+			continue;
+
+		SampleBuffer* buffer = NULL;
+		if (_freeBuffers.empty())
+		{
+			// 缓冲区表已满，之后的线程不采样
+			if (_buffers.size() >= PP_MAX_THREADS)
+				continue;
+
+			buffer = new SampleBuffer((int)_buffers.size());
+			s_sampleBuffers[buffer->_index].store(buffer, memory_order_release);
+			unique_lock<mutex> Lock(_mutex);
+			_buffers.push_back(buffer);
+		}
+		else
+		{
+			buffer = _freeBuffers.back();
+			_freeBuffers.pop_back();
+		}
+
+		struct sigevent event;
+		memset(&event, 0, sizeof(event));
+		event.sigev_notify = SIGEV_THREAD_ID;
+		event.sigev_signo = SIGPROF;
+		event.sigev_value.sival_ptr = EncodeSampleSignal(buffer, buffer->_generation.load());
+		event.sigev_notify_thread_id = tid;
+
+		// 线程可能已经退出
+		ThreadTimer timer;
+		timer._buffer = buffer;
+		if (timer_create(ThreadCpuClock(tid), &event, &timer._timer) != 0)
+		{
+			_freeBuffers.push_back(buffer);
+			continue;
+		}
+
+		if (!_ArmTimer(timer._timer, frequency))
+		{
+			timer_delete(timer._timer);
+			_freeBuffers.push_back(buffer);
+			continue;
+		}
+
+		_timers[tid] = timer;
+	}
+
+	closedir(dir);
+
+	// 回收已退出线程的定时器，缓冲区中剩余的样本之后照常取出
+	auto it = _timers.begin();
+	while (it != _timers.end())
+	{
+		if (alive.find(it->first) == alive.end())
+		{
+			timer_delete(it->second._timer);
+			_RecycleBuffer(it->second._buffer);
+			_timers.erase(it++);
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
+
+void StackSampler::_UpdateStackRanges()
+{
+	vector<SampleBuffer*> pending;
+	auto it = _timers.begin();
+	for (; it != _timers.end(); ++it)
+	{
+		if (it->second._buffer->_unknownSp.load(memory_order_relaxed))
+			pending.push_back(it->second._buffer);
+	}
+
+	if (pending.empty())
+		return;
+
+	FILE* maps = fopen("/proc/self/maps", "r");
+	if (maps == NULL)
+		return;
+
+	// 可读的映射，/proc/self/maps按地址升序
+	vector<pair<uintptr_t, uintptr_t> > ranges;
+	char line[512];
+	while (fgets(line, sizeof(line), maps))
+	{
+		unsigned long low, high;
+		char perms[8];
+		if (sscanf(line, "%lx-%lx %7s", &low, &high, perms) == 3 && perms[0] == 'r')
+			ranges.push_back(make_pair((uintptr_t)low, (uintptr_t)high));
+	}
+	fclose(maps);
+
+	for (size_t i = 0; i < pending.size(); ++i)
+	{
+		SampleBuffer* buffer = pending[i];
+		uintptr_t sp = buffer->_unknownSp.load(memory_order_relaxed);
+		auto range = upper_bound(ranges.begin(), ranges.end(),
+			make_pair(sp, (uintptr_t)-1));
+		if (range == ranges.begin() || sp >= (--range)->second)
+		{
+			buffer->_unknownSp.store(0, memory_order_relaxed);
+			continue;
+		}
+
+		LockSampleBuffer(buffer);
+		buffer->_stackLow = range->first;
+		buffer->_stackHigh = range->second;
+		buffer->_unknownSp.store(0, memory_order_relaxed);
+		UnlockSampleBuffer(buffer);
+	}
+}
+
+void StackSampler::_Drain()
+{
+	unique_lock<mutex> Lock(_mutex);
+
+	for (size_t i = 0; i < _buffers.size(); ++i)
+	{
+		SampleBuffer* buffer = _buffers[i];
+		unsigned tail = buffer->_tail.load(memory_order_relaxed);
+		unsigned head = buffer->_head.load(memory_order_acquire);
+		for (; tail != head; ++tail)
+		{
+			const StackSample& sample = buffer->_samples[tail & (PP_SAMPLER_BUFFER_SIZE - 1)];
+			vector<void*> stack(sample._frames, sample._frames + sample._depth);
+			++_stacks[sample._section][stack];
+			++_sampleCount;
+		}
+
+		buffer->_tail.store(tail, memory_order_release);
+
+		LongType dropped = buffer->_dropped.load(memory_order_relaxed);
+		_droppedCount += dropped - buffer->_droppedSeen;
+		buffer->_droppedSeen = dropped;
+	}
+}
+
+void StackSampler::Clear()
+{
+	_Drain();
+
+	unique_lock<mutex> Lock(_mutex);
+	_stacks.clear();
+	_sampleCount = 0;
+	_droppedCount = 0;
+}
+
+void StackSampler::ResolveFrames()
+{
+	_Drain();
+
+	unique_lock<mutex> Lock(_mutex);
+	_ResolveFrames();
+}
+
+void StackSampler::_ResolveFrames()
+{
+	auto it = _stacks.begin();
+	for (; it != _stacks.end(); ++it)
+	{
+		auto stackIt = it->second.begin();
+		for (; stackIt != it->second.end(); ++stackIt)
+		{
+			const vector<void*>& stack = stackIt->first;
+			for (size_t i = 0; i < stack.size(); ++i)
+			{
+				if (_frameNames.find(stack[i]) != _frameNames.end())
+					continue;
+
+				// 叶子帧是被中断的指令，其余是返回地址，减1后才落在调用指令所在的函数内
+				string symbol, module;
+				const char* address = (const char*)stack[i];
+				SymbolResolver::GetInstance()->Resolve(i ? address - 1 : address, symbol, module);
+				_frameNames[stack[i]] = symbol;
+			}
+		}
+	}
+}
+
+static const char* SampleSectionName(PerformanceSection* section)
+{
+	return section ? section->GetName() : "(No Section)";
+}
+
+typedef pair<string, LongType> FunctionCount;
+
+static bool CompareBySamples(const FunctionCount& lhs, const FunctionCount& rhs)
+{
+	return lhs.second > rhs.second;
+}
+
+// 函数的自身样本数和总样本数
+struct FunctionSamples
+{
+	string _name;
+	LongType _self;
+	LongType _total;
+};
+
+// 按自身样本数降序，相同时按总样本数降序，只出现在调用方的函数排在后面
+static bool CompareBySelfSamples(const FunctionSamples& lhs, const FunctionSamples& rhs)
+{
+	if (lhs._self != rhs._self)
+		return lhs._self > rhs._self;
+
+	return lhs._total > rhs._total;
+}
+
+void StackSampler::OutPut(SaveAdapter& SA)
+{
+	_Drain();
+
+	unique_lock<mutex> Lock(_mutex);
+	if (_sampleCount == 0)
+		return;
+
+	_ResolveFrames();
+	map<void*, string>& names = _frameNames;
+
+	// 同名函数(如同一函数的多个返回地址)合并，总样本数每个样本只计一次
+	map<string, LongType> selfCounts;
+	map<string, LongType> totalCounts;
+	vector<pair<PerformanceSection*, LongType> > sectionCounts;
+	map<PerformanceSection*, map<string, LongType> > sectionSelfCounts;
+
+	auto it = _stacks.begin();
+	for (; it != _stacks.end(); ++it)
+	{
+		LongType sectionCount = 0;
+		map<string, LongType>& sectionSelf = sectionSelfCounts[it->first];
+
+		auto stackIt = it->second.begin();
+		for (; stackIt != it->second.end(); ++stackIt)
+		{
+			const vector<void*>& stack = stackIt->first;
+			LongType count = stackIt->second;
+			sectionCount += count;
+			if (stack.empty())
+				continue;
+
+			const string& leaf = names[stack[0]];
+			selfCounts[leaf] += count;
+			sectionSelf[leaf] += count;
+
+			set<string> seen;
+			for (size_t i = 0; i < stack.size(); ++i)
+			{
+				const string& name = names[stack[i]];
+				if (seen.insert(name).second)
+					totalCounts[name] += count;
+			}
+		}
+
+		sectionCounts.push_back(make_pair(it->first, sectionCount));
+	}
+
+	vector<FunctionSamples> functions;
+	auto totalIt = totalCounts.begin();
+	for (; totalIt != totalCounts.end(); ++totalIt)
+	{
+		FunctionSamples function;
+		function._name = totalIt->first;
+		function._self = selfCounts[totalIt->first];
+		function._total = totalIt->second;
+		functions.push_back(function);
+	}
+	sort(functions.begin(), functions.end(), CompareBySelfSamples);
+
+	SA.Save("===================Stack Sampler====================\n\n");
+	SA.Save("Samples:%lld, Dropped:%lld, Frequency:%dHz\n\n",
+		_sampleCount, _droppedCount, OptionManager::GetInstance()->GetStackSampleFrequency());
+
+	double total = (double)_sampleCount;
+	for (size_t i = 0; i < functions.size() && i < PP_SAMPLER_REPORT_TOP; ++i)
+	{
+		const FunctionSamples& function = functions[i];
+		SA.Save("NO%d. Function:%s, Self:%lld(%.2f%%), Total:%lld(%.2f%%)\n",
+			(int)i + 1, function._name.c_str(), function._self, 100 * function._self / total,
+			function._total, 100 * function._total / total);
+	}
+	SA.Save("\n");
+
+	// 按采样时的剖析段列出热点函数
+	for (size_t i = 0; i < sectionCounts.size(); ++i)
+	{
+		PerformanceSection* section = sectionCounts[i].first;
+		SA.Save("Section:%s, Samples:%lld(%.2f%%)\n", SampleSectionName(section),
+			sectionCounts[i].second, 100 * sectionCounts[i].second / total);
+
+		map<string, LongType>& sectionSelf = sectionSelfCounts[section];
+		vector<FunctionCount> sectionFunctions(sectionSelf.begin(), sectionSelf.end());
+		sort(sectionFunctions.begin(), sectionFunctions.end(), CompareBySamples);
+		for (size_t j = 0; j < sectionFunctions.size() && j < PP_SAMPLER_SECTION_TOP; ++j)
+		{
+			SA.Save("  NO%d. Function:%s, Self:%lld\n",
+				(int)j + 1, sectionFunctions[j].first.c_str(), sectionFunctions[j].second);
+		}
+	}
+
+	SA.Save("\n");
+}
+
+static string FoldedName(const string& name)
+{
+	string frame(name);
+	for (size_t i = 0; i < frame.size(); ++i)
+	{
+		if (frame[i] == ';' || frame[i] == '\n')
+			frame[i] = ':';
+	}
+
+	return frame;
+}
+
+void StackSampler::OutPutFolded(SaveAdapter& SA)
+{
+	_Drain();
+
+	unique_lock<mutex> Lock(_mutex);
+
+	_ResolveFrames();
+	map<void*, string>& names = _frameNames;
+
+	// 不同地址解析为相同函数的调用栈合并为一行
+	map<string, LongType> paths;
+
+	auto it = _stacks.begin();
+	for (; it != _stacks.end(); ++it)
+	{
+		string prefix;
+		if (it->first)
+			prefix = "[" + FoldedName(it->first->GetName()) + "];";
+
+		auto stackIt = it->second.begin();
+		for (; stackIt != it->second.end(); ++stackIt)
+		{
+			const vector<void*>& stack = stackIt->first;
+			if (stack.empty())
+				continue;
+
+			// 折叠栈从根到叶子
+			string path = prefix;
+			for (int i = (int)stack.size() - 1; i >= 0; --i)
+			{
+				path += FoldedName(names[stack[i]]);
+				if (i)
+					path += ";";
+			}
+
+			paths[path] += stackIt->second;
+		}
+	}
+
+	auto pathIt = paths.begin();
+	for (; pathIt != paths.end(); ++pathIt)
+	{
+		SA.Save("%s %lld\n", pathIt->first.c_str(), pathIt->second);
+	}
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <signal.h>
+#include <time.h>
+
+#include "Performance.h"
+
+//
+// 栈采样剖析
+// 开启PPCO_STACK_SAMPLER后，采样线程为进程的每个线程创建一个按该线程CPU时间计时的
+// timer_create定时器，到期时向该线程发送SIGPROF，信号处理函数沿帧指针回溯调用栈，
+// 连同当时最内层的活动剖析段写入该线程预分配的缓冲区。
+// 采样线程周期性地取出样本按调用栈汇总，输出热点函数表和折叠栈，
+// 不需要在代码中添加剖析段。
+// 回溯依赖帧指针，被剖析的程序用-fno-omit-frame-pointer编译才能得到完整的调用栈，
+// 省略帧指针的函数的调用方会缺失。
+//
+
+// 每个样本最多记录的栈帧数
+#ifndef PP_SAMPLER_MAX_FRAMES
+#define PP_SAMPLER_MAX_FRAMES 64
+#endif
+
+// 每个线程缓冲区的样本数，必须是2的幂
+#ifndef PP_SAMPLER_BUFFER_SIZE
+#define PP_SAMPLER_BUFFER_SIZE 64
+#endif
+
+// 采样线程取出样本和扫描新线程的周期(毫秒)
+#ifndef PP_SAMPLER_SCAN_PERIOD
+#define PP_SAMPLER_SCAN_PERIOD 100
+#endif
+
+// 报告中列出的热点函数数
+#ifndef PP_SAMPLER_REPORT_TOP
+#define PP_SAMPLER_REPORT_TOP 20
+#endif
+
+//
+// 一次采样，栈帧从被中断的位置(叶子)开始
+//
+struct StackSample
+{
+	PerformanceSection* _section;			// 采样时最内层的活动剖析段
+	int _depth;								// 栈帧数
+	void* _frames[PP_SAMPLER_MAX_FRAMES];	// 栈帧地址
+};
+
+//
+// 线程的样本缓冲区
+// 单生产者单消费者的环形缓冲区：信号处理函数写入，采样线程取出，
+// 写满时丢弃新样本。缓冲区由采样线程预先分配，下标和分配代数随定时器信号传给
+// 信号处理函数，信号处理函数不分配内存也不等待锁。
+// 定时器删除后可能还有已产生的信号未处理，缓冲区因此不释放，回收后给新线程复用；
+// 回收时代数加1，遗留信号带的代数不一致，不再写入已属于其他线程的缓冲区。
+//
+struct SampleBuffer
+{
+	atomic<unsigned> _head;					// 写入位置，只由信号处理函数修改
+	atomic<unsigned> _tail;					// 取出位置，持有StackSampler的_mutex时修改
+	atomic<LongType> _dropped;				// 缓冲区满丢弃的样本数
+	LongType _droppedSeen;					// 采样线程已计入的丢弃数
+	int _index;								// 在缓冲区表中的下标
+	atomic<unsigned> _generation;			// 分配代数，每次回收加1
+	atomic<int> _busy;						// 写入样本、回收或设置栈范围时置1，信号处理函数遇到置1时丢弃样本
+	uintptr_t _stackLow;					// 线程栈所在映射的范围，持有_busy时读写，回溯只读取其中的栈帧
+	uintptr_t _stackHigh;
+	atomic<uintptr_t> _unknownSp;			// 不在栈范围内的栈指针，采样线程据此查找所在的映射
+	StackSample _samples[PP_SAMPLER_BUFFER_SIZE];
+
+	SampleBuffer(int index)
+		:_head(0)
+		, _tail(0)
+		, _dropped(0)
+		, _droppedSeen(0)
+		, _index(index)
+		, _generation(0)
+		, _busy(0)
+		, _stackLow(0)
+		, _stackHigh(0)
+		, _unknownSp(0)
+	{}
+};
+
+class StackSampler : public Singleton<StackSampler>
+{
+	friend class Singleton<StackSampler>;
+public:
+	void Stop();
+
+	//
+	// fork出的子进程中丢弃父进程的样本并重新启动采样线程。
+	// 定时器不会被子进程继承，采样线程重新为子进程的线程创建。
+	//
+	void RestartInChild();
+
+	//
+	// 输出热点函数表和各剖析段的热点函数，没有样本时不输出。
+	// 要读取剖析段名字，调用方持有Performance的锁(见Performance::_OutPutStackSamples)。
+	//
+	void OutPut(SaveAdapter& SA);
+
+	// 输出折叠栈格式(flamegraph.pl可直接读取)，值为样本数，根帧为采样时的剖析段
+	void OutPutFolded(SaveAdapter& SA);
+
+	// 清除已汇总的样本
+	void Clear();
+
+	//
+	// 解析已汇总样本中新出现的栈帧的函数名并缓存。
+	// 加载符号表较慢，在持有Performance的锁输出之前调用，输出时只解析之后新出现的栈帧。
+	//
+	void ResolveFrames();
+
+protected:
+	StackSampler();
+	~StackSampler();
+
+	void _Sample();
+
+	// 安装信号处理函数并开始为各线程创建定时器
+	void _Start();
+
+	// 删除所有定时器，缓冲区回收复用
+	void _Stop();
+
+	// 为新线程创建定时器，回收已退出线程的定时器
+	void _ScanThreads(int frequency);
+
+	// 按@frequency设置定时器周期
+	static bool _ArmTimer(timer_t timer, int frequency);
+
+	// 回收定时器已删除的缓冲区，遗留的信号不再写入
+	void _RecycleBuffer(SampleBuffer* buffer);
+
+	// 为栈指针不在已知范围内的缓冲区从/proc/self/maps查找栈所在的映射
+	void _UpdateStackRanges();
+
+	// 取出各缓冲区的样本汇总到调用栈表
+	void _Drain();
+
+	// 解析各栈帧的函数名到_frameNames，已解析的不再解析，调用方持有_mutex
+	void _ResolveFrames();
+
+private:
+	struct ThreadTimer
+	{
+		timer_t _timer;
+		SampleBuffer* _buffer;
+	};
+
+	typedef map<vector<void*>, LongType> StackCountMap;
+
+	map<int, ThreadTimer> _timers;					// 按内核线程id索引的定时器，只由采样线程访问
+	vector<SampleBuffer*> _freeBuffers;				// 回收的缓冲区，只由采样线程访问
+	bool _running;									// 是否已创建定时器
+	int _frequency;									// 当前定时器的采样频率(Hz)
+	int _samplerTid;								// 采样线程自身的内核线程id，不采样
+
+	mutex _mutex;									// 保护汇总数据和缓冲区的取出
+	vector<SampleBuffer*> _buffers;					// 分配过的所有缓冲区
+	map<PerformanceSection*, StackCountMap> _stacks;	// 按剖析段汇总的调用栈样本数
+	LongType _sampleCount;							// 汇总的样本数
+	LongType _droppedCount;							// 丢弃的样本数
+	map<void*, string> _frameNames;					// 已解析的栈帧函数名
+
+	bool _stop;										// 是否停止
+	mutex _stopMutex;
+	condition_variable _condVariable;
+	std::thread _sampleThread;						// 采样线程
+};
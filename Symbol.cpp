@@ -0,0 +1,214 @@
+#include <dlfcn.h>
+#include <link.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <cxxabi.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Symbol.h"
+
+//
+// ELF符号表中的函数符号
+//
+struct ElfSymbol
+{
+	uintptr_t _value;	// 符号值，位置无关模块为相对加载基址的偏移
+	uintptr_t _size;	// 函数大小
+	string _name;		// 未还原的符号名
+
+	bool operator<(const ElfSymbol& symbol) const
+	{
+		return _value < symbol._value;
+	}
+};
+
+//
+// 模块的函数符号表，按符号值排序
+//
+struct ModuleSymbols
+{
+	bool _relative;					// 位置无关(ET_DYN)时符号值相对加载基址
+	vector<ElfSymbol> _symbols;
+
+	ModuleSymbols()
+		:_relative(true)
+	{}
+
+	// 查找包含@value的函数，没有时返回NULL
+	const char* Find(uintptr_t value) const
+	{
+		ElfSymbol key;
+		key._value = value;
+		auto it = upper_bound(_symbols.begin(), _symbols.end(), key);
+		if (it == _symbols.begin())
+			return NULL;
+
+		--it;
+		if (it->_size && value >= it->_value + it->_size)
+			return NULL;
+
+		return it->_name.c_str();
+	}
+};
+
+// 读取模块文件的函数符号，优先用完整的.symtab，被strip后退回.dynsym
+static void LoadElfSymbols(const char* path, ModuleSymbols& module)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(ElfW(Ehdr)))
+	{
+		close(fd);
+		return;
+	}
+
+	size_t fileSize = st.st_size;
+	void* addr = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED)
+		return;
+
+	const char* base = (const char*)addr;
+	const ElfW(Ehdr)* ehdr = (const ElfW(Ehdr)*)base;
+	if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0
+		|| ehdr->e_shoff == 0
+		|| ehdr->e_shoff + ehdr->e_shnum * sizeof(ElfW(Shdr)) > fileSize)
+	{
+		munmap(addr, fileSize);
+		return;
+	}
+
+	module._relative = (ehdr->e_type == ET_DYN);
+
+	const ElfW(Shdr)* shdrs = (const ElfW(Shdr)*)(base + ehdr->e_shoff);
+	const ElfW(Shdr)* symtab = NULL;
+	for (int i = 0; i < ehdr->e_shnum; ++i)
+	{
+		if (shdrs[i].sh_type == SHT_SYMTAB)
+		{
+			symtab = &shdrs[i];
+			break;
+		}
+
+		if (shdrs[i].sh_type == SHT_DYNSYM)
+			symtab = &shdrs[i];
+	}
+
+	if (symtab && symtab->sh_link < ehdr->e_shnum
+		&& symtab->sh_offset + symtab->sh_size <= fileSize)
+	{
+		const ElfW(Shdr)& strtab = shdrs[symtab->sh_link];
+		const ElfW(Sym)* syms = (const ElfW(Sym)*)(base + symtab->sh_offset);
+		size_t count = symtab->sh_size / sizeof(ElfW(Sym));
+		for (size_t i = 0; i < count && strtab.sh_offset + strtab.sh_size <= fileSize; ++i)
+		{
+			const ElfW(Sym)& sym = syms[i];
+			if (ELF64_ST_TYPE(sym.st_info) != STT_FUNC
+				|| sym.st_shndx == SHN_UNDEF
+				|| sym.st_value == 0
+				|| sym.st_name >= strtab.sh_size)
+				continue;
+
+			ElfSymbol symbol;
+			symbol._value = sym.st_value;
+			symbol._size = sym.st_size;
+			symbol._name = base + strtab.sh_offset + sym.st_name;
+			module._symbols.push_back(symbol);
+		}
+
+		sort(module._symbols.begin(), module._symbols.end());
+	}
+
+	munmap(addr, fileSize);
+}
+
+static string Demangle(const char* name)
+{
+	int status = 0;
+	char* demangled = abi::__cxa_demangle(name, NULL, NULL, &status);
+	if (demangled == NULL)
+		return name;
+
+	string result(demangled);
+	free(demangled);
+	return result;
+}
+
+static void FormatAddress(char* buf, size_t size, const void* address)
+{
+	snprintf(buf, size, "0x%llx", (unsigned long long)(uintptr_t)address);
+}
+
+static void ResetSymbolResolverInChild()
+{
+	SymbolResolver::GetInstance()->ResetInChild();
+}
+
+SymbolResolver::SymbolResolver()
+{
+	pthread_atfork(NULL, NULL, ResetSymbolResolverInChild);
+}
+
+void SymbolResolver::ResetInChild()
+{
+	RebuildInChild(_mutex);
+}
+
+void SymbolResolver::Resolve(const void* address, string& symbol, string& module)
+{
+	char name[32];
+	FormatAddress(name, sizeof(name), address);
+	symbol = name;
+
+	module.clear();
+
+	Dl_info info;
+	if (dladdr(address, &info) == 0 || info.dli_fname == NULL)
+		return;
+
+	// 主程序的模块名是argv[0]，换成/proc/self/exe才能可靠地打开
+	module = info.dli_fname;
+	string path = module;
+	if (path.empty() || path == program_invocation_name)
+		path = "/proc/self/exe";
+
+	unique_lock<mutex> Lock(_mutex);
+	const ModuleSymbols* symbols = _LoadModule(path);
+	uintptr_t value = (uintptr_t)address;
+	if (symbols->_relative)
+		value -= (uintptr_t)info.dli_fbase;
+
+	const char* found = symbols->Find(value);
+	if (found == NULL)
+		found = info.dli_sname;
+
+	if (found)
+	{
+		symbol = Demangle(found);
+		return;
+	}
+
+	// 没有符号时用模块内偏移，可以再用addr2line解析
+	const char* baseName = strrchr(module.c_str(), '/');
+	snprintf(name, sizeof(name), "+0x%llx",
+		(unsigned long long)((uintptr_t)address - (uintptr_t)info.dli_fbase));
+	symbol = string(baseName ? baseName + 1 : module.c_str()) + name;
+}
+
+const ModuleSymbols* SymbolResolver::_LoadModule(const string& path)
+{
+	ModuleSymbols*& module = _modules[path];
+	if (module == NULL)
+	{
+		module = new ModuleSymbols;
+		LoadElfSymbols(path.c_str(), *module);
+	}
+
+	return module;
+}
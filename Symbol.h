@@ -0,0 +1,33 @@
+#pragma once
+
+#include "Performance.h"
+
+struct ModuleSymbols;
+
+//
+// 符号解析
+// 把代码地址解析为还原后的函数名和所在模块，优先读模块文件中完整的.symtab，
+// 被strip后退回.dynsym和dladdr。每个模块的符号表只加载一次。
+// 会加载文件和分配内存，只在输出报告时使用，不能在信号处理函数中调用。
+//
+class SymbolResolver : public Singleton<SymbolResolver>
+{
+	friend class Singleton<SymbolResolver>;
+public:
+	// 解析@address所在函数的符号名和模块，找不到符号时为"模块名+偏移"
+	void Resolve(const void* address, string& symbol, string& module);
+
+	// fork出的子进程中重建锁，fork时可能被父进程的其他线程持有
+	void ResetInChild();
+
+protected:
+	SymbolResolver();
+
+private:
+	// 加载模块的符号表，调用方持有_mutex
+	const ModuleSymbols* _LoadModule(const string& path);
+
+private:
+	mutex _mutex;
+	map<string, ModuleSymbols*> _modules;	// 已加载的模块符号表
+};
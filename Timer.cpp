@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "Timer.h"
+
+bool PerformanceTimer::_useTsc = false;
+uint64_t PerformanceTimer::_tscBase = 0;
+long long PerformanceTimer::_nsBase = 0;
+uint64_t PerformanceTimer::_tscMult = 0;
+
+//
+// 只有constant_tsc和nonstop_tsc都支持时，TSC频率才不随变频和休眠变化，
+// 可以当作墙上时间使用。
+//
+static bool IsTscReliable()
+{
+	FILE* fp = fopen("/proc/cpuinfo", "r");
+	if (fp == NULL)
+	{
+		return false;
+	}
+
+	bool constantTsc = false;
+	bool nonstopTsc = false;
+	char line[4096];
+	while (fgets(line, sizeof(line), fp))
+	{
+		if (strncmp(line, "flags", 5) == 0)
+		{
+			constantTsc = strstr(line, " constant_tsc") != NULL;
+			nonstopTsc = strstr(line, " nonstop_tsc") != NULL;
+			break;
+		}
+	}
+
+	fclose(fp);
+	return constantTsc && nonstopTsc;
+}
+
+void PerformanceTimer::Calibrate()
+{
+#if PP_HAS_TSC
+	static bool calibrated = false;
+	if (calibrated)
+	{
+		return;
+	}
+	calibrated = true;
+
+	if (!IsTscReliable())
+	{
+		return;
+	}
+
+	// 以CLOCK_MONOTONIC为基准，测量10ms内的TSC周期数
+	long long ns0 = MonotonicTimeNs();
+	uint64_t tsc0 = __rdtsc();
+	usleep(10 * 1000);
+	long long ns1 = MonotonicTimeNs();
+	uint64_t tsc1 = __rdtsc();
+
+	if (tsc1 <= tsc0 || ns1 <= ns0)
+	{
+		return;
+	}
+
+	_tscMult = (uint64_t)(((unsigned __int128)(ns1 - ns0) << 32) / (tsc1 - tsc0));
+	_tscBase = tsc1;
+	_nsBase = ns1;
+	_useTsc = true;
+#endif
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <time.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PP_HAS_TSC 1
+#else
+#define PP_HAS_TSC 0
+#endif
+
+#define PP_NS_PER_SEC 1000000000LL
+
+//
+// 高精度计时器
+// 墙上时间优先使用校准后的TSC，CPU不支持恒定TSC时退回CLOCK_MONOTONIC；
+// 线程CPU时间使用CLOCK_THREAD_CPUTIME_ID，只统计调用线程自身消耗的CPU。
+// 两者单位都是纳秒。
+//
+class PerformanceTimer
+{
+public:
+	// 单调的墙上时间(纳秒)
+	static inline long long WallTimeNs()
+	{
+#if PP_HAS_TSC
+		if (_useTsc)
+		{
+			return TscToNs(__rdtsc());
+		}
+#endif
+		return MonotonicTimeNs();
+	}
+
+	// 当前线程的CPU时间(纳秒)
+	static inline long long ThreadCpuTimeNs()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+		return ts.tv_sec * PP_NS_PER_SEC + ts.tv_nsec;
+	}
+
+	static inline long long MonotonicTimeNs()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return ts.tv_sec * PP_NS_PER_SEC + ts.tv_nsec;
+	}
+
+	//
+	// 校准TSC频率，并以CLOCK_MONOTONIC为基准对齐，保证两种时间源可以混用。
+	// 只需调用一次，由Performance构造时调用。
+	//
+	static void Calibrate();
+
+	// 墙上时间是否使用TSC
+	static bool IsTscEnabled()
+	{
+		return _useTsc;
+	}
+
+	// 当前墙上时间源名称
+	static const char* WallTimeSource()
+	{
+		return _useTsc ? "TSC" : "CLOCK_MONOTONIC";
+	}
+
+private:
+#if PP_HAS_TSC
+	static inline long long TscToNs(uint64_t tsc)
+	{
+		// 核间TSC偏差或校准前的读数可能小于基准，按无符号相减会变成极大的时间，钳位到基准
+		int64_t cycles = (int64_t)(tsc - _tscBase);
+		if (cycles < 0)
+			cycles = 0;
+
+		unsigned __int128 delta = (unsigned __int128)cycles * _tscMult;
+		return _nsBase + (long long)(delta >> 32);
+	}
+#endif
+
+private:
+	static bool _useTsc;			// 是否使用TSC
+	static uint64_t _tscBase;		// 校准时的TSC
+	static long long _nsBase;		// 校准时的CLOCK_MONOTONIC时间
+	static uint64_t _tscMult;		// 每个TSC周期的纳秒数，32位定点小数
+};
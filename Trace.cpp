@@ -0,0 +1,127 @@
+#include "Trace.h"
+
+// 各线程序号的追踪缓冲区，序号复用时继续使用
+static atomic<TraceRing*> s_traceRings[PP_MAX_THREADS];
+
+TraceRing* GetTraceRing(PerformanceThreadContext* context)
+{
+	atomic<TraceRing*>& ring = s_traceRings[context->_index];
+	TraceRing* traceRing = ring.load(memory_order_acquire);
+	if (traceRing == NULL)
+	{
+		traceRing = new TraceRing;
+		ring.store(traceRing, memory_order_release);
+	}
+
+	return traceRing;
+}
+
+void TraceRing::Snapshot(vector<Event>& events)
+{
+	LongType head = _head.load(memory_order_acquire);
+	LongType begin = head > PP_TRACE_RING_SIZE ? head - PP_TRACE_RING_SIZE : 0;
+
+	vector<Event> copied;
+	copied.reserve(head - begin);
+	for (LongType i = begin; i < head; ++i)
+	{
+		const TraceEvent& event = _events[i & (PP_TRACE_RING_SIZE - 1)];
+		Event e;
+		e._time = event._time.load(memory_order_relaxed);
+		int sectionId = event._sectionId.load(memory_order_relaxed);
+		e._sectionId = sectionId >> 1;
+		e._isEnd = (sectionId & 1) != 0;
+		e._tid = event._tid.load(memory_order_relaxed);
+		copied.push_back(e);
+	}
+
+	//
+	// 拷贝期间写入线程追上来覆盖的事件不再可信。
+	// 写入线程在发布newHead + 1之前先写newHead所在的位置，即事件newHead - PP_TRACE_RING_SIZE，
+	// 它可能正被覆盖，也一并丢弃。
+	//
+	atomic_thread_fence(memory_order_acquire);
+	LongType newHead = _head.load(memory_order_relaxed);
+	LongType valid = newHead + 1 > PP_TRACE_RING_SIZE ? newHead + 1 - PP_TRACE_RING_SIZE : 0;
+	size_t skip = valid > begin ? (size_t)(valid - begin) : 0;
+	if (skip > copied.size())
+		skip = copied.size();
+
+	events.insert(events.end(), copied.begin() + skip, copied.end());
+}
+
+string EscapeJson(const char* str)
+{
+	string escaped;
+	for (; *str; ++str)
+	{
+		unsigned char ch = *str;
+		if (ch == '"' || ch == '\\')
+		{
+			escaped += '\\';
+			escaped += ch;
+		}
+		else if (ch < 0x20)
+		{
+			char buf[8];
+			snprintf(buf, sizeof(buf), "\\u%04x", ch);
+			escaped += buf;
+		}
+		else
+		{
+			escaped += ch;
+		}
+	}
+
+	return escaped;
+}
+
+void ChromeTraceExporter::Export(const vector<PerformanceSection*>& sections)
+{
+	int pid = getpid();
+	bool first = true;
+
+	_SA.Save("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+	for (int i = 0; i < PP_MAX_THREADS; ++i)
+	{
+		TraceRing* ring = s_traceRings[i].load(memory_order_acquire);
+		if (ring == NULL)
+			continue;
+
+		vector<TraceRing::Event> events;
+		ring->Snapshot(events);
+
+		//
+		// 缓冲区开头可能是开始事件已被覆盖的结束事件，
+		// 按线程记录嵌套深度，丢弃这些不匹配的结束事件。
+		//
+		map<int, int> depths;
+		for (size_t j = 0; j < events.size(); ++j)
+		{
+			const TraceRing::Event& e = events[j];
+			if (e._sectionId < 0 || e._sectionId >= (int)sections.size())
+				continue;
+
+			int& depth = depths[e._tid];
+			if (e._isEnd)
+			{
+				if (depth == 0)
+					continue;
+				--depth;
+			}
+			else
+			{
+				++depth;
+			}
+
+			_SA.Save("%s{\"name\":\"%s\",\"cat\":\"section\",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d}",
+				first ? "" : ",\n",
+				EscapeJson(sections[e._sectionId]->GetName()).c_str(),
+				e._isEnd ? "E" : "B", e._time / 1000.0, pid, e._tid);
+			first = false;
+		}
+	}
+
+	_SA.Save("\n]}\n");
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "Performance.h"
+
+//
+// 追踪环形缓冲区的事件个数，必须是2的幂。
+//
+#ifndef PP_TRACE_RING_SIZE
+#define PP_TRACE_RING_SIZE 16384
+#endif
+
+//
+// 追踪事件，16字节。
+// 所有字段只由所属线程写入，导出线程可能读到正在被覆盖的事件，
+// 由TraceRing::Snapshot根据写入位置丢弃。
+//
+struct TraceEvent
+{
+	atomic<LongType> _time;		// 墙上时间(纳秒)
+	atomic<int> _sectionId;		// 剖析段id，最低位为1表示结束事件
+	atomic<int> _tid;			// 内核线程id
+};
+
+//
+// 每个线程序号一个追踪环形缓冲区，写满后覆盖最旧的事件。
+// 写入不加锁也不分配内存，只有所属线程写入。
+//
+class TraceRing
+{
+public:
+	TraceRing()
+		:_head(0)
+	{}
+
+	void Append(LongType time, int sectionId, bool isEnd, int tid)
+	{
+		LongType head = _head.load(memory_order_relaxed);
+		TraceEvent& event = _events[head & (PP_TRACE_RING_SIZE - 1)];
+		event._time.store(time, memory_order_relaxed);
+		event._sectionId.store(sectionId << 1 | (isEnd ? 1 : 0), memory_order_relaxed);
+		event._tid.store(tid, memory_order_relaxed);
+		_head.store(head + 1, memory_order_release);
+	}
+
+	//
+	// 拷贝缓冲区中仍然有效的事件，按写入顺序排列。
+	// 拷贝过程中被覆盖的事件会被丢弃。
+	//
+	struct Event
+	{
+		LongType _time;
+		int _sectionId;
+		bool _isEnd;
+		int _tid;
+	};
+	void Snapshot(vector<Event>& events);
+
+private:
+	atomic<LongType> _head;					// 下一个写入位置
+	TraceEvent _events[PP_TRACE_RING_SIZE];	// 事件
+};
+
+// 获取当前线程的追踪缓冲区，第一次使用时分配
+TraceRing* GetTraceRing(PerformanceThreadContext* context);
+
+// JSON字符串转义
+string EscapeJson(const char* str);
+
+//
+// Chrome trace-event格式导出器，生成的JSON可以用chrome://tracing或
+// Perfetto(ui.perfetto.dev)直接打开。
+//
+class ChromeTraceExporter
+{
+public:
+	ChromeTraceExporter(SaveAdapter& SA)
+		:_SA(SA)
+	{}
+
+	// @sections是按剖析段id索引的剖析段表
+	void Export(const vector<PerformanceSection*>& sections);
+
+private:
+	SaveAdapter& _SA;
+};
@@ -0,0 +1,466 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <functional>
+
+#include "../Performance.h"
+
+using namespace std;
+
+//
+// 剖析库自身热路径的微基准测试
+// 每个用例在1~64个线程上各运行一次，结果写成JSON，可与保存的基线比较。
+//
+
+#define BENCH_FILE "Benchmark.cpp"
+
+struct BenchOptions
+{
+	LongType _iterations;		// 每个线程的操作次数
+	int _maxThreads;			// 最大线程数
+	const char* _output;		// 结果文件
+	const char* _baseline;		// 基线文件，为NULL不比较
+	double _threshold;			// 判定为变慢的百分比
+};
+
+struct BenchResult
+{
+	string _name;				// 用例名
+	int _threads;				// 线程数
+	LongType _iterations;		// 每个线程的操作次数
+	double _nsPerOp;			// 各线程平均每次操作的纳秒数
+	double _opsPerSec;			// 所有线程合计的每秒操作数
+};
+
+// 用例主体，@threadIndex是线程序号，执行@iterations次操作
+typedef function<void(int threadIndex, LongType iterations)> BenchBody;
+
+static vector<BenchResult> s_results;
+
+//
+// 在@threads个线程上同时执行用例主体。
+// 所有线程就绪后一起开始，每个线程各自计时。
+//
+static void RunBench(const char* name, int threads, LongType iterations,
+	const BenchBody& body)
+{
+	atomic<int> ready(0);
+	atomic<bool> start(false);
+	vector<LongType> costs(threads, 0);
+	vector<thread> workers;
+
+	for (int i = 0; i < threads; ++i)
+	{
+		workers.push_back(thread([&, i]()
+		{
+			++ready;
+			while (!start.load(memory_order_acquire))
+				this_thread::yield();
+
+			LongType begin = PerformanceTimer::MonotonicTimeNs();
+			body(i, iterations);
+			costs[i] = PerformanceTimer::MonotonicTimeNs() - begin;
+		}));
+	}
+
+	while (ready.load() < threads)
+		this_thread::yield();
+
+	LongType begin = PerformanceTimer::MonotonicTimeNs();
+	start.store(true, memory_order_release);
+	for (size_t i = 0; i < workers.size(); ++i)
+	{
+		workers[i].join();
+	}
+	LongType wallTime = PerformanceTimer::MonotonicTimeNs() - begin;
+
+	double totalCost = 0;
+	for (int i = 0; i < threads; ++i)
+	{
+		totalCost += costs[i];
+	}
+
+	BenchResult result;
+	result._name = name;
+	result._threads = threads;
+	result._iterations = iterations;
+	result._nsPerOp = totalCost / threads / iterations;
+	result._opsPerSec = wallTime ? (double)threads * iterations * PP_NS_PER_SEC / wallTime : 0;
+	s_results.push_back(result);
+
+	printf("%-28s threads:%-3d ns/op:%10.1f  ops/s:%14.0f\n",
+		name, threads, result._nsPerOp, result._opsPerSec);
+	fflush(stdout);
+}
+
+static PerformanceSection* CreateBenchSection(const char* function, int line,
+	bool isStatistics = false)
+{
+	return Performance::GetInstance()->CreateSection(BENCH_FILE, function, line, "", isStatistics);
+}
+
+static void Recurse(PerformanceSection* section, int threadId, int depth)
+{
+	section->Begin(threadId);
+	if (depth > 1)
+		Recurse(section, threadId, depth - 1);
+	section->End(threadId);
+}
+
+static void __attribute__((noinline)) MacroSection()
+{
+	PERFORMANCE_EE_BEGIN(BenchMacro, "macro");
+	PERFORMANCE_EE_END(BenchMacro);
+}
+
+static void __attribute__((noinline)) ScopeSection()
+{
+	PERFORMANCE_SCOPE("scope");
+}
+
+static void RunAllBench(const BenchOptions& options)
+{
+	LongType iterations = options._iterations;
+
+	vector<int> threadCounts;
+	for (int threads = 1; threads <= options._maxThreads; threads *= 2)
+	{
+		threadCounts.push_back(threads);
+	}
+
+	for (size_t t = 0; t < threadCounts.size(); ++t)
+	{
+		int threads = threadCounts[t];
+
+		// 各线程使用自己的剖析段
+		vector<PerformanceSection*> privates;
+		for (int i = 0; i < threads; ++i)
+		{
+			privates.push_back(CreateBenchSection("private", i));
+		}
+		RunBench("begin_end_private", threads, iterations,
+			[&](int index, LongType n)
+		{
+			PerformanceSection* section = privates[index];
+			int threadId = GetThreadId();
+			for (LongType i = 0; i < n; ++i)
+			{
+				section->Begin(threadId);
+				section->End(threadId);
+			}
+		});
+
+		// 所有线程共用一个剖析段
+		PerformanceSection* shared = CreateBenchSection("shared", 0);
+		RunBench("begin_end_shared", threads, iterations,
+			[&](int, LongType n)
+		{
+			int threadId = GetThreadId();
+			for (LongType i = 0; i < n; ++i)
+			{
+				shared->Begin(threadId);
+				shared->End(threadId);
+			}
+		});
+
+		// 每64次调用计时一次
+		PerformanceSection* sampled = CreateBenchSection("sampled", 0)->SetSampling(64, PPSM_EVERY_NTH);
+		RunBench("begin_end_sampled_64", threads, iterations,
+			[&](int, LongType n)
+		{
+			int threadId = GetThreadId();
+			for (LongType i = 0; i < n; ++i)
+			{
+				sampled->Begin(threadId);
+				sampled->End(threadId);
+			}
+		});
+
+		// 三层嵌套，每次操作包含三对Begin/End
+		PerformanceSection* outer = CreateBenchSection("nested", 0);
+		PerformanceSection* middle = CreateBenchSection("nested", 1);
+		PerformanceSection* inner = CreateBenchSection("nested", 2);
+		RunBench("nested_3", threads, iterations,
+			[&](int, LongType n)
+		{
+			int threadId = GetThreadId();
+			for (LongType i = 0; i < n; ++i)
+			{
+				outer->Begin(threadId);
+				middle->Begin(threadId);
+				inner->Begin(threadId);
+				inner->End(threadId);
+				middle->End(threadId);
+				outer->End(threadId);
+			}
+		});
+
+		// 递归8层，每次操作包含八对Begin/End
+		PerformanceSection* recursive = CreateBenchSection("recursive", 0);
+		RunBench("recursive_8", threads, iterations,
+			[&](int, LongType n)
+		{
+			int threadId = GetThreadId();
+			for (LongType i = 0; i < n; ++i)
+			{
+				Recurse(recursive, threadId, 8);
+			}
+		});
+
+		// 用户代码实际使用的宏
+		RunBench("macro_begin_end", threads, iterations,
+			[&](int, LongType n)
+		{
+			for (LongType i = 0; i < n; ++i)
+			{
+				MacroSection();
+			}
+		});
+
+		RunBench("scope", threads, iterations,
+			[&](int, LongType n)
+		{
+			for (LongType i = 0; i < n; ++i)
+			{
+				ScopeSection();
+			}
+		});
+
+		// 资源统计段
+		vector<PerformanceSection*> rsPrivates;
+		for (int i = 0; i < threads; ++i)
+		{
+			rsPrivates.push_back(CreateBenchSection("rs_private", i, true));
+		}
+		RunBench("rs_private", threads, iterations,
+			[&](int index, LongType n)
+		{
+			PerformanceSection* section = rsPrivates[index];
+			int threadId = GetThreadId();
+			for (LongType i = 0; i < n; ++i)
+			{
+				section->Begin(threadId);
+				section->End(threadId);
+			}
+		});
+
+		PerformanceSection* rsShared = CreateBenchSection("rs_shared", 0, true);
+		RunBench("rs_shared", threads, iterations,
+			[&](int, LongType n)
+		{
+			int threadId = GetThreadId();
+			for (LongType i = 0; i < n; ++i)
+			{
+				rsShared->Begin(threadId);
+				rsShared->End(threadId);
+			}
+		});
+
+		// 查找已存在的剖析段
+		RunBench("create_section_lookup", threads, iterations,
+			[&](int, LongType n)
+		{
+			for (LongType i = 0; i < n; ++i)
+			{
+				CreateBenchSection("shared", 0);
+			}
+		});
+
+		// 另一个线程不停地生成报告时查找剖析段
+		int flag = OptionManager::GetInstance()->GetOptions();
+		SET_PERFORMANCE_OPTIONS(PPCO_PROFILER | PPCO_SAVE_TO_FILE);
+		atomic<bool> stop(false);
+		thread reporter([&]()
+		{
+			while (!stop.load())
+			{
+				Performance::OutPut();
+			}
+		});
+		RunBench("create_during_report", threads, iterations,
+			[&](int, LongType n)
+		{
+			for (LongType i = 0; i < n; ++i)
+			{
+				CreateBenchSection("shared", 0);
+			}
+		});
+		stop = true;
+		reporter.join();
+		SET_PERFORMANCE_OPTIONS(flag);
+	}
+
+	//
+	// 新建剖析段，每个剖析段都要分配内存并插入注册表。
+	// 放在最后，避免大量剖析段拖慢前面生成报告的用例。
+	//
+	int line = 0;
+	for (size_t t = 0; t < threadCounts.size(); ++t)
+	{
+		int threads = threadCounts[t];
+		LongType count = max(1LL, 1000LL / threads);
+		int base = line;
+		line += threads * count;
+
+		RunBench("create_section_new", threads, count,
+			[&](int index, LongType n)
+		{
+			int first = base + index * n;
+			for (LongType i = 0; i < n; ++i)
+			{
+				CreateBenchSection("new", first + i);
+			}
+		});
+	}
+}
+
+static bool WriteResults(const char* fileName)
+{
+	FILE* fp = fopen(fileName, "w");
+	if (fp == NULL)
+	{
+		printf("Open %s failed.\n", fileName);
+		return false;
+	}
+
+	fprintf(fp, "{\"version\":1,\"wallTimeSource\":\"%s\",\"cpus\":%u,\"results\":[\n",
+		PerformanceTimer::WallTimeSource(), thread::hardware_concurrency());
+
+	// 每行一个结果，方便比较时逐行解析
+	for (size_t i = 0; i < s_results.size(); ++i)
+	{
+		const BenchResult& r = s_results[i];
+		fprintf(fp, "{\"name\":\"%s\",\"threads\":%d,\"iterations\":%lld,\"nsPerOp\":%.2f,\"opsPerSec\":%.0f}%s\n",
+			r._name.c_str(), r._threads, r._iterations, r._nsPerOp, r._opsPerSec,
+			i + 1 < s_results.size() ? "," : "");
+	}
+
+	fprintf(fp, "]}\n");
+	fclose(fp);
+	return true;
+}
+
+static bool ReadResults(const char* fileName, vector<BenchResult>& results)
+{
+	FILE* fp = fopen(fileName, "r");
+	if (fp == NULL)
+	{
+		printf("Open %s failed.\n", fileName);
+		return false;
+	}
+
+	char line[1024];
+	while (fgets(line, sizeof(line), fp))
+	{
+		char name[128];
+		BenchResult r;
+		if (sscanf(line, "{\"name\":\"%127[^\"]\",\"threads\":%d,\"iterations\":%lld,\"nsPerOp\":%lf",
+			name, &r._threads, &r._iterations, &r._nsPerOp) == 4)
+		{
+			r._name = name;
+			r._opsPerSec = 0;
+			results.push_back(r);
+		}
+	}
+
+	fclose(fp);
+	return true;
+}
+
+//
+// 与基线比较，返回变慢超过阈值的用例数
+//
+static int CompareBaseline(const char* fileName, double threshold)
+{
+	vector<BenchResult> baseline;
+	if (!ReadResults(fileName, baseline))
+		return -1;
+
+	int regressions = 0;
+	printf("\n%-28s %-7s %12s %12s %9s\n", "name", "threads", "baseline", "current", "delta");
+	for (size_t i = 0; i < s_results.size(); ++i)
+	{
+		const BenchResult& current = s_results[i];
+		for (size_t j = 0; j < baseline.size(); ++j)
+		{
+			const BenchResult& base = baseline[j];
+			if (base._name != current._name || base._threads != current._threads)
+				continue;
+
+			double delta = base._nsPerOp > 0
+				? (current._nsPerOp - base._nsPerOp) * 100.0 / base._nsPerOp : 0.0;
+			bool regression = delta > threshold;
+			if (regression)
+				++regressions;
+
+			printf("%-28s %-7d %12.1f %12.1f %+8.1f%%%s\n", current._name.c_str(),
+				current._threads, base._nsPerOp, current._nsPerOp, delta,
+				regression ? "  REGRESSION" : "");
+			break;
+		}
+	}
+
+	printf("\n%d regression(s) over %.1f%%.\n", regressions, threshold);
+	return regressions;
+}
+
+void UsageHelp()
+{
+	printf("Usage: Benchmark [-iterations n] [-threads n] [-output file]"
+		" [-baseline file] [-threshold percent]\n");
+	printf("  -iterations  operations per thread for each case, default 10000.\n");
+	printf("  -threads     max thread count, runs 1,2,4... up to it, default 64.\n");
+	printf("  -output      result JSON file, default benchmark.json.\n");
+	printf("  -baseline    compare with a stored result, exit 1 on regression.\n");
+	printf("  -threshold   slowdown percent treated as regression, default 10.\n");
+	exit(0);
+}
+
+int main(int argc, char** argv)
+{
+	BenchOptions options;
+	options._iterations = 10000;
+	options._maxThreads = 64;
+	options._output = "benchmark.json";
+	options._baseline = NULL;
+	options._threshold = 10.0;
+
+	for (int i = 1; i < argc; i += 2)
+	{
+		if (i + 1 >= argc)
+			UsageHelp();
+
+		if (!strcmp(argv[i], "-iterations"))
+			options._iterations = atoll(argv[i + 1]);
+		else if (!strcmp(argv[i], "-threads"))
+			options._maxThreads = atoi(argv[i + 1]);
+		else if (!strcmp(argv[i], "-output"))
+			options._output = argv[i + 1];
+		else if (!strcmp(argv[i], "-baseline"))
+			options._baseline = argv[i + 1];
+		else if (!strcmp(argv[i], "-threshold"))
+			options._threshold = atof(argv[i + 1]);
+		else
+			UsageHelp();
+	}
+
+	if (options._iterations <= 0 || options._maxThreads <= 0)
+		UsageHelp();
+
+	// 只剖析，退出时不输出报告
+	SET_PERFORMANCE_OPTIONS(PPCO_PROFILER);
+
+	RunAllBench(options);
+
+	if (!WriteResults(options._output))
+		return 1;
+
+	if (options._baseline && CompareBaseline(options._baseline, options._threshold) != 0)
+		return 1;
+
+	return 0;
+}
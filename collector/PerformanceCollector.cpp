@@ -0,0 +1,599 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <dirent.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+using namespace std;
+
+#include "../IPCManager.h"
+#include "../SharedStats.h"
+
+//
+// 本机剖析数据收集器
+// 扫描登记目录发现开启了PPCO_PUBLISH_SHM的进程，只读映射它们的共享内存统计区，
+// 按可执行文件和剖析段合并各进程的统计(包括延迟分布)，
+// 通过IPC服务提供合并视图，PerformanceTool -collector连接查看。
+// 收集周期内只读取统计区头和各剖析段的计数，延迟分布在查看时才合并，
+// 收集器的开销与进程数和剖析段数成正比，与被剖析进程的调用频率无关。
+//
+
+// 默认收集周期(毫秒)
+#define PP_COLLECTOR_PERIOD 1000
+
+// 报告中每个程序列出的剖析段数
+#define PP_COLLECTOR_REPORT_TOP 30
+
+//
+// 合并后的剖析段统计
+//
+struct MergedSection
+{
+	string _name;							// 描述
+	string _location;						// 文件名:行号
+	long long _callCount;					// 调用次数
+	long long _costTime;					// 墙上时间(纳秒)
+	long long _cpuTime;						// 线程CPU时间(纳秒)
+	int _processCount;						// 包含该剖析段的进程数
+	long long _histogram[HISTOGRAM_BUCKET_COUNT];	// 延迟分布
+
+	MergedSection()
+	{
+		Reset();
+	}
+
+	void Reset()
+	{
+		_callCount = _costTime = _cpuTime = 0;
+		_processCount = 0;
+		memset(_histogram, 0, sizeof(_histogram));
+	}
+
+	void Add(const SharedSectionStats& stats)
+	{
+		if (_name.empty())
+		{
+			_name = stats._name;
+			_location = string(stats._fileName) + ":" + to_string((long long)stats._line);
+		}
+
+		_callCount += stats._callCount;
+		_costTime += stats._costTime;
+		_cpuTime += stats._cpuTime;
+		for (int i = 0; i < HISTOGRAM_BUCKET_COUNT; ++i)
+		{
+			_histogram[i] += stats._histogram[i];
+		}
+	}
+
+	void Add(const MergedSection& section)
+	{
+		if (_name.empty())
+		{
+			_name = section._name;
+			_location = section._location;
+		}
+
+		_callCount += section._callCount;
+		_costTime += section._costTime;
+		_cpuTime += section._cpuTime;
+		for (int i = 0; i < HISTOGRAM_BUCKET_COUNT; ++i)
+		{
+			_histogram[i] += section._histogram[i];
+		}
+	}
+};
+
+// 剖析段在不同进程中的下标可能不同，按描述、文件名和行号合并
+static string SectionKey(const SharedSectionStats& stats)
+{
+	string key = stats._name;
+	key += '|';
+	key += stats._fileName;
+	key += ':';
+	key += to_string((long long)stats._line);
+	return key;
+}
+
+//
+// 被收集的进程
+//
+struct CollectedProcess
+{
+	int _pid;
+	string _binary;							// 可执行文件路径
+	SharedStatsRegion _region;				// 只读映射的统计区
+	uint64_t _publishCount;					// 上次收集时的发布次数
+	vector<string> _keys;					// 按剖析段下标索引的合并键，空表示尚未发布
+
+	CollectedProcess(int pid)
+		:_pid(pid)
+		, _publishCount(0)
+	{}
+};
+
+//
+// 剖析段的调用速率
+//
+struct SectionRate
+{
+	long long _lastCallCount;				// 上个收集周期的合并调用次数
+	double _rate;							// 每秒调用次数
+
+	SectionRate()
+		:_lastCallCount(-1)
+		, _rate(0)
+	{}
+};
+
+//
+// 同一可执行文件的所有进程
+//
+struct BinaryStats
+{
+	vector<CollectedProcess*> _processes;	// 存活的进程
+	int _exitedCount;						// 已退出的进程数
+	map<string, MergedSection> _retired;	// 已退出进程的最终统计
+	map<string, SectionRate> _rates;		// 按合并键索引的调用速率
+
+	BinaryStats()
+		:_exitedCount(0)
+	{}
+};
+
+class PerformanceCollector
+{
+public:
+	PerformanceCollector(int period)
+		:_period(period)
+		, _collectCount(0)
+		, _lastCollectTime(0)
+		, _server(PP_COLLECTOR_SOCKET_NAME)
+	{}
+
+	~PerformanceCollector()
+	{
+		map<int, CollectedProcess*>::iterator it = _processes.begin();
+		for (; it != _processes.end(); ++it)
+		{
+			delete it->second;
+		}
+	}
+
+	// 收集循环，收到SIGINT或SIGTERM时返回
+	void Run()
+	{
+		if (!_server.Listen())
+			return;
+
+		std::thread serverThread(&IPCServer::Run, &_server,
+			IPCServer::MsgHandler(std::bind(&PerformanceCollector::OnCommand, this,
+			std::placeholders::_1, std::placeholders::_2)));
+
+		printf("%s Performance Collector Start\n", PP_COLLECTOR_SOCKET_NAME);
+
+		sigset_t signals;
+		sigemptyset(&signals);
+		sigaddset(&signals, SIGINT);
+		sigaddset(&signals, SIGTERM);
+
+		while (1)
+		{
+			Collect();
+
+			struct timespec timeout;
+			timeout.tv_sec = _period / 1000;
+			timeout.tv_nsec = (_period % 1000) * 1000000L;
+			int sig = sigtimedwait(&signals, NULL, &timeout);
+			if (sig == SIGINT || sig == SIGTERM)
+				break;
+		}
+
+		_server.Stop();
+		serverThread.join();
+		_server.Close();
+
+		printf("Performance Collector Exit\n");
+	}
+
+	// 一个收集周期：发现新进程，回收已退出的进程，更新调用速率
+	void Collect()
+	{
+		unique_lock<mutex> Lock(_mutex);
+
+		_ScanRegistry();
+
+		map<int, CollectedProcess*>::iterator it = _processes.begin();
+		while (it != _processes.end())
+		{
+			CollectedProcess* process = it->second;
+			if (kill(process->_pid, 0) != 0 && errno == ESRCH)
+			{
+				_Retire(process, true);
+				_processes.erase(it++);
+				continue;
+			}
+
+			// pid已被新进程复用，新进程的统计区在下个周期扫描登记目录时打开
+			if (process->_region.IsReplaced(process->_pid))
+			{
+				_Retire(process, false);
+				_processes.erase(it++);
+				continue;
+			}
+
+			_Update(process);
+			++it;
+		}
+
+		_UpdateRates();
+		++_collectCount;
+	}
+
+	void OnCommand(const string& msg, string& reply)
+	{
+		unique_lock<mutex> Lock(_mutex);
+
+		if (msg == "state")
+			_State(reply);
+		else if (msg == "list")
+			_List(reply);
+		else if (msg == "processes")
+			_Processes(reply);
+		else if (msg == "report")
+			_Report(reply);
+		else
+			reply = "Invalid Command";
+	}
+
+protected:
+	// 扫描登记目录，映射新进程的统计区
+	void _ScanRegistry()
+	{
+		DIR* dir = opendir(PP_SHM_REGISTRY_DIRECTORY);
+		if (dir == NULL)
+			return;
+
+		struct dirent* entry;
+		while ((entry = readdir(dir)) != NULL)
+		{
+			int pid = atoi(entry->d_name);
+			if (pid <= 0 || _processes.count(pid))
+				continue;
+
+			// 进程崩溃留下的登记和统计区由收集器清理
+			if (kill(pid, 0) != 0 && errno == ESRCH)
+			{
+				SharedStatsRegion::Unlink(pid);
+				continue;
+			}
+
+			// 统计区可能还未初始化完成，下个周期再试
+			CollectedProcess* process = new CollectedProcess(pid);
+			if (!process->_region.Open(pid))
+			{
+				delete process;
+				continue;
+			}
+
+			process->_binary = process->_region.Header()->_exe;
+			_processes[pid] = process;
+			_binaries[process->_binary]._processes.push_back(process);
+		}
+
+		closedir(dir);
+	}
+
+	// 目标进程发布了新数据时，记录新出现的剖析段的合并键
+	void _Update(CollectedProcess* process)
+	{
+		SharedStatsHeader* header = process->_region.Header();
+		uint64_t publishCount = header->_publishCount.load(std::memory_order_acquire);
+		if (publishCount == process->_publishCount)
+			return;
+
+		process->_publishCount = publishCount;
+
+		int count = header->_sectionCount.load(std::memory_order_acquire);
+		if (count > header->_capacity)
+			count = header->_capacity;
+		if ((int)process->_keys.size() < count)
+			process->_keys.resize(count);
+
+		SharedSectionStats stats;
+		for (int i = 0; i < count; ++i)
+		{
+			if (!process->_keys[i].empty())
+				continue;
+
+			if (process->_region.ReadSection(i, stats, false) && stats._name[0] != '\0')
+				process->_keys[i] = SectionKey(stats);
+		}
+	}
+
+	//
+	// 进程退出后统计区已被删除，但映射仍然有效，
+	// 读取最终统计并入所属程序，保证预派生的工作进程轮换后累计值不丢失。
+	// pid被复用时@removeRegion为false，不能删除新进程的统计区和登记。
+	//
+	void _Retire(CollectedProcess* process, bool removeRegion)
+	{
+		BinaryStats& binary = _binaries[process->_binary];
+		_Update(process);
+
+		SharedSectionStats* stats = new SharedSectionStats;
+		for (int i = 0; i < (int)process->_keys.size(); ++i)
+		{
+			if (!process->_keys[i].empty() && process->_region.ReadSection(i, *stats))
+				binary._retired[process->_keys[i]].Add(*stats);
+		}
+		delete stats;
+
+		vector<CollectedProcess*>& processes = binary._processes;
+		processes.erase(find(processes.begin(), processes.end(), process));
+		++binary._exitedCount;
+
+		// 正常退出的进程已自行删除，这里清理崩溃进程的残留
+		if (removeRegion)
+			SharedStatsRegion::Unlink(process->_pid);
+		delete process;
+	}
+
+	// 按合并调用次数的增量计算各剖析段上个周期的调用速率，只读取计数
+	void _UpdateRates()
+	{
+		long long now = _MonotonicTimeNs();
+		double seconds = _lastCollectTime ? (now - _lastCollectTime) / 1e9 : 0;
+		_lastCollectTime = now;
+
+		map<string, BinaryStats>::iterator it = _binaries.begin();
+		for (; it != _binaries.end(); ++it)
+		{
+			BinaryStats& binary = it->second;
+
+			map<string, long long> callCounts;
+			map<string, MergedSection>::iterator retiredIt = binary._retired.begin();
+			for (; retiredIt != binary._retired.end(); ++retiredIt)
+			{
+				callCounts[retiredIt->first] += retiredIt->second._callCount;
+			}
+
+			SharedSectionStats stats;
+			for (size_t i = 0; i < binary._processes.size(); ++i)
+			{
+				CollectedProcess* process = binary._processes[i];
+				for (int j = 0; j < (int)process->_keys.size(); ++j)
+				{
+					if (!process->_keys[j].empty() && process->_region.ReadSection(j, stats, false))
+						callCounts[process->_keys[j]] += stats._callCount;
+				}
+			}
+
+			map<string, long long>::iterator countIt = callCounts.begin();
+			for (; countIt != callCounts.end(); ++countIt)
+			{
+				SectionRate& rate = binary._rates[countIt->first];
+				if (rate._lastCallCount >= 0 && seconds > 0)
+					rate._rate = (countIt->second - rate._lastCallCount) / seconds;
+				rate._lastCallCount = countIt->second;
+			}
+		}
+	}
+
+	// 合并一个程序的所有进程的统计，包括已退出的进程
+	void _Merge(BinaryStats& binary, map<string, MergedSection>& sections)
+	{
+		map<string, MergedSection>::iterator retiredIt = binary._retired.begin();
+		for (; retiredIt != binary._retired.end(); ++retiredIt)
+		{
+			sections[retiredIt->first].Add(retiredIt->second);
+		}
+
+		SharedSectionStats* stats = new SharedSectionStats;
+		for (size_t i = 0; i < binary._processes.size(); ++i)
+		{
+			CollectedProcess* process = binary._processes[i];
+			for (int j = 0; j < (int)process->_keys.size(); ++j)
+			{
+				if (process->_keys[j].empty() || !process->_region.ReadSection(j, *stats))
+					continue;
+
+				MergedSection& section = sections[process->_keys[j]];
+				section.Add(*stats);
+				++section._processCount;
+			}
+		}
+		delete stats;
+	}
+
+	void _State(string& reply)
+	{
+		char buf[256];
+		snprintf(buf, sizeof(buf),
+			"Collector Period:%dms, Collect Count:%llu, Binaries:%d, Processes:%d",
+			_period, (unsigned long long)_collectCount, (int)_binaries.size(), (int)_processes.size());
+		reply = buf;
+	}
+
+	void _List(string& reply)
+	{
+		char buf[512];
+		snprintf(buf, sizeof(buf), "%8s %8s %8s  %s\n", "LIVE", "EXITED", "SECTIONS", "BINARY");
+		reply += buf;
+
+		map<string, BinaryStats>::iterator it = _binaries.begin();
+		for (; it != _binaries.end(); ++it)
+		{
+			snprintf(buf, sizeof(buf), "%8d %8d %8d  %s\n", (int)it->second._processes.size(),
+				it->second._exitedCount, (int)it->second._rates.size(), it->first.c_str());
+			reply += buf;
+		}
+	}
+
+	void _Processes(string& reply)
+	{
+		char buf[512];
+		snprintf(buf, sizeof(buf), "%8s %6s %10s %8s %10s  %s\n",
+			"PID", "CPU%", "RSS(K)", "SECTIONS", "PUBLISH", "BINARY");
+		reply += buf;
+
+		map<int, CollectedProcess*>::iterator it = _processes.begin();
+		for (; it != _processes.end(); ++it)
+		{
+			CollectedProcess* process = it->second;
+			SharedStatsHeader* header = process->_region.Header();
+			snprintf(buf, sizeof(buf), "%8d %6lld %10lld %8d %10llu  %s\n", process->_pid,
+				(long long)header->_processCpu.load(), (long long)header->_processMemory.load(),
+				header->_sectionCount.load(), (unsigned long long)header->_publishCount.load(),
+				process->_binary.c_str());
+			reply += buf;
+		}
+	}
+
+	static bool CompareByCostTime(const pair<string, MergedSection*>& lhs,
+		const pair<string, MergedSection*>& rhs)
+	{
+		return lhs.second->_costTime > rhs.second->_costTime;
+	}
+
+	// 每个程序按墙上时间列出合并后的前PP_COLLECTOR_REPORT_TOP个剖析段
+	void _Report(string& reply)
+	{
+		char buf[1024];
+
+		map<string, BinaryStats>::iterator it = _binaries.begin();
+		for (; it != _binaries.end(); ++it)
+		{
+			BinaryStats& binary = it->second;
+			map<string, MergedSection> sections;
+			_Merge(binary, sections);
+
+			snprintf(buf, sizeof(buf), "Binary:%s, Live Processes:%d, Exited Processes:%d\n",
+				it->first.c_str(), (int)binary._processes.size(), binary._exitedCount);
+			reply += buf;
+			snprintf(buf, sizeof(buf), "%12s %10s %12s %12s %12s %7s %5s  %s\n",
+				"CALLS", "CALLS/S", "AVG(us)", "P50(us)", "P99(us)", "CPU%", "PROCS", "NAME");
+			reply += buf;
+
+			vector<pair<string, MergedSection*> > sorted;
+			map<string, MergedSection>::iterator sectionIt = sections.begin();
+			for (; sectionIt != sections.end(); ++sectionIt)
+			{
+				sorted.push_back(make_pair(sectionIt->first, &sectionIt->second));
+			}
+			sort(sorted.begin(), sorted.end(), CompareByCostTime);
+
+			HistogramSnapshot* h = new HistogramSnapshot;
+			for (size_t i = 0; i < sorted.size() && i < PP_COLLECTOR_REPORT_TOP; ++i)
+			{
+				MergedSection& section = *sorted[i].second;
+				_BuildHistogram(section, *h);
+
+				double avg = section._callCount ? (double)section._costTime / section._callCount : 0;
+				double cpu = section._costTime ? section._cpuTime * 100.0 / section._costTime : 0;
+				map<string, SectionRate>::iterator rateIt = binary._rates.find(sorted[i].first);
+				double rate = rateIt != binary._rates.end() ? rateIt->second._rate : 0;
+				snprintf(buf, sizeof(buf), "%12lld %10.1f %12.3f %12.3f %12.3f %7.1f %5d  %s (%s)\n",
+					section._callCount, rate, avg / 1000.0,
+					h->Percentile(50) / 1000.0, h->Percentile(99) / 1000.0, cpu,
+					section._processCount, section._name.c_str(), section._location.c_str());
+				reply += buf;
+			}
+			delete h;
+
+			reply += "\n";
+		}
+
+		if (reply.empty())
+			reply = "No Profiled Process";
+	}
+
+	// 共享内存中没有最小最大值，用非空桶的边界代替
+	static void _BuildHistogram(const MergedSection& section, HistogramSnapshot& h)
+	{
+		h.Reset();
+		for (int i = 0; i < HISTOGRAM_BUCKET_COUNT; ++i)
+		{
+			h._counts[i] = section._histogram[i];
+			h._count += section._histogram[i];
+		}
+
+		for (int i = 0; i < HISTOGRAM_BUCKET_COUNT; ++i)
+		{
+			if (h._counts[i])
+			{
+				h._min = i ? HistogramBucketUpperValue(i - 1) + 1 : 0;
+				break;
+			}
+		}
+		for (int i = HISTOGRAM_BUCKET_COUNT - 1; i >= 0; --i)
+		{
+			if (h._counts[i])
+			{
+				h._max = HistogramBucketUpperValue(i);
+				break;
+			}
+		}
+	}
+
+	static long long _MonotonicTimeNs()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+	}
+
+private:
+	int _period;								// 收集周期(毫秒)
+	uint64_t _collectCount;						// 收集次数
+	long long _lastCollectTime;					// 上次计算速率的时间(纳秒)
+
+	mutex _mutex;								// 保护以下数据，收集线程和IPC线程共用
+	map<int, CollectedProcess*> _processes;		// 按pid索引的存活进程
+	map<string, BinaryStats> _binaries;			// 按可执行文件路径索引
+
+	IPCServer _server;							// 提供合并视图的IPC服务
+};
+
+void UsageHelp()
+{
+	printf("Usage: PerformanceCollector [-interval ms].\n");
+	printf("Example: PerformanceCollector -interval 1000.\n");
+
+	exit(0);
+}
+
+int main(int argc, char** argv)
+{
+	int period = PP_COLLECTOR_PERIOD;
+	for (int i = 1; i < argc; i += 2)
+	{
+		if (!strcmp(argv[i], "-interval") && i + 1 < argc)
+		{
+			period = atoi(argv[i + 1]);
+			if (period <= 0)
+				UsageHelp();
+		}
+		else
+		{
+			UsageHelp();
+		}
+	}
+
+	// 退出信号由收集线程同步等待，IPC线程继承屏蔽字
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+	PerformanceCollector collector(period);
+	collector.Run();
+
+	return 0;
+}
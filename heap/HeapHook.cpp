@@ -0,0 +1,187 @@
+#include <malloc.h>
+#include <errno.h>
+#include <new>
+
+#include "Performance.h"
+
+//
+// 堆分配拦截
+// 编译为libperformance_heap.so，链接到程序或用LD_PRELOAD预加载后，
+// malloc/free/realloc等和operator new/delete都经过这里，
+// 开启PPCO_HEAP_PROFILER时把分配和释放记到当前线程最内层的活动剖析段。
+// 实际的分配由glibc的__libc_*完成，不需要dlsym，也就不会在初始化时递归。
+//
+extern "C"
+{
+	void* __libc_malloc(size_t size);
+	void __libc_free(void* ptr);
+	void* __libc_calloc(size_t count, size_t size);
+	void* __libc_realloc(void* ptr, size_t size);
+	void* __libc_memalign(size_t alignment, size_t size);
+	void* __libc_valloc(size_t size);
+	void* __libc_pvalloc(size_t size);
+}
+
+// 按块的可用大小记账，分配和释放的字节数才能对得上
+static inline void* RecordAlloc(void* ptr)
+{
+	if (ptr && OptionManager::IsEnabled(PPCO_HEAP_PROFILER))
+	{
+		OnHeapAlloc(malloc_usable_size(ptr));
+	}
+
+	return ptr;
+}
+
+static inline void RecordFree(void* ptr)
+{
+	if (ptr && OptionManager::IsEnabled(PPCO_HEAP_PROFILER))
+	{
+		OnHeapFree(malloc_usable_size(ptr));
+	}
+}
+
+extern "C"
+{
+
+void* malloc(size_t size)
+{
+	return RecordAlloc(__libc_malloc(size));
+}
+
+void free(void* ptr)
+{
+	RecordFree(ptr);
+	__libc_free(ptr);
+}
+
+void* calloc(size_t count, size_t size)
+{
+	return RecordAlloc(__libc_calloc(count, size));
+}
+
+void* realloc(void* ptr, size_t size)
+{
+	// 原地扩展也按一次释放加一次分配记账
+	size_t oldSize = ptr ? malloc_usable_size(ptr) : 0;
+	void* newPtr = __libc_realloc(ptr, size);
+	if ((newPtr || size == 0) && OptionManager::IsEnabled(PPCO_HEAP_PROFILER))
+	{
+		if (ptr)
+			OnHeapFree(oldSize);
+		if (newPtr)
+			OnHeapAlloc(malloc_usable_size(newPtr));
+	}
+
+	return newPtr;
+}
+
+void* memalign(size_t alignment, size_t size)
+{
+	return RecordAlloc(__libc_memalign(alignment, size));
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+	return RecordAlloc(__libc_memalign(alignment, size));
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size)
+{
+	if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0)
+		return EINVAL;
+
+	void* buf = RecordAlloc(__libc_memalign(alignment, size));
+	if (buf == NULL)
+		return ENOMEM;
+
+	*ptr = buf;
+	return 0;
+}
+
+void* valloc(size_t size)
+{
+	return RecordAlloc(__libc_valloc(size));
+}
+
+void* pvalloc(size_t size)
+{
+	return RecordAlloc(__libc_pvalloc(size));
+}
+
+}
+
+//
+// operator new/delete直接走上面的malloc/free，每次分配只记一次账。
+//
+static void* OperatorNew(size_t size)
+{
+	if (size == 0)
+		size = 1;
+
+	while (1)
+	{
+		void* ptr = malloc(size);
+		if (ptr)
+			return ptr;
+
+		std::new_handler handler = std::set_new_handler(NULL);
+		std::set_new_handler(handler);
+		if (handler == NULL)
+			throw std::bad_alloc();
+
+		handler();
+	}
+}
+
+static void* OperatorNewNothrow(size_t size)
+{
+	try
+	{
+		return OperatorNew(size);
+	}
+	catch (...)
+	{
+		return NULL;
+	}
+}
+
+void* operator new(size_t size)
+{
+	return OperatorNew(size);
+}
+
+void* operator new[](size_t size)
+{
+	return OperatorNew(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	return OperatorNewNothrow(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+	return OperatorNewNothrow(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+	free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{
+	free(ptr);
+}
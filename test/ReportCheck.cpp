@@ -0,0 +1,562 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <thread>
+
+#include "../Performance.h"
+#include "../Report.h"
+
+//
+// 报告正确性检查，失败时输出位置并以非0退出码结束，由ctest运行
+//
+
+#define CHECK_REPORT_DIRECTORY "/tmp/performance_profiler"
+
+static int s_failures = 0;
+
+#define CHECK(cond)																\
+	do{																			\
+		if (!(cond))															\
+		{																		\
+			fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond);	\
+			++s_failures;														\
+		}																		\
+	}while(0)
+
+///////////////////////////////////////////////////////////////
+// 百分位数精度
+
+// 桶内最大值与真实值的相对误差不超过一个子桶的宽度
+static bool WithinBucketError(long long value, long long expected)
+{
+	return value >= expected
+		&& value <= expected + expected / HISTOGRAM_SUB_BUCKETS + 1;
+}
+
+static void CheckUniformPercentiles()
+{
+	LatencyHistogram histogram;
+	for (long long v = 1; v <= 100000; ++v)
+	{
+		histogram.Record(v);
+	}
+
+	HistogramSnapshot h;
+	h.Merge(histogram);
+
+	CHECK(h._count == 100000);
+	CHECK(h._min == 1);
+	CHECK(h._max == 100000);
+	CHECK(fabs(h.Mean() - 50000.5) < 0.01);
+	CHECK(fabs(h.StdDev() - 28867.5) < 1.0);
+
+	CHECK(WithinBucketError(h.Percentile(50), 50000));
+	CHECK(WithinBucketError(h.Percentile(90), 90000));
+	CHECK(WithinBucketError(h.Percentile(99), 99000));
+	CHECK(WithinBucketError(h.Percentile(99.9), 99900));
+	CHECK(h.Percentile(100) == 100000);
+}
+
+static void CheckTailPercentiles()
+{
+	// 990次100ns，10次1ms，P99落在快的一侧，P99.9是慢的一侧并限定在最大值内
+	LatencyHistogram histogram;
+	for (int i = 0; i < 990; ++i)
+	{
+		histogram.Record(100);
+	}
+	for (int i = 0; i < 10; ++i)
+	{
+		histogram.Record(1000000);
+	}
+
+	HistogramSnapshot h;
+	h.Merge(histogram);
+
+	CHECK(WithinBucketError(h.Percentile(50), 100));
+	CHECK(WithinBucketError(h.Percentile(99), 100));
+	CHECK(h.Percentile(99.9) == 1000000);
+	CHECK(h._min == 100);
+	CHECK(h._max == 1000000);
+}
+
+static void CheckMergedPercentiles()
+{
+	// 两个线程的直方图合并后与记录到同一个直方图的结果相同
+	LatencyHistogram even, odd, all;
+	for (long long v = 1; v <= 10000; ++v)
+	{
+		(v % 2 ? odd : even).Record(v * 7);
+		all.Record(v * 7);
+	}
+
+	HistogramSnapshot merged, single;
+	merged.Merge(even);
+	merged.Merge(odd);
+	single.Merge(all);
+
+	CHECK(merged._count == single._count);
+	CHECK(merged._min == single._min);
+	CHECK(merged._max == single._max);
+	CHECK(memcmp(merged._counts, single._counts, sizeof(merged._counts)) == 0);
+	CHECK(merged.Percentile(99) == single.Percentile(99));
+}
+
+///////////////////////////////////////////////////////////////
+// 结构化报告，编译期关闭剖析时没有剖析段，不做检查
+
+#ifndef PP_DISABLE_PROFILER
+
+static bool ReadFile(const char* path, string& content)
+{
+	ifstream in(path);
+	if (!in)
+		return false;
+
+	stringstream ss;
+	ss << in.rdbuf();
+	content = ss.str();
+	return true;
+}
+
+// 按RFC 4180拆分一行CSV
+static vector<string> SplitCsvLine(const string& line)
+{
+	vector<string> fields;
+	string field;
+	bool quoted = false;
+	for (size_t i = 0; i < line.size(); ++i)
+	{
+		char c = line[i];
+		if (quoted)
+		{
+			if (c == '"' && i + 1 < line.size() && line[i + 1] == '"')
+			{
+				field += '"';
+				++i;
+			}
+			else if (c == '"')
+			{
+				quoted = false;
+			}
+			else
+			{
+				field += c;
+			}
+		}
+		else if (c == '"')
+		{
+			quoted = true;
+		}
+		else if (c == ',')
+		{
+			fields.push_back(field);
+			field.clear();
+		}
+		else
+		{
+			field += c;
+		}
+	}
+	fields.push_back(field);
+
+	return fields;
+}
+
+//
+// 只覆盖报告用到的JSON子集：对象、数组、字符串、数字、true/false/null。
+// 解析失败时_ok为false。
+//
+struct JsonValue
+{
+	enum Type { NUL, BOOL, NUMBER, STRING, ARRAY, OBJECT };
+
+	Type _type;
+	double _number;
+	string _string;
+	vector<JsonValue> _array;
+	map<string, JsonValue> _object;
+
+	JsonValue()
+		:_type(NUL)
+		, _number(0)
+	{}
+
+	const JsonValue& operator[](const char* key) const
+	{
+		static const JsonValue s_null;
+		map<string, JsonValue>::const_iterator it = _object.find(key);
+		return it == _object.end() ? s_null : it->second;
+	}
+};
+
+class JsonParser
+{
+public:
+	JsonParser(const string& text)
+		:_text(text)
+		, _pos(0)
+		, _ok(true)
+	{}
+
+	bool Parse(JsonValue& value)
+	{
+		_ParseValue(value);
+		_SkipSpace();
+		return _ok && _pos == _text.size();
+	}
+
+private:
+	void _SkipSpace()
+	{
+		while (_pos < _text.size() && strchr(" \t\r\n", _text[_pos]))
+			++_pos;
+	}
+
+	bool _Expect(char c)
+	{
+		_SkipSpace();
+		if (_pos < _text.size() && _text[_pos] == c)
+		{
+			++_pos;
+			return true;
+		}
+
+		_ok = false;
+		return false;
+	}
+
+	void _ParseString(string& str)
+	{
+		if (!_Expect('"'))
+			return;
+
+		while (_pos < _text.size() && _text[_pos] != '"')
+		{
+			char c = _text[_pos++];
+			if (c == '\\' && _pos < _text.size())
+			{
+				c = _text[_pos++];
+				if (c == 'u')
+				{
+					// 报告只转义控制字符，按一个占位字符处理
+					_pos += 4;
+					c = '?';
+				}
+				else if (c == 'n')
+					c = '\n';
+				else if (c == 't')
+					c = '\t';
+				else if (c == 'r')
+					c = '\r';
+			}
+			str += c;
+		}
+
+		_Expect('"');
+	}
+
+	void _ParseValue(JsonValue& value)
+	{
+		_SkipSpace();
+		if (!_ok || _pos >= _text.size())
+		{
+			_ok = false;
+			return;
+		}
+
+		char c = _text[_pos];
+		if (c == '{')
+		{
+			value._type = JsonValue::OBJECT;
+			++_pos;
+			_SkipSpace();
+			if (_pos < _text.size() && _text[_pos] == '}')
+			{
+				++_pos;
+				return;
+			}
+
+			do
+			{
+				string key;
+				_ParseString(key);
+				_Expect(':');
+				if (value._object.count(key))
+					_ok = false;
+				_ParseValue(value._object[key]);
+				_SkipSpace();
+			} while (_ok && _pos < _text.size() && _text[_pos] == ',' && ++_pos);
+
+			_Expect('}');
+		}
+		else if (c == '[')
+		{
+			value._type = JsonValue::ARRAY;
+			++_pos;
+			_SkipSpace();
+			if (_pos < _text.size() && _text[_pos] == ']')
+			{
+				++_pos;
+				return;
+			}
+
+			do
+			{
+				value._array.push_back(JsonValue());
+				_ParseValue(value._array.back());
+				_SkipSpace();
+			} while (_ok && _pos < _text.size() && _text[_pos] == ',' && ++_pos);
+
+			_Expect(']');
+		}
+		else if (c == '"')
+		{
+			value._type = JsonValue::STRING;
+			_ParseString(value._string);
+		}
+		else if (_text.compare(_pos, 4, "true") == 0 || _text.compare(_pos, 5, "false") == 0)
+		{
+			value._type = JsonValue::BOOL;
+			value._number = c == 't';
+			_pos += c == 't' ? 4 : 5;
+		}
+		else if (_text.compare(_pos, 4, "null") == 0)
+		{
+			_pos += 4;
+		}
+		else
+		{
+			char* end = NULL;
+			value._type = JsonValue::NUMBER;
+			value._number = strtod(_text.c_str() + _pos, &end);
+			if (end == _text.c_str() + _pos)
+				_ok = false;
+			_pos = end - _text.c_str();
+		}
+	}
+
+private:
+	const string& _text;
+	size_t _pos;
+	bool _ok;
+};
+
+// 对象的字段名集合
+static set<string> KeysOf(const JsonValue& value)
+{
+	set<string> keys;
+	map<string, JsonValue>::const_iterator it = value._object.begin();
+	for (; it != value._object.end(); ++it)
+	{
+		keys.insert(it->first);
+	}
+
+	return keys;
+}
+
+// @values中每个对象的字段与第一个对象相同
+static bool SameKeys(const vector<JsonValue>& values)
+{
+	for (size_t i = 1; i < values.size(); ++i)
+	{
+		if (values[i]._type != JsonValue::OBJECT || KeysOf(values[i]) != KeysOf(values[0]))
+			return false;
+	}
+
+	return true;
+}
+
+static void Spin(int ms)
+{
+	LongType end = PerformanceTimer::MonotonicTimeNs() + ms * 1000000LL;
+	while (PerformanceTimer::MonotonicTimeNs() < end)
+		;
+}
+
+//
+// 生成检查用的剖析段：普通段、名字需要转义的段、多线程的资源统计段，
+// 资源统计只报告存活的线程，在线程还在段内时生成报告
+//
+static void GenerateReport()
+{
+	for (int i = 0; i < 100; ++i)
+	{
+		PERFORMANCE_EE_BEGIN(Plain, "plain");
+		PERFORMANCE_EE_END(Plain);
+	}
+
+	PERFORMANCE_EE_BEGIN(Escaped, "comma, \"quote\"");
+	Spin(1);
+	PERFORMANCE_EE_END(Escaped);
+
+	atomic<bool> stop(false);
+	vector<std::thread> threads;
+	for (int i = 0; i < 2; ++i)
+	{
+		threads.push_back(std::thread([&stop]()
+		{
+			PERFORMANCE_EE_RS_BEGIN(Resource, "resource");
+			while (!stop.load())
+				Spin(10);
+			PERFORMANCE_EE_RS_END(Resource);
+		}));
+	}
+
+	// 等待资源采样线程至少采样两次
+	usleep(500000);
+	Performance::OutPut();
+	CHECK(ReportWriter::GetInstance()->Flush(10000));
+
+	stop = true;
+	for (size_t i = 0; i < threads.size(); ++i)
+	{
+		threads[i].join();
+	}
+}
+
+static void CheckCsvReport()
+{
+	string csv;
+	CHECK(ReadFile(CHECK_REPORT_DIRECTORY "/PerformanceReport.csv", csv));
+
+	istringstream in(csv);
+	string line;
+	CHECK(getline(in, line));
+	vector<string> header = SplitCsvLine(line);
+	CHECK(header.size() > 0 && header[0] == "scope");
+	CHECK(header.back() == "histogram");
+
+	// tid列是内核线程id，资源统计段各线程的行能按它对应到线程行
+	size_t tidColumn = find(header.begin(), header.end(), "tid") - header.begin();
+	CHECK(tidColumn < header.size());
+
+	map<string, int> scopes;
+	set<string> threadTids, resourceTids;
+	int lineNo = 1;
+	while (getline(in, line))
+	{
+		++lineNo;
+		vector<string> fields = SplitCsvLine(line);
+		if (fields.size() != header.size())
+		{
+			fprintf(stderr, "csv line %d has %d columns, header has %d: %s\n",
+				lineNo, (int)fields.size(), (int)header.size(), line.c_str());
+			++s_failures;
+			continue;
+		}
+
+		++scopes[fields[0]];
+		if (fields[0] == "section" && fields[2] == "comma, \"quote\"")
+			++scopes["escaped"];
+
+		if (tidColumn < fields.size() && fields[2] == "resource")
+		{
+			if (fields[0] == "thread")
+				threadTids.insert(fields[tidColumn]);
+			else if (fields[0] == "resource_thread")
+				resourceTids.insert(fields[tidColumn]);
+		}
+	}
+
+	CHECK(scopes["section"] >= 3);
+	CHECK(scopes["thread"] >= 4);
+	CHECK(scopes["resource_thread"] >= 1);
+	CHECK(scopes["escaped"] == 1);
+	CHECK(!resourceTids.empty() && resourceTids == threadTids);
+}
+
+static void CheckJsonReport()
+{
+	string text;
+	CHECK(ReadFile(CHECK_REPORT_DIRECTORY "/PerformanceReport.json", text));
+
+	JsonValue report;
+	CHECK(JsonParser(text).Parse(report));
+	CHECK(report["schema"]._string == "performance_report");
+	CHECK(report["version"]._number == PP_REPORT_SCHEMA_VERSION);
+
+	const vector<JsonValue>& sections = report["sections"]._array;
+	CHECK(sections.size() >= 3);
+	CHECK(SameKeys(sections));
+
+	bool foundPlain = false;
+	vector<JsonValue> latencies, threads, resourceThreads;
+	for (size_t i = 0; i < sections.size(); ++i)
+	{
+		const JsonValue& section = sections[i];
+		latencies.push_back(section["latency_ns"]);
+		threads.insert(threads.end(), section["threads"]._array.begin(), section["threads"]._array.end());
+
+		const JsonValue& resources = section["resources"];
+		if (resources._type == JsonValue::OBJECT)
+		{
+			resourceThreads.insert(resourceThreads.end(),
+				resources["threads"]._array.begin(), resources["threads"]._array.end());
+		}
+
+		if (section["name"]._string == "plain")
+		{
+			foundPlain = true;
+			CHECK(section["call_count"]._number == 100);
+
+			// 延迟分布各桶计数之和等于计时次数，百分位数单调
+			const JsonValue& latency = section["latency_ns"];
+			double total = 0;
+			for (size_t j = 0; j < latency["buckets"]._array.size(); ++j)
+			{
+				total += latency["buckets"]._array[j]._array[1]._number;
+			}
+			CHECK(total == latency["count"]._number);
+			CHECK(latency["min"]._number <= latency["p50"]._number);
+			CHECK(latency["p50"]._number <= latency["p90"]._number);
+			CHECK(latency["p90"]._number <= latency["p99"]._number);
+			CHECK(latency["p99"]._number <= latency["p999"]._number);
+			CHECK(latency["p999"]._number <= latency["max"]._number);
+		}
+	}
+
+	CHECK(foundPlain);
+	CHECK(SameKeys(latencies));
+	CHECK(threads.size() >= 4 && SameKeys(threads));
+	CHECK(resourceThreads.size() >= 1 && SameKeys(resourceThreads));
+}
+
+#endif // PP_DISABLE_PROFILER
+
+int main()
+{
+	CheckUniformPercentiles();
+	CheckTailPercentiles();
+	CheckMergedPercentiles();
+
+#ifndef PP_DISABLE_PROFILER
+	SET_PERFORMANCE_OPTIONS(PPCO_PROFILER | PPCO_SAVE_TO_FILE
+		| PPCO_SAVE_AS_JSON | PPCO_SAVE_AS_CSV);
+	SET_PERFORMANCE_SAMPLE_PERIOD(100);
+
+	GenerateReport();
+
+	CheckCsvReport();
+	CheckJsonReport();
+#endif // PP_DISABLE_PROFILER
+
+	if (s_failures)
+	{
+		fprintf(stderr, "%d check(s) failed\n", s_failures);
+		return 1;
+	}
+
+	printf("all checks passed\n");
+	return 0;
+}
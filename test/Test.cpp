@@ -23,12 +23,27 @@ void Test1()
 	PERFORMANCE_EE_END(PP2);
 }
 
+// 2.ΣǰʱҲȷ
+bool Test2(int n)
+{
+	PERFORMANCE_SCOPE("PP3");
+
+	for(int i = 0; i < n; i++)
+	{
+		if (i == n / 2)
+			return false;
+	}
+
+	return true;
+}
+
 int main()
 {
 	SET_PERFORMANCE_OPTIONS(
 		PPCO_PROFILER | PPCO_SAVE_TO_FILE | PPCO_SAVE_BY_COST_TIME);
 
 	Test1();
+	Test2(100000000);
 	getchar();
 	return 0;
 }
\ No newline at end of file
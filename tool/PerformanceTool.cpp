@@ -3,17 +3,27 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <signal.h>
+#include <termios.h>
+#include <sys/select.h>
+#include <vector>
+#include <map>
+#include <algorithm>
 using namespace std;
 
 #include "../IPCManager.h"
+#include "../SharedStats.h"
 
-const char* SERVER_PIPE_NAME = "/tmp/performance_profiler/_fifo";
+const char* SERVER_SOCKET_NAME = "/tmp/performance_profiler/_sock";
 
 void UsageHelp ()
 {
 	printf ("Usage: PerformanceTool -help\n");
 	printf ("Usage: PerformanceTool -pid pid.\n");
+	printf ("Usage: PerformanceTool -top pid [-sort calls|rate|avg|p99|cpu] [-interval ms].\n");
+	printf ("Usage: PerformanceTool -collector.\n");
 	printf ("Example: PerformanceTool -pid 2345.\n");	
+	printf ("Example: PerformanceTool -top 2345 -sort p99.\n");
 
 	exit (0);
 }
@@ -26,29 +36,58 @@ void UsageHelpInfo ()
 	printf ("    <enable>:  Force enable performance profiler.\n");
 	printf ("    <disable>: Force disable performance profiler.\n");
 	printf ("    <save>:    Save the results to file.\n");
+	printf ("    <report>:  Show the full report.\n");
+	printf ("    <report_json>: Show the report as JSON.\n");
+	printf ("    <report_csv>:  Show the report as CSV.\n");
+	printf ("    <calibrate>: Re-measure the profiler overhead.\n");
+	printf ("    <trace_on>:   Start recording trace events.\n");
+	printf ("    <trace_off>:  Stop recording trace events.\n");
+	printf ("    <trace_save>: Save trace events as Chrome trace JSON.\n");
+	printf ("    <interval_on>:   Start recording 1s/10s/60s interval stats.\n");
+	printf ("    <interval_off>:  Stop recording interval stats.\n");
+	printf ("    <interval>:      Show the latest interval of each window.\n");
+	printf ("    <interval_json>: Show all recorded intervals as JSON.\n");
+	printf ("    <sample_on>:     Start sampling call stacks with SIGPROF timers.\n");
+	printf ("    <sample_off>:    Stop sampling call stacks.\n");
+	printf ("    <sample>:        Show the top functions of the samples.\n");
+	printf ("    <sample_folded>: Show the samples as folded stacks.\n");
+	printf ("    <sample_clear>:  Clear the samples.\n");
 }
 
-void PerformanceToolClient(const string& idStr)
+void CollectorHelpInfo ()
 {
-	char res[1024] ={0};
-	char msg[1024] = {0};
-	size_t msgLen = 0;
+	printf ("    <exit>:      Exit.\n");
+	printf ("    <help>:      Show Usage help Info.\n");
+	printf ("    <state>:     Show the state of the collector.\n");
+	printf ("    <list>:      List the profiled binaries.\n");
+	printf ("    <processes>: List the profiled processes.\n");
+	printf ("    <report>:    Show the sections merged across the processes of each binary.\n");
+}
 
-	string serverPipeName = SERVER_PIPE_NAME;
-	serverPipeName += idStr;
+void PerformanceToolClient(const string& serverSocketName, void (*helpInfo)())
+{
+	string res;
+	char msg[1024] = {0};
 
-	UsageHelpInfo();
+	helpInfo();
 
-	IPCClient client(serverPipeName.c_str());
+	// 整个会话使用同一个连接
+	IPCClient client(serverSocketName.c_str());
+	if (!client.Connect())
+	{
+		printf("Connect to %s failed.\n", serverSocketName.c_str());
+		return;
+	}
 
 	while (1)
 	{
 		printf("shell:>");
-		scanf("%s", msg);
+		if (scanf("%1023s", msg) != 1)
+			break;
 
 		if (strcmp(msg, "help") == 0)
 		{
-			UsageHelpInfo();
+			helpInfo();
 			continue;
 		}
 		if (strcmp(msg, "exit") == 0)
@@ -57,10 +96,290 @@ void PerformanceToolClient(const string& idStr)
 			break;
 		}
 
-		client.SendMsg(msg, strlen(msg));
-		client.GetReplyMsg(res, 1024);
+		if (!client.SendMsg(msg, strlen(msg)) || !client.GetReplyMsg(res))
+		{
+			printf("Connection lost.\n");
+			break;
+		}
+
+		printf("%s\n\n", res.c_str());
+	}
+}
+
+//
+// top视图
+// 只读映射目标进程的共享内存统计区，不向目标进程发送任何命令。
+// 目标进程需要开启PPCO_PUBLISH_SHM。
+//
+enum TopSortKey
+{
+	TOP_SORT_CALLS,
+	TOP_SORT_RATE,
+	TOP_SORT_AVG,
+	TOP_SORT_P99,
+	TOP_SORT_CPU,
+};
+
+static const char* TopSortKeyName(TopSortKey key)
+{
+	switch (key)
+	{
+	case TOP_SORT_CALLS: return "calls";
+	case TOP_SORT_RATE: return "rate";
+	case TOP_SORT_AVG: return "avg";
+	case TOP_SORT_P99: return "p99";
+	case TOP_SORT_CPU: return "cpu";
+	}
+	return "";
+}
+
+static bool ParseTopSortKey(const char* name, TopSortKey& key)
+{
+	for (int k = TOP_SORT_CALLS; k <= TOP_SORT_CPU; ++k)
+	{
+		if (strcmp(name, TopSortKeyName((TopSortKey)k)) == 0)
+		{
+			key = (TopSortKey)k;
+			return true;
+		}
+	}
+	return false;
+}
+
+// 一个剖析段在一个刷新周期内的统计
+struct TopRow
+{
+	string _name;
+	long long _callCount;	// 累计调用次数
+	double _rate;			// 每秒调用次数
+	double _avg;			// 周期内平均耗时(纳秒)
+	long long _p99;			// 周期内P99(纳秒)，周期内没有调用时为累计值
+	double _cpu;			// 周期内CPU时间/墙上时间(%)
+	long long _memory;		// 资源统计段的内存峰值(KB)，-1表示不是资源统计段
+};
+
+static TopSortKey s_topSortKey = TOP_SORT_CALLS;
+
+static bool CompareTopRow(const TopRow& lhs, const TopRow& rhs)
+{
+	switch (s_topSortKey)
+	{
+	case TOP_SORT_RATE: return lhs._rate > rhs._rate;
+	case TOP_SORT_AVG: return lhs._avg > rhs._avg;
+	case TOP_SORT_P99: return lhs._p99 > rhs._p99;
+	case TOP_SORT_CPU: return lhs._cpu > rhs._cpu;
+	default: return lhs._callCount > rhs._callCount;
+	}
+}
+
+static void BuildHistogram(const SharedSectionStats& stats, HistogramSnapshot& h)
+{
+	h.Reset();
+	for (int i = 0; i < HISTOGRAM_BUCKET_COUNT; ++i)
+	{
+		h._counts[i] = stats._histogram[i];
+		h._count += stats._histogram[i];
+	}
+
+	// 没有最小最大值，用非空桶的边界代替
+	for (int i = 0; i < HISTOGRAM_BUCKET_COUNT; ++i)
+	{
+		if (h._counts[i])
+		{
+			h._min = i ? HistogramBucketUpperValue(i - 1) + 1 : 0;
+			break;
+		}
+	}
+	for (int i = HISTOGRAM_BUCKET_COUNT - 1; i >= 0; --i)
+	{
+		if (h._counts[i])
+		{
+			h._max = HistogramBucketUpperValue(i);
+			break;
+		}
+	}
+}
+
+// -top切换终端模式前的设置，退出或被信号终止时恢复
+static struct termios s_oldTermios;
+static volatile sig_atomic_t s_termiosSaved = 0;
+
+static void RestoreTermios()
+{
+	if (s_termiosSaved)
+	{
+		tcsetattr(STDIN_FILENO, TCSANOW, &s_oldTermios);
+		s_termiosSaved = 0;
+	}
+}
+
+// 恢复终端后按默认处理重新发出信号，退出状态与未处理时相同
+static void OnTopSignal(int sig)
+{
+	RestoreTermios();
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+static void PerformanceTop(int pid, int interval)
+{
+	SharedStatsRegion region;
+	if (!region.Open(pid))
+	{
+		printf("Open shared stats of pid %d failed, "
+			"the target must enable PPCO_PUBLISH_SHM.\n", pid);
+		return;
+	}
+
+	// 终端切换到非规范模式，按键立即生效
+	bool isTty = isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &s_oldTermios) == 0;
+	if (isTty)
+	{
+		s_termiosSaved = 1;
+		signal(SIGINT, OnTopSignal);
+		signal(SIGTERM, OnTopSignal);
+
+		struct termios raw = s_oldTermios;
+		raw.c_lflag &= ~(ICANON | ECHO);
+		raw.c_cc[VMIN] = 0;
+		raw.c_cc[VTIME] = 0;
+		tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+	}
+
+	map<int, SharedSectionStats*> lastStats;
+	long long lastPublishTime = 0;
+	uint64_t lastPublishCount = 0;
+	vector<TopRow> rows;
+
+	while (1)
+	{
+		SharedStatsHeader* header = region.Header();
+		uint64_t publishCount = header->_publishCount.load(std::memory_order_acquire);
+
+		// 目标进程发布了新数据才重新计算
+		if (publishCount != lastPublishCount)
+		{
+			long long publishTime = header->_publishTime.load(std::memory_order_relaxed);
+			double seconds = lastPublishTime ? (publishTime - lastPublishTime) / 1e9 : 0;
+
+			rows.clear();
+			int count = header->_sectionCount.load(std::memory_order_acquire);
+			for (int i = 0; i < count && i < header->_capacity; ++i)
+			{
+				SharedSectionStats* stats = new SharedSectionStats;
+				if (!region.ReadSection(i, *stats) || stats->_name[0] == '\0')
+				{
+					delete stats;
+					continue;
+				}
+
+				SharedSectionStats* last = lastStats[i];
+				TopRow row;
+				row._name = stats->_name;
+				row._callCount = stats->_callCount;
+				row._memory = stats->_memoryPeak;
+
+				long long calls = stats->_callCount - (last ? last->_callCount : 0);
+				long long cost = stats->_costTime - (last ? last->_costTime : 0);
+				long long cpu = stats->_cpuTime - (last ? last->_cpuTime : 0);
+				row._rate = seconds > 0 ? calls / seconds : 0;
+				row._avg = calls ? (double)cost / calls : 0;
+				row._cpu = cost ? cpu * 100.0 / cost : 0;
+
+				HistogramSnapshot h;
+				BuildHistogram(*stats, h);
+				if (last && calls)
+				{
+					// 周期内的延迟分布 = 本次累计 - 上次累计
+					HistogramSnapshot lh;
+					BuildHistogram(*last, lh);
+					for (int b = 0; b < HISTOGRAM_BUCKET_COUNT; ++b)
+					{
+						h._counts[b] -= lh._counts[b];
+					}
+					h._count -= lh._count;
+				}
+				row._p99 = h.Percentile(99);
+
+				rows.push_back(row);
+
+				delete last;
+				lastStats[i] = stats;
+			}
+
+			lastPublishTime = publishTime;
+			lastPublishCount = publishCount;
+		}
+
+		sort(rows.begin(), rows.end(), CompareTopRow);
+
+		printf("\033[H\033[2J");
+		printf("PerformanceTool top - pid %d (%s)\n", header->_pid, header->_exe);
+		printf("Cpu: %lld%%, Rss: %lldK, Sections: %d, Publish: %llu\n",
+			(long long)header->_processCpu.load(), (long long)header->_processMemory.load(),
+			header->_sectionCount.load(), (unsigned long long)publishCount);
+		printf("Sort: %s    [c]alls [r]ate [a]vg [p]99 c[u]p [q]uit\n\n", TopSortKeyName(s_topSortKey));
+		printf("%12s %10s %12s %12s %7s %10s  %s\n",
+			"CALLS", "CALLS/S", "AVG(us)", "P99(us)", "CPU%", "RSS(K)", "NAME");
+		for (size_t i = 0; i < rows.size(); ++i)
+		{
+			const TopRow& row = rows[i];
+			char memory[32] = "-";
+			if (row._memory >= 0)
+				snprintf(memory, sizeof(memory), "%lld", row._memory);
+
+			printf("%12lld %10.1f %12.3f %12.3f %7.1f %10s  %s\n",
+				row._callCount, row._rate, row._avg / 1000.0, row._p99 / 1000.0,
+				row._cpu, memory, row._name.c_str());
+		}
+		fflush(stdout);
+
+		// 等待按键或刷新周期到达
+		fd_set fds;
+		FD_ZERO(&fds);
+		FD_SET(STDIN_FILENO, &fds);
+		struct timeval tv;
+		tv.tv_sec = interval / 1000;
+		tv.tv_usec = (interval % 1000) * 1000;
+		if (select(STDIN_FILENO + 1, isTty ? &fds : NULL, NULL, NULL, &tv) > 0)
+		{
+			char key = 0;
+			if (read(STDIN_FILENO, &key, 1) == 1)
+			{
+				if (key == 'q')
+					break;
+				else if (key == 'c')
+					s_topSortKey = TOP_SORT_CALLS;
+				else if (key == 'r')
+					s_topSortKey = TOP_SORT_RATE;
+				else if (key == 'a')
+					s_topSortKey = TOP_SORT_AVG;
+				else if (key == 'p')
+					s_topSortKey = TOP_SORT_P99;
+				else if (key == 'u')
+					s_topSortKey = TOP_SORT_CPU;
+			}
+		}
+
+		// 目标进程退出后统计区被删除
+		if (kill(pid, 0) != 0)
+		{
+			printf("\nProcess %d exited.\n", pid);
+			break;
+		}
+	}
+
+	if (isTty)
+	{
+		RestoreTermios();
+		signal(SIGINT, SIG_DFL);
+		signal(SIGTERM, SIG_DFL);
+	}
 
-		printf("%s\n\n", res);
+	map<int, SharedSectionStats*>::iterator it = lastStats.begin();
+	for (; it != lastStats.end(); ++it)
+	{
+		delete it->second;
 	}
 }
 
@@ -72,6 +391,37 @@ int main(int argc, char** argv)
 		UsageHelpInfo();
 
 	}
+	else if (argc >= 3 && !strcmp(argv[1], "-top"))
+	{
+		int interval = 1000;
+		for (int i = 3; i + 1 < argc; i += 2)
+		{
+			if (!strcmp(argv[i], "-sort"))
+			{
+				if (!ParseTopSortKey(argv[i + 1], s_topSortKey))
+					UsageHelp();
+			}
+			else if (!strcmp(argv[i], "-interval"))
+			{
+				interval = atoi(argv[i + 1]);
+				if (interval <= 0)
+					UsageHelp();
+			}
+			else
+			{
+				UsageHelp();
+			}
+		}
+
+		PerformanceTop(atoi(argv[2]), interval);
+		return 0;
+	}
+	else if (argc == 2 && !strcmp(argv[1], "-collector"))
+	{
+		// 连接本机的PerformanceCollector，查看按程序合并的统计
+		PerformanceToolClient(PP_COLLECTOR_SOCKET_NAME, CollectorHelpInfo);
+		return 0;
+	}
 	else if (argc == 3 && !strcmp(argv[1], "-pid"))
 	{
 		idStr += argv[2];
@@ -81,7 +431,7 @@ int main(int argc, char** argv)
 		UsageHelp();
 	}
 
-	PerformanceToolClient(idStr);
+	PerformanceToolClient(SERVER_SOCKET_NAME + idStr, UsageHelpInfo);
 
 	return 0;
 }
\ No newline at end of file